@@ -118,7 +118,8 @@ namespace Nat
 
 /-
 We have pure functions for calculating the decimal representation of a `Nat` (`toDigits`), but also
-a fast variant that handles small numbers (`USize`) via C code (`lean_string_of_usize`).
+fast variants that use C code for small numbers (`USize`, `lean_string_of_usize`) and for big ones
+(`lean_string_of_nat`), where the latter avoids the quadratic cost of `toDigits`.
 -/
 
 def digitChar (n : Nat) : Char :=
@@ -155,6 +156,10 @@ def toDigits (base : Nat) (n : Nat) : List Char :=
 protected def _root_.USize.repr (n : @& USize) : String :=
   (toDigits 10 n.toNat).asString
 
+@[extern "lean_string_of_nat"]
+private def reprBig (n : @& Nat) : String :=
+  (toDigits 10 n).asString
+
 /-- We statically allocate and memoize reprs for small natural numbers. -/
 private def reprArray : Array String := Id.run do
   List.range 128 |>.map (·.toUSize.repr) |> Array.mk
@@ -162,7 +167,7 @@ private def reprArray : Array String := Id.run do
 private def reprFast (n : Nat) : String :=
   if h : n < 128 then Nat.reprArray.get ⟨n, h⟩ else
   if h : n < USize.size then (USize.ofNatCore n h).repr
-  else (toDigits 10 n).asString
+  else reprBig n
 
 @[implemented_by reprFast]
 protected def repr (n : Nat) : String :=
@@ -67,6 +67,28 @@ unsafe def StateFactory.mkImpl : StateFactoryBuilder → StateFactory
 @[implemented_by StateFactory.mkImpl]
 opaque StateFactory.mk : StateFactoryBuilder → StateFactory
 
+@[extern "lean_sharecommon_mk_native_tables", never_extract]
+unsafe opaque StateFactory.mkNativeTables : Unit → Object
+
+/-
+  The map and the set of `StateFactory.native` are open-addressing hash tables implemented in C++.
+  `lean_state_sharecommon` recognizes them and performs the lookups and insertions natively,
+  so `mapFind?`, `mapInsert`, `setFind?` and `setInsert` are never called.
+  The tables are updated destructively when the state is not shared, and copied otherwise. -/
+unsafe def StateFactory.nativeImpl : StateFactory :=
+  unsafeCast {
+    Map := Object
+    Set := Unit
+    mkState := fun _ => (StateFactory.mkNativeTables (), ())
+    mapFind? := fun _ _ => none
+    mapInsert := fun m _ _ => m
+    setFind? := fun _ _ => none
+    setInsert := fun s _ => s
+  : StateFactoryImpl }
+
+@[implemented_by StateFactory.nativeImpl]
+opaque StateFactory.native : StateFactory
+
 unsafe def StateFactory.get : StateFactory → StateFactoryImpl := unsafeCast
 
 /-- Internally `State` is implemented as a pair `ObjectMap` and `ObjectSet` -/
@@ -81,6 +103,13 @@ instance : Inhabited (State σ) := ⟨.mk σ⟩
 @[extern "lean_state_sharecommon"]
 def State.shareCommon {σ : @& StateFactory} (s : State σ) (a : α) : α × State σ := (a, s)
 
+/--
+Maximizes the sharing in `a` using fresh native tables that are discarded afterwards.
+It does not depend on any state, so it can be used in parallel on different objects,
+e.g. from different tasks, but objects processed by different calls are not shared with each other. -/
+@[extern "lean_sharecommon_quick"]
+def shareCommon' (a : @& α) : α := a
+
 end ShareCommon
 
 class MonadShareCommon (m : Type u → Type v) where
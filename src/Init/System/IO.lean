@@ -228,6 +228,74 @@ local macro "nonempty_list" : tactic =>
 /-- Helper method for implementing "deterministic" timeouts. It is the number of "small" memory allocations performed by the current execution thread. -/
 @[extern "lean_io_get_num_heartbeats"] opaque getNumHeartbeats : BaseIO Nat
 
+/-- Occupancy of the pages of one object size of the small object allocator. -/
+structure AllocSlotStats where
+  /-- Size in bytes of the objects stored in this slot. -/
+  objSize  : Nat
+  /-- Number of pages allocated for this slot, summed over all thread heaps. -/
+  numPages : Nat
+  /-- Number of live objects in the heap of the current thread. -/
+  numUsed  : Nat
+  /-- Number of free object cells in the pages of the heap of the current thread. A high ratio of
+  `numFree` to `numUsed` indicates fragmentation. -/
+  numFree  : Nat
+  deriving Inhabited, Repr
+
+/--
+Statistics of the small object allocator. Counters are summed over all thread heaps,
+including the heaps of finished threads, which are reused by new threads.
+-/
+structure AllocStats where
+  numHeaps            : Nat
+  numSegments         : Nat
+  numPages            : Nat
+  /-- Number of times a page was moved back to the free page list after enough of its objects were freed. -/
+  numRecycledPages    : Nat
+  /-- Number of batches of objects freed by a thread other than the one that allocated them. -/
+  numExports          : Nat
+  numExportedObjs     : Nat
+  numImportedObjs     : Nat
+  /-- Number of segments returned to the operating system, see `IO.releaseFreeMemory`. -/
+  numReleasedSegments : Nat
+  /-- Per-slot occupancy, only for slots with at least one page. -/
+  slots               : Array AllocSlotStats
+  deriving Inhabited, Repr
+
+/-- Return statistics of the small object allocator. The counters are always maintained, so no special build is needed. -/
+@[extern "lean_io_get_alloc_stats"] opaque getAllocStats : BaseIO AllocStats
+
+/--
+Return the memory segments of the small object allocator heap of the current thread that contain no live objects
+to the operating system, and return the number of bytes released. This also happens automatically after enough
+pages have become empty, and when a thread finishes.
+-/
+@[extern "lean_io_release_free_memory"] opaque releaseFreeMemory : BaseIO Nat
+
+/--
+Enable background deallocation of large object graphs. When the last reference to an object graph is dropped, at most
+`threshold` of its objects are freed by the current thread. The remaining objects that may be shared between threads
+(such as environments and tasks' results) are then freed by a dedicated thread, unless `maxQueue` object graphs are
+already waiting for it. `threshold = 0` disables background deallocation, which is the default unless the
+`LEAN_BG_DEALLOC` environment variable is set to a threshold. No-op in single-threaded builds.
+-/
+@[extern "lean_io_set_bg_dealloc"] opaque setBackgroundDealloc (threshold : @& Nat) (maxQueue : @& Nat := 16) : BaseIO Unit
+
+/-- Statistics of background deallocation, see `IO.setBackgroundDealloc`. -/
+structure BgDeallocStats where
+  /-- Number of object graphs handed to the background thread. -/
+  numHandoffs   : Nat
+  /-- Number of objects freed by the background thread. -/
+  numFreedObjs  : Nat
+  /-- Number of object graphs freed by the releasing thread because too many were already waiting. -/
+  numRejected   : Nat
+  /-- Number of object graphs currently waiting for the background thread, and the maximum so far. -/
+  queueDepth    : Nat
+  maxQueueDepth : Nat
+  deriving Inhabited, Repr
+
+/-- Return statistics of background deallocation. -/
+@[extern "lean_io_get_bg_dealloc_stats"] opaque getBgDeallocStats : BaseIO BgDeallocStats
+
 /--
 The mode of a file handle (i.e., a set of `open` flags and an `fdopen` mode).
 
@@ -25,6 +25,16 @@ register_builtin_option diagnostics.threshold : Nat := {
   descr    := "only diagnostic counters above this threshold are reported by the definitional equality"
 }
 
+register_builtin_option kernel.stats : Bool := {
+  defValue := false
+  descr    := "report, for each declaration, how often the kernel reduced terms, unfolded constants and hit its caches, as a JSON object"
+}
+
+register_builtin_option kernel.stats.topN : Nat := {
+  defValue := 10
+  descr    := "number of most frequently unfolded constants reported by `kernel.stats`"
+}
+
 register_builtin_option maxHeartbeats : Nat := {
   defValue := 200000
   descr := "maximum amount of heartbeats per command. A heartbeat is number of (small) memory allocations (in thousands), 0 means no limit"
@@ -328,7 +338,15 @@ def addDecl (decl : Declaration) : CoreM Unit := do
     withTraceNode `Kernel (fun _ => return m!"typechecking declaration") do
       if !(← MonadLog.hasErrors) && decl.hasSorry then
         logWarning "declaration uses 'sorry'"
-      match (← getEnv).addDecl decl with
+      let env ← getEnv
+      let opts ← getOptions
+      let res ← if kernel.stats.get opts then
+        let (res, stats) := env.addDeclWithStats decl (kernel.stats.topN.get opts)
+        logInfo m!"kernel statistics: {stats}"
+        pure res
+      else
+        pure <| env.addDecl decl
+      match res with
       | Except.ok    env => setEnv env
       | Except.error ex  => throwKernelException ex
 
@@ -27,7 +27,7 @@ private def escapeAux (acc : String) (c : Char) : String :=
   -- and encoding it with multiple \u is allowed, and it is up to parsers to make the
   -- decision.
   else if 0x0020 ≤ c.val ∧ c.val ≤ 0x10ffff then
-    acc ++ String.singleton c
+    acc.push c
   else
     let n := c.toNat;
     -- since c.val < 0x20 in this case, this conversion is more involved than necessary
@@ -38,11 +38,14 @@ private def escapeAux (acc : String) (c : Char) : String :=
       Nat.digitChar ((n % 256) / 16),
       Nat.digitChar (n % 16) ].asString
 
-def escape (s : String) : String :=
-  s.foldl escapeAux ""
+def escape (s : String) (acc : String := "") : String :=
+  s.foldl escapeAux acc
 
-def renderString (s : String) : String :=
-  "\"" ++ escape s ++ "\""
+/-- Appends the JSON representation of `s` to `acc`, which avoids copying the escaped string. -/
+def renderString (s : String) (acc : String := "") : String :=
+  let acc := acc.push '"'
+  let acc := escape s acc
+  acc.push '"'
 
 section
 
@@ -84,14 +87,14 @@ where go (acc : String) : List Json.CompressWorkItem → String
     | bool true  => go (acc ++ "true") is
     | bool false => go (acc ++ "false") is
     | num s      => go (acc ++ s.toString) is
-    | str s      => go (acc ++ renderString s) is
+    | str s      => go (renderString s acc) is
     | arr elems  => go (acc ++ "[") (elems.toList.map arrayElem ++ [arrayEnd] ++ is)
     | obj kvs    => go (acc ++ "{") (kvs.fold (init := []) (fun acc k j => objectField k j :: acc) ++ [objectEnd] ++ is)
   | arrayElem j :: arrayEnd :: is      => go acc (json j :: arrayEnd :: is)
   | arrayElem j :: is                  => go acc (json j :: comma :: is)
   | arrayEnd :: is                     => go (acc ++ "]") is
-  | objectField k j :: objectEnd :: is => go (acc ++ renderString k ++ ":") (json j :: objectEnd :: is)
-  | objectField k j :: is              => go (acc ++ renderString k ++ ":") (json j :: comma :: is)
+  | objectField k j :: objectEnd :: is => go ((renderString k acc).push ':') (json j :: objectEnd :: is)
+  | objectField k j :: is              => go ((renderString k acc).push ':') (json j :: comma :: is)
   | objectEnd :: is                    => go (acc ++ "}") is
   | comma :: is                        => go (acc ++ ",") is
 
@@ -242,12 +242,58 @@ inductive KernelException where
   | deepRecursion
   | interrupted
 
+namespace Kernel
+
+private opaque CacheImpl : NonemptyType.{0}
+
+/--
+  Type inference and weak head normalization results of the kernel type checker, shared by
+  the checks of several declarations. Only results for closed terms without universe parameters
+  are stored. A cache must only be used with environments that agree on all constants they have
+  in common, e.g. the environments obtained by adding the declarations of a module in order. -/
+def Cache : Type := CacheImpl.type
+
+instance : Nonempty Cache := CacheImpl.property
+
+/-- Creates a new, empty `Kernel.Cache`. -/
+@[extern "lean_kernel_cache_new"]
+opaque Cache.new : BaseIO Cache
+
+end Kernel
+
 namespace Environment
 
 /-- Type check given declaration and add it to the environment -/
 @[extern "lean_add_decl"]
 opaque addDecl (env : Environment) (decl : @& Declaration) : Except KernelException Environment
 
+private instance : Nonempty (Environment × Task (Except KernelException Unit)) :=
+  ⟨(Classical.ofNonempty, .pure (.ok ()))⟩
+
+/--
+  Like `addDecl`, but for theorems only checks the header before returning. The value is checked
+  in a separate task, whose result must be joined to ensure the theorem has been fully checked. -/
+@[extern "lean_add_decl_async"]
+opaque addDeclAsync (env : Environment) (decl : @& Declaration) :
+  Except KernelException (Environment × Task (Except KernelException Unit))
+
+/-- Like `addDecl`, but reuses and extends the results stored in `cache`. -/
+@[extern "lean_add_decl_with_cache"]
+opaque addDeclWithCache (env : Environment) (decl : @& Declaration) (cache : @& Kernel.Cache) :
+  Except KernelException Environment
+
+private instance : Nonempty (Except KernelException Environment × String) :=
+  ⟨(.ok Classical.ofNonempty, "")⟩
+
+/--
+  Like `addDecl`, but also returns statistics about the work done by the kernel as a JSON object:
+  the number of `whnf_core`, `whnf`, `infer_type`, `is_def_eq_core`, `unfold_definition` and
+  `lazy_delta_reduction_step` calls, the hits and misses of the kernel caches, and the `topN`
+  most frequently unfolded constants. The statistics are returned even if checking fails. -/
+@[extern "lean_add_decl_with_stats"]
+opaque addDeclWithStats (env : Environment) (decl : @& Declaration) (topN : @& Nat) :
+  Except KernelException Environment × String
+
 end Environment
 
 namespace ConstantInfo
@@ -636,6 +682,9 @@ end MapDeclarationExtension
 opaque saveModuleData (fname : @& System.FilePath) (mod : @& Name) (data : @& ModuleData) : IO Unit
 @[extern "lean_read_module_data"]
 opaque readModuleData (fname : @& System.FilePath) : IO (ModuleData × CompactedRegion)
+/-- Like `readModuleData`, but reads all given files in parallel. Fails with the first error in `fnames` order. -/
+@[extern "lean_read_module_data_parallel"]
+opaque readModuleDataParallel (fnames : @& Array System.FilePath) : IO (Array (ModuleData × CompactedRegion))
 
 /--
   Free compacted regions of imports. No live references to imported objects may exist at the time of invocation; in
@@ -759,21 +808,63 @@ abbrev ImportStateM := StateRefT ImportState IO
 @[inline] nonrec def ImportStateM.run (x : ImportStateM α) (s : ImportState := {}) : IO (α × ImportState) :=
   x.run s
 
-partial def importModulesCore (imports : Array Import) : ImportStateM Unit := do
+/--
+Read the .olean files of all modules transitively imported by `imports` that are not in `s.moduleNameSet` yet
+into `loaded`. The import graph is traversed breadth-first so that all files of one layer can be read in parallel. -/
+partial def readImportClosure (imports : Array Import) (s : ImportState)
+    (loaded : IO.Ref (HashMap Name (ModuleData × CompactedRegion))) : IO Unit := do
+  let mut names := #[]
+  let mut fnames := #[]
+  let mut seen : NameHashSet := {}
   for i in imports do
-    if i.runtimeOnly || (← get).moduleNameSet.contains i.module then
+    if i.runtimeOnly || s.moduleNameSet.contains i.module || (← loaded.get).contains i.module || seen.contains i.module then
       continue
-    modify fun s => { s with moduleNameSet := s.moduleNameSet.insert i.module }
+    seen := seen.insert i.module
     let mFile ← findOLean i.module
     unless (← mFile.pathExists) do
       throw <| IO.userError s!"object file '{mFile}' of module {i.module} does not exist"
-    let (mod, region) ← readModuleData mFile
-    importModulesCore mod.imports
-    modify fun s => { s with
-      moduleData  := s.moduleData.push mod
-      regions     := s.regions.push region
-      moduleNames := s.moduleNames.push i.module
-    }
+    names := names.push i.module
+    fnames := fnames.push mFile
+  if names.isEmpty then
+    return
+  let mods ← readModuleDataParallel fnames
+  let mut next := #[]
+  for n in names, m in mods do
+    loaded.modify (·.insert n m)
+    next := next ++ m.1.imports
+  readImportClosure next s loaded
+
+private unsafe def freeLoadedRegionsImpl (loaded : HashMap Name (ModuleData × CompactedRegion)) : IO Unit :=
+  for (_, _, region) in loaded.toList do
+    region.free
+
+/-- Free the regions of modules read by `readImportClosure` when the import fails. -/
+@[implemented_by freeLoadedRegionsImpl]
+private opaque freeLoadedRegions (loaded : HashMap Name (ModuleData × CompactedRegion)) : IO Unit
+
+partial def importModulesCore (imports : Array Import) : ImportStateM Unit := do
+  let loaded ← IO.mkRef ({} : HashMap Name (ModuleData × CompactedRegion))
+  try
+    readImportClosure imports (← get) loaded
+  catch e =>
+    freeLoadedRegions (← loaded.get)
+    throw e
+  go (← loaded.get) imports
+where
+  /- Module order (and thus module indices) is determined by this depth-first traversal, as before. -/
+  go (loaded : HashMap Name (ModuleData × CompactedRegion)) (imports : Array Import) : ImportStateM Unit := do
+    for i in imports do
+      if i.runtimeOnly || (← get).moduleNameSet.contains i.module then
+        continue
+      modify fun s => { s with moduleNameSet := s.moduleNameSet.insert i.module }
+      let some (mod, region) := loaded.find? i.module
+        | throw <| IO.userError s!"internal error, module {i.module} has not been read"
+      go loaded mod.imports
+      modify fun s => { s with
+        moduleData  := s.moduleData.push mod
+        regions     := s.regions.push region
+        moduleNames := s.moduleNames.push i.module
+      }
 
 /--
 Return `true` if `cinfo₁` and `cinfo₂` are theorems with the same name, universe parameters,
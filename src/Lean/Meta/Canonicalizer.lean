@@ -51,7 +51,7 @@ State for the `CanonM` monad.
 -/
 structure State where
   /-- "Set" of all keys created so far. This is a hash-consing helper structure available in Lean. -/
-  keys       : ShareCommon.State.{0} Lean.ShareCommon.objectFactory := ShareCommon.State.mk Lean.ShareCommon.objectFactory
+  keys       : ShareCommon.State.{0} Lean.ShareCommon.nativeObjectFactory := ShareCommon.State.mk Lean.ShareCommon.nativeObjectFactory
   /-- Mapping from `Expr` to `Key`. See comment at `ExprVisited`. -/
   -- We use `HashMapImp` to ensure we don't have to tag `State` as `unsafe`.
   cache      : HashMapImp ExprVisited Key := mkHashMapImp
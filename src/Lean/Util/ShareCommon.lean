@@ -25,7 +25,10 @@ def persistentObjectFactory :=
     Set := PersistentHashSet, mkSet := fun _ => .empty, setFind? := (·.find?), setInsert := (·.insert)
   }
 
-abbrev ShareCommonT := _root_.ShareCommonT objectFactory
+/-- Uses the native hash tables of `StateFactory.native`. -/
+def nativeObjectFactory := StateFactory.native
+
+abbrev ShareCommonT := _root_.ShareCommonT nativeObjectFactory
 abbrev PShareCommonT := _root_.ShareCommonT persistentObjectFactory
 abbrev ShareCommonM := ShareCommonT Id
 abbrev PShareCommonM := PShareCommonT Id
@@ -47,4 +50,4 @@ instance PShareCommonT.monadShareCommon [Monad m] : MonadShareCommon (PShareComm
 @[inline] def ShareCommonM.run : ShareCommonM α → α := ShareCommonT.run
 @[inline] def PShareCommonM.run : PShareCommonM α → α := PShareCommonT.run
 
-def shareCommon (a : α) : α := (withShareCommon a : ShareCommonM α).run
+def shareCommon (a : α) : α := _root_.ShareCommon.shareCommon' a
@@ -195,18 +195,22 @@ typedef struct {
 } lean_thunk_object;
 
 struct lean_task;
+struct lean_task_waiter;
 
-/* Data required for executing a Lean task. It is released as soon as
-   the task terminates even if the task object itself is still referenced. */
+/* Data required for executing a Lean task. The closure is released as soon as
+   the task terminates, the rest when the task object itself is freed. */
 typedef struct {
-    lean_object *        m_closure;
-    struct lean_task *   m_head_dep;
-    struct lean_task *   m_next_dep;
-    unsigned             m_prio;
-    uint8_t              m_canceled;
+    lean_object *               m_closure;
+    /* Dependents are pushed using compare-and-swap, see `task_manager::add_dep`. */
+    _Atomic(struct lean_task *) m_head_dep;
+    struct lean_task *          m_next_dep;
+    /* Threads blocked on this task, protected by the task manager mutex. */
+    struct lean_task_waiter *   m_waiters;
+    unsigned                    m_prio;
+    uint8_t                     m_canceled;
     // If true, task will not be freed until finished
-    uint8_t              m_keep_alive;
-    uint8_t              m_deleted;
+    uint8_t                     m_keep_alive;
+    uint8_t                     m_deleted;
 } lean_task_imp;
 
 /* Object of type `Task _`. The lifetime of a `lean_task` object can be represented as a state machine with atomic
@@ -233,6 +237,8 @@ typedef struct {
        * It cannot become Deactivated because this task should be holding an owned reference to it
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
      * transition: task dependency Finished ==> Queued (`handle_finished` under `spawn_worker` lock)
+     * Note that tasks enter this state by a compare-and-swap on the dependency's `m_head_dep` without taking the lock,
+       `handle_finished` closes the list by swapping in a sentinel before traversing it
    * Promised
      * condition: obtained as result from promise
      * invariant: m_imp != nullptr && m_value == nullptr
@@ -258,7 +264,8 @@ typedef struct {
      * transition: task dependency Deactivated ==> freed
    * Finished
      * condition: m_value != nullptr
-     * invariant: m_imp == nullptr
+     * invariant: m_imp == nullptr || (m_imp->m_closure == nullptr && m_imp->m_waiters == nullptr)
+       * `m_imp` is kept alive until the task is freed because `add_dep` may still be accessing it
      * transition: RC becomes 0 ==> freed (`deactivate_task` lock) */
 typedef struct lean_task {
     lean_object            m_header;
@@ -313,6 +320,69 @@ LEAN_EXPORT void lean_free_small(void * p);
 LEAN_EXPORT unsigned lean_small_mem_size(void * p);
 LEAN_EXPORT void lean_inc_heartbeat(void);
 
+#define LEAN_NUM_SMALL_SLOTS (LEAN_MAX_SMALL_OBJECT_SIZE / LEAN_OBJECT_SIZE_DELTA)
+
+/* Statistics of the small object allocator. The counters are summed over all thread heaps, including
+   orphaned heaps of finished threads. Slot `i` contains objects of size `(i+1)*LEAN_OBJECT_SIZE_DELTA`. */
+typedef struct {
+    uint64_t m_num_heaps;
+    uint64_t m_num_segments;
+    uint64_t m_num_pages;
+    /* Pages moved back to the free page list after enough of their objects were freed. */
+    uint64_t m_num_recycled_pages;
+    /* Batches of objects sent back to the heaps that allocated them, and the objects in them. */
+    uint64_t m_num_exports;
+    uint64_t m_num_exported_objs;
+    uint64_t m_num_imported_objs;
+    /* Segments returned to the OS, see `lean_release_free_segments`. */
+    uint64_t m_num_released_segments;
+    uint64_t m_slot_pages[LEAN_NUM_SMALL_SLOTS];
+    /* Allocated and free objects in the pages of each slot. Only computed for the heap of the calling thread,
+       since the free lists of other heaps cannot be inspected without synchronization. */
+    uint64_t m_slot_used[LEAN_NUM_SMALL_SLOTS];
+    uint64_t m_slot_free[LEAN_NUM_SMALL_SLOTS];
+} lean_small_alloc_stats;
+
+LEAN_EXPORT void lean_get_small_alloc_stats(lean_small_alloc_stats * r);
+
+#define LEAN_HUGE_PAGES_NONE        0
+/* `madvise(MADV_HUGEPAGE)` on segments */
+#define LEAN_HUGE_PAGES_TRANSPARENT 1
+/* `MAP_HUGETLB`, falling back to transparent huge pages */
+#define LEAN_HUGE_PAGES_EXPLICIT    2
+
+/* Configure how segments of the small object allocator are mapped. Only affects segments allocated afterwards.
+   If `numa_local` is true, segments prefer the NUMA node of the thread allocating them.
+   The defaults are taken from the `LEAN_HUGE_PAGES` (`transparent` or `explicit`) and `LEAN_NUMA_LOCAL`
+   environment variables. Only supported on Linux, a no-op elsewhere. */
+LEAN_EXPORT void lean_set_small_alloc_options(uint8_t huge_pages, bool numa_local);
+
+/* Return the segments of the calling thread's heap whose pages are all free to the OS, and return the number of
+   bytes released. Heaps also do this on their own after `num_pages` pages have become empty (see
+   `lean_set_small_alloc_release_threshold`, 0 disables it), and when their thread finishes. */
+LEAN_EXPORT size_t lean_release_free_segments(void);
+LEAN_EXPORT void lean_set_small_alloc_release_threshold(unsigned num_pages);
+
+/* Background deallocation. If `threshold` is not 0, `lean_dec_ref_cold` frees at most `threshold` objects of a dead
+   object graph before handing its remaining multi-threaded objects to a reclaimer thread, unless `max_queue` such
+   worklists are already waiting. Single-threaded objects are always freed by the releasing thread. Disabled by
+   default, the initial threshold is taken from the `LEAN_BG_DEALLOC` environment variable. Not supported in
+   single-threaded builds. */
+LEAN_EXPORT void lean_set_bg_dealloc(size_t threshold, unsigned max_queue);
+
+typedef struct {
+    /* Worklists handed to the reclaimer thread, and the objects it freed. */
+    uint64_t m_num_handoffs;
+    uint64_t m_num_freed_objs;
+    /* Worklists freed by the releasing thread because the queue was full. */
+    uint64_t m_num_rejected;
+    /* Worklists currently waiting, and the maximum so far. */
+    uint64_t m_queue_depth;
+    uint64_t m_max_queue_depth;
+} lean_bg_dealloc_stats;
+
+LEAN_EXPORT void lean_get_bg_dealloc_stats(lean_bg_dealloc_stats * r);
+
 #ifndef __cplusplus
 void * malloc(size_t);  // avoid including big `stdlib.h`
 #endif
@@ -998,6 +1068,9 @@ static inline char const * lean_string_cstr(b_lean_obj_arg o) {
 }
 static inline size_t lean_string_size(b_lean_obj_arg o) { return lean_to_string(o)->m_size; }
 static inline size_t lean_string_len(b_lean_obj_arg o) { return lean_to_string(o)->m_length; }
+/* A string is pure ASCII iff its length is its size in bytes. Byte positions and character indices coincide
+   in such a string. */
+static inline bool lean_string_is_ascii(b_lean_obj_arg o) { return lean_string_size(o) - 1 == lean_string_len(o); }
 LEAN_EXPORT lean_obj_res lean_string_push(lean_obj_arg s, uint32_t c);
 LEAN_EXPORT lean_obj_res lean_string_append(lean_obj_arg s1, b_lean_obj_arg s2);
 static inline lean_obj_res lean_string_length(b_lean_obj_arg s) { return lean_box(lean_string_len(s)); }
@@ -1028,12 +1101,28 @@ static inline lean_obj_res lean_string_utf8_next_fast(b_lean_obj_arg s, b_lean_o
   return lean_string_utf8_next_fast_cold(idx, c);
 }
 
-LEAN_EXPORT lean_obj_res lean_string_utf8_prev(b_lean_obj_arg s, b_lean_obj_arg i);
+LEAN_EXPORT lean_obj_res lean_string_utf8_prev_cold(b_lean_obj_arg s, b_lean_obj_arg i);
+static inline lean_obj_res lean_string_utf8_prev(b_lean_obj_arg s, b_lean_obj_arg i) {
+  if (lean_is_scalar(i) && lean_string_is_ascii(s)) {
+    size_t idx = lean_unbox(i);
+    return lean_box(idx == 0 || idx > lean_string_len(s) ? 0 : idx - 1);
+  }
+  return lean_string_utf8_prev_cold(s, i);
+}
 LEAN_EXPORT lean_obj_res lean_string_utf8_set(lean_obj_arg s, b_lean_obj_arg i, uint32_t c);
 static inline uint8_t lean_string_utf8_at_end(b_lean_obj_arg s, b_lean_obj_arg i) {
     return !lean_is_scalar(i) || lean_unbox(i) >= lean_string_size(s) - 1;
 }
 LEAN_EXPORT lean_obj_res lean_string_utf8_extract(b_lean_obj_arg s, b_lean_obj_arg b, b_lean_obj_arg e);
+LEAN_EXPORT lean_obj_res lean_string_offset_of_pos_cold(b_lean_obj_arg s, b_lean_obj_arg pos);
+static inline lean_obj_res lean_string_offset_of_pos(b_lean_obj_arg s, b_lean_obj_arg pos) {
+  if (lean_is_scalar(pos) && lean_string_is_ascii(s)) {
+    size_t idx = lean_unbox(pos);
+    size_t len = lean_string_len(s);
+    return lean_box(idx < len ? idx : len);
+  }
+  return lean_string_offset_of_pos_cold(s, pos);
+}
 static inline lean_obj_res lean_string_utf8_byte_size(b_lean_obj_arg s) { return lean_box(lean_string_size(s) - 1); }
 LEAN_EXPORT bool lean_string_eq_cold(b_lean_obj_arg s1, b_lean_obj_arg s2);
 static inline bool lean_string_eq(b_lean_obj_arg s1, b_lean_obj_arg s2) {
@@ -1045,6 +1134,7 @@ static inline uint8_t lean_string_dec_eq(b_lean_obj_arg s1, b_lean_obj_arg s2) {
 static inline uint8_t lean_string_dec_lt(b_lean_obj_arg s1, b_lean_obj_arg s2) { return lean_string_lt(s1, s2); }
 LEAN_EXPORT uint64_t lean_string_hash(b_lean_obj_arg);
 LEAN_EXPORT lean_obj_res lean_string_of_usize(size_t);
+LEAN_EXPORT lean_obj_res lean_string_of_nat(b_lean_obj_arg);
 
 /* Thunks */
 
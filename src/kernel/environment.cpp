@@ -173,22 +173,41 @@ environment environment::add_definition(declaration const & d, bool check) const
     }
 }
 
-environment environment::add_theorem(declaration const & d, bool check) const {
+static void check_theorem_value(environment const & env, declaration const & d, type_checker & checker) {
+    theorem_val const & v = d.to_theorem_val();
+    check_no_metavar_no_fvar(env, v.get_name(), v.get_value());
+    expr val_type = checker.check(v.get_value(), v.get_lparams());
+    if (!checker.is_def_eq(val_type, v.get_type()))
+        throw definition_type_mismatch_exception(env, d, val_type);
+}
+
+static void check_theorem_header(environment const & env, declaration const & d, type_checker & checker) {
     theorem_val const & v = d.to_theorem_val();
+    if (!checker.is_prop(v.get_type()))
+        throw theorem_type_is_not_prop(env, v.get_name(), v.get_type());
+    check_constant_val(env, v.to_constant_val(), checker);
+}
+
+environment environment::add_theorem(declaration const & d, bool check) const {
     if (check) {
-        // TODO(Leo): we must add support for handling tasks here
         type_checker checker(*this);
-        if (!checker.is_prop(v.get_type()))
-            throw theorem_type_is_not_prop(*this, v.get_name(), v.get_type());
-        check_constant_val(*this, v.to_constant_val(), checker);
-        check_no_metavar_no_fvar(*this, v.get_name(), v.get_value());
-        expr val_type = checker.check(v.get_value(), v.get_lparams());
-        if (!checker.is_def_eq(val_type, v.get_type()))
-            throw definition_type_mismatch_exception(*this, d, val_type);
+        check_theorem_header(*this, d, checker);
+        ::lean::check_theorem_value(*this, d, checker);
     }
     return add(constant_info(d));
 }
 
+environment environment::add_theorem_unchecked_value(declaration const & d) const {
+    type_checker checker(*this);
+    check_theorem_header(*this, d, checker);
+    return add(constant_info(d));
+}
+
+void environment::check_theorem_value(declaration const & d) const {
+    type_checker checker(*this);
+    ::lean::check_theorem_value(*this, d, checker);
+}
+
 environment environment::add_opaque(declaration const & d, bool check) const {
     opaque_val const & v = d.to_opaque_val();
     if (check) {
@@ -254,6 +273,65 @@ extern "C" LEAN_EXPORT object * lean_add_decl(object * env, object * decl) {
         });
 }
 
+static obj_res check_theorem_value_fn(obj_arg env, obj_arg decl, obj_arg) {
+    environment e(env);
+    declaration d(decl);
+    return catch_kernel_exceptions<object_ref>([&]() {
+            e.check_theorem_value(d);
+            return object_ref(box(0));
+        });
+}
+
+/*
+@[extern "lean_add_decl_async"]
+opaque addDeclAsync (env : Environment) (decl : @& Declaration) :
+  Except KernelException (Environment × Task (Except KernelException Unit)) */
+extern "C" LEAN_EXPORT object * lean_add_decl_async(object * env, object * decl) {
+    return catch_kernel_exceptions<object_ref>([&]() {
+            environment e(env);
+            declaration d(decl, true);
+            if (d.kind() != declaration_kind::Theorem) {
+                environment new_env = e.add(d);
+                return object_ref(mk_cnstr(0, new_env, object_ref(lean_task_pure(mk_cnstr(1, box(0)).steal()))));
+            }
+            environment new_env = e.add_theorem_unchecked_value(d);
+            object * c = lean_alloc_closure(reinterpret_cast<void *>(check_theorem_value_fn), 3, 2);
+            lean_closure_set(c, 0, e.steal());
+            lean_closure_set(c, 1, d.steal());
+            object * t = lean_task_spawn_core(c, 0, /* keep_alive */ false);
+            return object_ref(mk_cnstr(0, new_env, object_ref(t)));
+        });
+}
+
+extern "C" LEAN_EXPORT object * lean_add_decl_with_cache(object * env, object * decl, b_obj_arg cache) {
+    scope_type_checker_cache scope(to_type_checker_cache(cache));
+    object * r = lean_add_decl(env, decl);
+    // `Except.ok`: the declaration has been accepted
+    if (lean_obj_tag(r) == 1)
+        scope.commit();
+    return r;
+}
+
+/*
+@[extern "lean_add_decl_with_stats"]
+opaque addDeclWithStats (env : Environment) (decl : @& Declaration) (topN : @& Nat) :
+  Except KernelException Environment × String */
+extern "C" LEAN_EXPORT object * lean_add_decl_with_stats(object * env, object * decl, b_obj_arg top_n) {
+    type_checker_stats stats;
+    object * r;
+    {
+        scope_type_checker_stats scope(&stats);
+        r = lean_add_decl(env, decl);
+    }
+    unsigned n = std::numeric_limits<unsigned>::max();
+    if (lean_is_scalar(top_n) && lean_unbox(top_n) < n)
+        n = lean_unbox(top_n);
+    object * p = alloc_cnstr(0, 2, 0);
+    cnstr_set(p, 0, r);
+    cnstr_set(p, 1, mk_string(stats.to_json(n)));
+    return p;
+}
+
 void environment::for_each_constant(std::function<void(constant_info const & d)> const & f) const {
     smap_foreach(cnstr_get(raw(), 1), [&](object *, object * v) {
             constant_info cinfo(v, true);
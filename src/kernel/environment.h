@@ -74,6 +74,12 @@ public:
     /** \brief Extends the current environment with the given declaration */
     environment add(declaration const & d, bool check = true) const;
 
+    /** \brief Check everything about the theorem \c d but its value, and add it to the environment.
+        The value must then be checked using \c check_theorem_value on this environment, not the resulting one. */
+    environment add_theorem_unchecked_value(declaration const & d) const;
+    /** \brief Check that the value of the theorem \c d has the declared type. */
+    void check_theorem_value(declaration const & d) const;
+
     /** \brief Apply the function \c f to each constant */
     void for_each_constant(std::function<void(constant_info const & d)> const & f) const;
 
@@ -7,12 +7,19 @@ Author: Leonardo de Moura
 #pragma once
 #include <unordered_map>
 #include <functional>
+#include "runtime/flat_hash_map.h"
 #include "kernel/expr.h"
 
 namespace lean {
 // Maps based on structural equality. That is, two keys are equal iff they are structurally equal
 template<typename T>
 using expr_map = typename std::unordered_map<expr, T, expr_hash, std::equal_to<expr>>;
+/* Structural equality with a pointer equality fast path, for use as a hash table key predicate */
+struct expr_quick_eq { bool operator()(expr const & a, expr const & b) const { return is_eqp(a, b) || a == b; } };
+// Like `expr_map`, but using open addressing, see `flat_hash_table`. Keys are compared on their cached hash codes
+// first, so structural equality is only checked for (likely) matches.
+template<typename T>
+using expr_flat_map = flat_hash_map<expr, T, expr_hash, expr_quick_eq>;
 // The following map also takes into account binder information
 template<typename T>
 using expr_bi_map = typename std::unordered_map<expr, T, expr_hash, is_bi_equal_proc>;
@@ -101,7 +101,7 @@ inline optional<expr> inductive_reduce_rec(environment const & env, expr const &
     get_app_args(major, major_args);
     if (rule->get_nfields() > major_args.size()) return none_expr();
     if (length(const_levels(rec_fn)) != length(rec_info->get_lparams())) return none_expr();
-    expr rhs = instantiate_lparams(rule->get_rhs(), rec_info->get_lparams(), const_levels(rec_fn));
+    expr rhs = instantiate_rec_rule_lparams(*rule, rec_info->get_lparams(), const_levels(rec_fn));
     /* apply parameters, motives and minor premises from recursor application. */
     rhs      = mk_app(rhs, rec_val.get_nparams() + rec_val.get_nmotives() + rec_val.get_nminors(), rec_args.data());
     /* The number of parameters in the constructor is not necessarily
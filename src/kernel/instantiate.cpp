@@ -6,6 +6,8 @@ Author: Leonardo de Moura
 */
 #include <algorithm>
 #include <limits>
+#include "runtime/thread.h"
+#include "runtime/flat_hash_map.h"
 #include "kernel/replace_fn.h"
 #include "kernel/declaration.h"
 #include "kernel/kernel_exception.h"
@@ -15,7 +17,7 @@ namespace lean {
 expr instantiate(expr const & a, unsigned s, unsigned n, expr const * subst) {
     if (s >= get_loose_bvar_range(a) || n == 0)
         return a;
-    return replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+    return replace_iter(a, [=](expr const & m, unsigned offset) -> optional<expr> {
             unsigned s1 = s + offset;
             if (s1 < s)
                 return some_expr(m); // overflow, vidx can't be >= max unsigned
@@ -58,7 +60,7 @@ static object * lean_expr_instantiate_core(b_obj_arg a0, size_t n, object** subs
         lean_inc(a0);
         return a0;
     }
-    expr r = replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+    expr r = replace_iter(a, [=](expr const & m, unsigned offset) -> optional<expr> {
             if (offset >= get_loose_bvar_range(m))
                 return some_expr(m); // expression m does not contain loose bound variables with idx >= offset
             if (is_bvar(m)) {
@@ -99,7 +101,7 @@ extern "C" LEAN_EXPORT object * lean_expr_instantiate_range(b_obj_arg a, b_obj_a
 expr instantiate_rev(expr const & a, unsigned n, expr const * subst) {
     if (!has_loose_bvars(a))
         return a;
-    return replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+    return replace_iter(a, [=](expr const & m, unsigned offset) -> optional<expr> {
             if (offset >= get_loose_bvar_range(m))
                 return some_expr(m); // expression m does not contain loose bound variables with idx >= offset
             if (is_bvar(m)) {
@@ -123,7 +125,7 @@ static object * lean_expr_instantiate_rev_core(object * a0, size_t n, object **
         lean_inc(a0);
         return a0;
     }
-    expr r = replace(a, [=](expr const & m, unsigned offset) -> optional<expr> {
+    expr r = replace_iter(a, [=](expr const & m, unsigned offset) -> optional<expr> {
             if (offset >= get_loose_bvar_range(m))
                 return some_expr(m); // expression m does not contain loose bound variables with idx >= offset
             if (is_bvar(m)) {
@@ -216,7 +218,7 @@ expr cheap_beta_reduce(expr const & e) {
 expr instantiate_lparams(expr const & e, names const & lps, levels const & ls) {
     if (!has_param_univ(e))
         return e;
-    return replace(e, [&](expr const & e) -> optional<expr> {
+    return replace_iter(e, [&](expr const & e, unsigned) -> optional<expr> {
             if (!has_param_univ(e))
                 return some_expr(e);
             if (is_constant(e)) {
@@ -229,12 +231,78 @@ expr instantiate_lparams(expr const & e, names const & lps, levels const & ls) {
         });
 }
 
+/** \brief Bounded cache of the universe instantiations of constant types and values (and recursor rules). The same
+    constant is used at the same levels over and over again, e.g. `Eq.{1}` or `List.map.{0, 0}`, and reusing the result
+    also lets the callers' caches, which compare pointers first, hit more often.
+
+    Entries are keyed by the constant name, the levels, and the instantiated expression itself, compared by pointer:
+    environments may contain different constants with the same name, and keeping a reference to the expression in
+    the entry makes sure its address is not reused while the entry exists. The cache is simply emptied when it is
+    full.
+
+    There is one cache per thread. A cache shared by all threads would have to mark every result MT before
+    inserting it, which walks the freshly instantiated expression once more and cost more than the hits saved. */
+class instantiate_lparams_cache {
+    struct key {
+        name   m_const;
+        expr   m_expr;
+        levels m_levels;
+    };
+    struct key_hash {
+        unsigned operator()(key const & k) const {
+            uint64 h = lean::hash(k.m_const.hash(), hash(k.m_expr));
+            for (level const & l : k.m_levels)
+                h = lean::hash(h, l.hash());
+            return static_cast<unsigned>(h);
+        }
+    };
+    struct key_eq {
+        bool operator()(key const & k1, key const & k2) const {
+            return is_eqp(k1.m_expr, k2.m_expr) && k1.m_const == k2.m_const && k1.m_levels == k2.m_levels;
+        }
+    };
+    static constexpr unsigned capacity = 16384;
+    flat_hash_map<key, expr, key_hash, key_eq> m_map{capacity};
+public:
+    optional<expr> find(name const & n, expr const & e, levels const & ls) {
+        if (auto it = m_map.find(key{n, e, ls}))
+            return some_expr(it->second);
+        return none_expr();
+    }
+
+    void insert(name const & n, expr const & e, levels const & ls, expr const & r) {
+        if (m_map.size() >= capacity)
+            m_map.clear();
+        m_map.insert(mk_pair(key{n, e, ls}, r));
+    }
+};
+
+/* CACHE_RESET: No */
+MK_THREAD_LOCAL_GET_DEF(instantiate_lparams_cache, get_instantiate_lparams_cache);
+LEAN_THREAD_VALUE(instantiate_lparams_stats, g_instantiate_lparams_stats, {});
+
+instantiate_lparams_stats const & get_instantiate_lparams_stats() {
+    return g_instantiate_lparams_stats;
+}
+
+static expr instantiate_lparams_cached(name const & n, expr const & e, names const & ps, levels const & ls) {
+    instantiate_lparams_cache & cache = get_instantiate_lparams_cache();
+    g_instantiate_lparams_stats.m_lookups++;
+    if (auto r = cache.find(n, e, ls)) {
+        g_instantiate_lparams_stats.m_hits++;
+        return *r;
+    }
+    expr r = instantiate_lparams(e, ps, ls);
+    cache.insert(n, e, ls, r);
+    return r;
+}
+
 expr instantiate_type_lparams(constant_info const & info, levels const & ls) {
     if (info.get_num_lparams() != length(ls))
         lean_internal_panic("#universes mismatch at instantiateTypeLevelParams");
     if (is_nil(ls) || !has_param_univ(info.get_type()))
         return info.get_type();
-    return instantiate_lparams(info.get_type(), info.get_lparams(), ls);
+    return instantiate_lparams_cached(info.get_name(), info.get_type(), info.get_lparams(), ls);
 }
 
 expr instantiate_value_lparams(constant_info const & info, levels const & ls) {
@@ -244,7 +312,13 @@ expr instantiate_value_lparams(constant_info const & info, levels const & ls) {
         lean_internal_panic("definition/theorem expected at instantiateValueLevelParams");
     if (is_nil(ls) || !has_param_univ(info.get_value()))
         return info.get_value();
-    return instantiate_lparams(info.get_value(), info.get_lparams(), ls);
+    return instantiate_lparams_cached(info.get_name(), info.get_value(), info.get_lparams(), ls);
+}
+
+expr instantiate_rec_rule_lparams(recursor_rule const & rule, names const & ps, levels const & ls) {
+    if (is_nil(ls) || !has_param_univ(rule.get_rhs()))
+        return rule.get_rhs();
+    return instantiate_lparams_cached(rule.get_cnstr(), rule.get_rhs(), ps, ls);
 }
 
 }
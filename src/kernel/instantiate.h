@@ -42,4 +42,17 @@ expr instantiate_type_lparams(constant_info const & info, levels const & ls);
 /** \brief Instantiate the universe level parameters of the value of the given constant.
     \pre d.get_num_lparams() == length(ls) */
 expr instantiate_value_lparams(constant_info const & info, levels const & ls);
+
+class recursor_rule;
+/** \brief Instantiate the universe level parameters \c ps of the right-hand side of the given recursor rule.
+    \pre length(ps) == length(ls) */
+expr instantiate_rec_rule_lparams(recursor_rule const & rule, names const & ps, levels const & ls);
+
+/** \brief Lookups in the per-thread cache used by `instantiate_type_lparams`, `instantiate_value_lparams` and
+    `instantiate_rec_rule_lparams` performed on the current thread. */
+struct instantiate_lparams_stats {
+    uint64 m_lookups{0};
+    uint64 m_hits{0};
+};
+instantiate_lparams_stats const & get_instantiate_lparams_stats();
 }
@@ -121,4 +121,35 @@ public:
 expr replace(expr const & e, std::function<optional<expr>(expr const &, unsigned)> const & f, bool use_cache) {
     return replace_rec_fn(f, use_cache)(e);
 }
+
+void replace_iter_cache::clear() {
+    /* do not keep the memory used by exceptionally big traversals alive */
+    if (m_map.size() > 16 * LEAN_DEFAULT_REPLACE_ITER_CACHE_CAPACITY)
+        m_map = flat_hash_map<key, expr, key_hash, key_eq>(LEAN_DEFAULT_REPLACE_ITER_CACHE_CAPACITY);
+    else
+        m_map.clear();
+}
+
+struct replace_iter_cache_stack {
+    unsigned                                         m_top;
+    std::vector<std::unique_ptr<replace_iter_cache>> m_cache_stack;
+    replace_iter_cache_stack():m_top(0) {}
+};
+MK_THREAD_LOCAL_GET_DEF(replace_iter_cache_stack, get_replace_iter_cache_stack);
+
+replace_iter_cache_ref::replace_iter_cache_ref() {
+    replace_iter_cache_stack & s = get_replace_iter_cache_stack();
+    lean_assert(s.m_top <= s.m_cache_stack.size());
+    if (s.m_top == s.m_cache_stack.size())
+        s.m_cache_stack.push_back(std::unique_ptr<replace_iter_cache>(new replace_iter_cache()));
+    m_cache = s.m_cache_stack[s.m_top].get();
+    s.m_top++;
+}
+
+replace_iter_cache_ref::~replace_iter_cache_ref() {
+    replace_iter_cache_stack & s = get_replace_iter_cache_stack();
+    lean_assert(s.m_top > 0);
+    s.m_top--;
+    m_cache->clear();
+}
 }
@@ -7,9 +7,20 @@ Author: Leonardo de Moura
 #pragma once
 #include <tuple>
 #include "runtime/interrupt.h"
+#include "runtime/buffer.h"
+#include "runtime/hash.h"
+#include "runtime/flat_hash_map.h"
 #include "kernel/expr.h"
 #include "kernel/expr_maps.h"
 
+#ifndef LEAN_REPLACE_MAX_REC_DEPTH
+#define LEAN_REPLACE_MAX_REC_DEPTH 256
+#endif
+
+#ifndef LEAN_DEFAULT_REPLACE_ITER_CACHE_CAPACITY
+#define LEAN_DEFAULT_REPLACE_ITER_CACHE_CAPACITY 1024
+#endif
+
 namespace lean {
 /**
    \brief Apply <tt>f</tt> to the subexpressions of a given expression.
@@ -23,4 +34,248 @@ expr replace(expr const & e, std::function<optional<expr>(expr const &, unsigned
 inline expr replace(expr const & e, std::function<optional<expr>(expr const &)> const & f, bool use_cache = true) {
     return replace(e, [&](expr const & e, unsigned) { return f(e); }, use_cache);
 }
+
+/** \brief Cache used by `replace_iter`. It maps a subexpression and the offset it was visited at
+    to the result of the traversal, and grows as needed. Instances are reused by each thread, see
+    `replace_iter_cache_ref`. */
+class replace_iter_cache {
+    struct key {
+        object * m_cell;
+        unsigned m_offset;
+    };
+    struct key_hash {
+        uint64 operator()(key const & k) const {
+            return lean::hash(reinterpret_cast<size_t>(k.m_cell), k.m_offset);
+        }
+    };
+    struct key_eq {
+        bool operator()(key const & k1, key const & k2) const {
+            return k1.m_cell == k2.m_cell && k1.m_offset == k2.m_offset;
+        }
+    };
+    flat_hash_map<key, expr, key_hash, key_eq> m_map;
+public:
+    replace_iter_cache():m_map(LEAN_DEFAULT_REPLACE_ITER_CACHE_CAPACITY) {}
+
+    expr const * find(expr const & e, unsigned offset) const {
+        auto r = m_map.find(key{e.raw(), offset});
+        return r ? &r->second : nullptr;
+    }
+
+    void insert(expr const & e, unsigned offset, expr const & r) {
+        m_map.insert(mk_pair(key{e.raw(), offset}, r));
+    }
+
+    void clear();
+};
+
+/** \brief Reference to a `replace_iter_cache` of the current thread, which is not used by any other
+    `replace_iter_cache_ref`. So `f` may call `replace_iter` recursively. */
+class replace_iter_cache_ref {
+    replace_iter_cache * m_cache;
+public:
+    replace_iter_cache_ref();
+    ~replace_iter_cache_ref();
+    replace_iter_cache * operator->() const { return m_cache; }
+};
+
+/**
+   \brief Specialized version of `replace` for the function object type `F`, which must provide
+   <tt>optional<expr> operator()(expr const & s, unsigned offset)</tt> with the same meaning as above.
+
+   `f` is inlined instead of being called through a `std::function`, and the results for shared
+   subexpressions are stored in a `replace_iter_cache`, which, unlike the fixed size cache used by
+   `replace`, does not evict entries on collisions. Subexpressions nested more than
+   `LEAN_REPLACE_MAX_REC_DEPTH` levels deep are traversed using an explicit stack instead of the
+   C stack, so very deep terms (e.g., long application spines) do not overflow it.
+   It is used for the hot paths `instantiate`, `instantiate_rev`, `abstract` and `instantiate_lparams`. */
+template<typename F>
+class replace_iter_fn {
+    struct frame {
+        expr const * m_e;
+        unsigned     m_offset;
+        /* index of the next child of `m_e` to be visited */
+        unsigned     m_next;
+        bool         m_shared;
+    };
+
+    F const &              m_f;
+    replace_iter_cache_ref m_cache;
+    buffer<frame, 32>      m_todo;
+    /* results of the visited children of the expressions in `m_todo` */
+    buffer<expr, 32>       m_results;
+    unsigned               m_steps = 0;
+
+    expr pop_result() {
+        expr r = m_results.back();
+        m_results.pop_back();
+        return r;
+    }
+
+    /* Recursive traversal, used for the first `LEAN_REPLACE_MAX_REC_DEPTH` levels. */
+    expr apply(expr const & e, unsigned offset, unsigned depth) {
+        if (depth >= LEAN_REPLACE_MAX_REC_DEPTH)
+            return apply_iter(e, offset);
+        bool shared = false;
+        if (is_shared(e)) {
+            if (auto r = m_cache->find(e, offset))
+                return *r;
+            shared = true;
+        }
+        if ((++m_steps & 0xff) == 0)
+            check_system("replace");
+        expr r = apply_core(e, offset, depth);
+        if (shared)
+            m_cache->insert(e, offset, r);
+        return r;
+    }
+
+    expr apply_core(expr const & e, unsigned offset, unsigned depth) {
+        if (optional<expr> r = m_f(e, offset))
+            return *r;
+        switch (e.kind()) {
+        case expr_kind::Const: case expr_kind::Sort:
+        case expr_kind::BVar:  case expr_kind::Lit:
+        case expr_kind::MVar:  case expr_kind::FVar:
+            return e;
+        case expr_kind::MData:
+            return update_mdata(e, apply(mdata_expr(e), offset, depth + 1));
+        case expr_kind::Proj:
+            return update_proj(e, apply(proj_expr(e), offset, depth + 1));
+        case expr_kind::App: {
+            expr new_f = apply(app_fn(e), offset, depth + 1);
+            expr new_a = apply(app_arg(e), offset, depth + 1);
+            return update_app(e, new_f, new_a);
+        }
+        case expr_kind::Pi: case expr_kind::Lambda: {
+            expr new_d = apply(binding_domain(e), offset, depth + 1);
+            expr new_b = apply(binding_body(e), offset + 1, depth + 1);
+            return update_binding(e, new_d, new_b);
+        }
+        case expr_kind::Let: {
+            expr new_t = apply(let_type(e), offset, depth + 1);
+            expr new_v = apply(let_value(e), offset, depth + 1);
+            expr new_b = apply(let_body(e), offset + 1, depth + 1);
+            return update_let(e, new_t, new_v, new_b);
+        }
+        }
+        lean_unreachable();
+    }
+
+    /* Push the result for `e` on `m_results` if it does not depend on its children,
+       and a frame for visiting them otherwise. */
+    void visit(expr const & e, unsigned offset) {
+        bool shared = false;
+        if (is_shared(e)) {
+            if (auto r = m_cache->find(e, offset)) {
+                m_results.push_back(*r);
+                return;
+            }
+            shared = true;
+        }
+        if ((++m_steps & 0xff) == 0)
+            check_system("replace");
+        if (optional<expr> r = m_f(e, offset)) {
+            if (shared)
+                m_cache->insert(e, offset, *r);
+            m_results.push_back(*r);
+            return;
+        }
+        switch (e.kind()) {
+        case expr_kind::Const: case expr_kind::Sort:
+        case expr_kind::BVar:  case expr_kind::Lit:
+        case expr_kind::MVar:  case expr_kind::FVar:
+            m_results.push_back(e);
+            return;
+        default:
+            m_todo.push_back(frame{&e, offset, 0, shared});
+        }
+    }
+
+    /* Visit the next child of `fr.m_e`, and return `false` if there is none. */
+    bool visit_next_child(frame & fr) {
+        expr const & e  = *fr.m_e;
+        unsigned offset = fr.m_offset;
+        unsigned i      = fr.m_next++;
+        switch (e.kind()) {
+        case expr_kind::MData:
+            if (i == 0) { visit(mdata_expr(e), offset); return true; }
+            return false;
+        case expr_kind::Proj:
+            if (i == 0) { visit(proj_expr(e), offset); return true; }
+            return false;
+        case expr_kind::App:
+            if (i == 0) { visit(app_fn(e), offset); return true; }
+            if (i == 1) { visit(app_arg(e), offset); return true; }
+            return false;
+        case expr_kind::Pi: case expr_kind::Lambda:
+            if (i == 0) { visit(binding_domain(e), offset); return true; }
+            if (i == 1) { visit(binding_body(e), offset + 1); return true; }
+            return false;
+        case expr_kind::Let:
+            if (i == 0) { visit(let_type(e), offset); return true; }
+            if (i == 1) { visit(let_value(e), offset); return true; }
+            if (i == 2) { visit(let_body(e), offset + 1); return true; }
+            return false;
+        default:
+            lean_unreachable();
+        }
+    }
+
+    /* All children of `e` have been visited, combine their results. */
+    expr combine(expr const & e) {
+        switch (e.kind()) {
+        case expr_kind::MData:
+            return update_mdata(e, pop_result());
+        case expr_kind::Proj:
+            return update_proj(e, pop_result());
+        case expr_kind::App: {
+            expr new_a = pop_result();
+            expr new_f = pop_result();
+            return update_app(e, new_f, new_a);
+        }
+        case expr_kind::Pi: case expr_kind::Lambda: {
+            expr new_b = pop_result();
+            expr new_d = pop_result();
+            return update_binding(e, new_d, new_b);
+        }
+        case expr_kind::Let: {
+            expr new_b = pop_result();
+            expr new_v = pop_result();
+            expr new_t = pop_result();
+            return update_let(e, new_t, new_v, new_b);
+        }
+        default:
+            lean_unreachable();
+        }
+    }
+
+    /* Traversal using the explicit stack `m_todo`, which is empty between calls. */
+    expr apply_iter(expr const & e, unsigned offset) {
+        visit(e, offset);
+        while (!m_todo.empty()) {
+            /* `visit_next_child` may push a new frame, and invalidate `fr` */
+            frame & fr = m_todo.back();
+            if (!visit_next_child(fr)) {
+                frame top = m_todo.back();
+                expr r = combine(*top.m_e);
+                if (top.m_shared)
+                    m_cache->insert(*top.m_e, top.m_offset, r);
+                m_todo.pop_back();
+                m_results.push_back(r);
+            }
+        }
+        lean_assert(m_results.size() == 1);
+        return pop_result();
+    }
+
+public:
+    replace_iter_fn(F const & f):m_f(f) {}
+
+    expr operator()(expr const & e) { return apply(e, 0, 0); }
+};
+
+template<typename F> expr replace_iter(expr const & e, F const & f) {
+    return replace_iter_fn<F>(f)(e);
+}
 }
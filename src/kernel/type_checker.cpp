@@ -6,9 +6,15 @@ Author: Leonardo de Moura
 */
 #include <utility>
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
 #include "runtime/interrupt.h"
 #include "runtime/sstream.h"
 #include "runtime/flet.h"
+#include "runtime/io.h"
+#include "runtime/flat_hash_map.h"
 #include "util/lbool.h"
 #include "kernel/type_checker.h"
 #include "kernel/expr_maps.h"
@@ -21,28 +27,127 @@ Author: Leonardo de Moura
 #include "kernel/inductive.h"
 
 namespace lean {
+LEAN_THREAD_PTR(type_checker_cache, g_type_checker_cache);
+LEAN_THREAD_PTR(type_checker_cache::staged_entries, g_type_checker_cache_staged);
+
+scope_type_checker_cache::scope_type_checker_cache(type_checker_cache * c):
+    m_cache(c), m_old(g_type_checker_cache), m_old_staged(g_type_checker_cache_staged) {
+    g_type_checker_cache        = c;
+    g_type_checker_cache_staged = &m_staged;
+}
+
+scope_type_checker_cache::~scope_type_checker_cache() {
+    g_type_checker_cache        = m_old;
+    g_type_checker_cache_staged = m_old_staged;
+}
+
+void scope_type_checker_cache::commit() {
+    m_cache->insert(m_staged);
+    m_staged.clear();
+}
+
+LEAN_THREAD_PTR(type_checker_stats, g_type_checker_stats);
+
+scope_type_checker_stats::scope_type_checker_stats(type_checker_stats * s):
+    m_old(g_type_checker_stats), m_lparams_start(get_instantiate_lparams_stats()) {
+    g_type_checker_stats = s;
+}
+
+scope_type_checker_stats::~scope_type_checker_stats() {
+    if (g_type_checker_stats) {
+        instantiate_lparams_stats const & end = get_instantiate_lparams_stats();
+        g_type_checker_stats->m_instantiate_lparams      += end.m_lookups - m_lparams_start.m_lookups;
+        g_type_checker_stats->m_instantiate_lparams_hits += end.m_hits - m_lparams_start.m_hits;
+    }
+    g_type_checker_stats = m_old;
+}
+
+static void display_json_string(std::ostream & out, std::string const & s) {
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<unsigned>(c) << std::dec;
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+static void display_cache_stats(std::ostream & out, char const * cache, uint64 lookups, uint64 hits) {
+    out << "\"" << cache << "\": {\"hits\": " << hits << ", \"misses\": " << lookups - hits << "}";
+}
+
+std::string type_checker_stats::to_json(unsigned top_n) const {
+    std::vector<std::pair<name, uint64>> unfolded(m_unfolded.begin(), m_unfolded.end());
+    std::sort(unfolded.begin(), unfolded.end(), [](std::pair<name, uint64> const & a, std::pair<name, uint64> const & b) {
+            return a.second > b.second || (a.second == b.second && a.first < b.first);
+        });
+    if (unfolded.size() > top_n)
+        unfolded.resize(top_n);
+    std::ostringstream out;
+    out << "{\"whnf_core\": " << m_whnf_core
+        << ", \"whnf\": " << m_whnf
+        << ", \"infer_type\": " << m_infer_type
+        << ", \"is_def_eq_core\": " << m_is_def_eq_core
+        << ", \"unfold_definition\": " << m_unfold_definition
+        << ", \"lazy_delta_reduction_step\": " << m_lazy_delta_reduction_step
+        << ", \"cache\": {";
+    display_cache_stats(out, "whnf_core", m_whnf_core, m_whnf_core_hits);
+    out << ", ";
+    display_cache_stats(out, "whnf", m_whnf, m_whnf_hits);
+    out << ", ";
+    display_cache_stats(out, "infer_type", m_infer_type, m_infer_type_hits);
+    out << ", ";
+    display_cache_stats(out, "instantiate_lparams", m_instantiate_lparams, m_instantiate_lparams_hits);
+    out << ", \"failure\": {\"hits\": " << m_failure_hits << "}}";
+    out << ", \"unfolded\": [";
+    for (size_t i = 0; i < unfolded.size(); i++) {
+        if (i > 0) out << ", ";
+        out << "{\"name\": ";
+        display_json_string(out, unfolded[i].first.to_string());
+        out << ", \"count\": " << unfolded[i].second << "}";
+    }
+    out << "]}";
+    return out.str();
+}
+
+optional<expr> type_checker_cache::find(expr_flat_map<expr> & m, expr const & e) {
+    if (!is_shareable(e))
+        return none_expr();
+    lock_guard<mutex> lock(m_mutex);
+    auto it = m.find(e);
+    if (it)
+        return some_expr(it->second);
+    return none_expr();
+}
+
+void type_checker_cache::insert(staged_entries const & es) {
+    /* the entries may be used and released by other threads */
+    for (auto const & en : es) {
+        mark_mt(std::get<1>(en).raw());
+        mark_mt(std::get<2>(en).raw());
+    }
+    lock_guard<mutex> lock(m_mutex);
+    for (auto const & en : es)
+        std::get<0>(en)->insert(mk_pair(std::get<1>(en), std::get<2>(en)));
+}
+
 static name * g_kernel_fresh = nullptr;
 static expr * g_dont_care    = nullptr;
 static name * g_bool_true    = nullptr;
 static expr * g_nat_zero     = nullptr;
 static expr * g_nat_succ     = nullptr;
-static expr * g_nat_add      = nullptr;
-static expr * g_nat_sub      = nullptr;
-static expr * g_nat_mul      = nullptr;
-static expr * g_nat_pow      = nullptr;
-static expr * g_nat_gcd      = nullptr;
-static expr * g_nat_mod      = nullptr;
-static expr * g_nat_div      = nullptr;
-static expr * g_nat_beq      = nullptr;
-static expr * g_nat_ble      = nullptr;
-static expr * g_nat_land     = nullptr;
-static expr * g_nat_lor      = nullptr;
-static expr * g_nat_xor      = nullptr;
-static expr * g_nat_shiftLeft  = nullptr;
-static expr * g_nat_shiftRight = nullptr;
 
 type_checker::state::state(environment const & env):
-    m_env(env), m_ngen(*g_kernel_fresh) {}
+    m_env(env), m_ngen(*g_kernel_fresh), m_shared(g_type_checker_cache), m_staged(g_type_checker_cache_staged),
+    m_stats(g_type_checker_stats) {}
+
+void type_checker::stage_shared(expr_flat_map<expr> & m, expr const & e, expr const & r) {
+    if (type_checker_cache::is_shareable(e))
+        m_st->m_staged->emplace_back(&m, e, r);
+}
 
 /** \brief Make sure \c e "is" a sort, and return the corresponding sort.
     If \c e is not a sort, then the whnf procedure is invoked.
@@ -294,9 +399,19 @@ expr type_checker::infer_type_core(expr const & e, bool infer_only) {
     lean_assert(!has_loose_bvars(e));
     check_system("type checker", /* do_check_interrupted */ true);
 
+    if (m_st->m_stats) m_st->m_stats->m_infer_type++;
     auto it = m_st->m_infer_type[infer_only].find(e);
-    if (it != m_st->m_infer_type[infer_only].end())
+    if (it) {
+        if (m_st->m_stats) m_st->m_stats->m_infer_type_hits++;
         return it->second;
+    }
+    if (m_st->m_shared) {
+        if (auto r = m_st->m_shared->find(m_st->m_shared->m_infer_type[infer_only], e)) {
+            if (m_st->m_stats) m_st->m_stats->m_infer_type_hits++;
+            m_st->m_infer_type[infer_only].insert(mk_pair(e, *r));
+            return *r;
+        }
+    }
 
     expr r;
     switch (e.kind()) {
@@ -319,6 +434,8 @@ expr type_checker::infer_type_core(expr const & e, bool infer_only) {
     }
 
     m_st->m_infer_type[infer_only].insert(mk_pair(e, r));
+    if (m_st->m_shared && (infer_only || m_definition_safety == definition_safety::safe))
+        stage_shared(m_st->m_shared->m_infer_type[infer_only], e, r);
     return r;
 }
 
@@ -441,9 +558,19 @@ expr type_checker::whnf_core(expr const & e, bool cheap_rec, bool cheap_proj) {
     }
 
     // check cache
+    if (m_st->m_stats) m_st->m_stats->m_whnf_core++;
     auto it = m_st->m_whnf_core.find(e);
-    if (it != m_st->m_whnf_core.end())
+    if (it) {
+        if (m_st->m_stats) m_st->m_stats->m_whnf_core_hits++;
         return it->second;
+    }
+    if (m_st->m_shared && !cheap_rec && !cheap_proj) {
+        if (auto r = m_st->m_shared->find(m_st->m_shared->m_whnf_core, e)) {
+            if (m_st->m_stats) m_st->m_stats->m_whnf_core_hits++;
+            m_st->m_whnf_core.insert(mk_pair(e, *r));
+            return *r;
+        }
+    }
 
     // do the actual work
     expr r;
@@ -494,6 +621,8 @@ expr type_checker::whnf_core(expr const & e, bool cheap_rec, bool cheap_proj) {
 
     if (!cheap_rec && !cheap_proj) {
         m_st->m_whnf_core.insert(mk_pair(e, r));
+        if (m_st->m_shared)
+            stage_shared(m_st->m_shared->m_whnf_core, e, r);
     }
     return r;
 }
@@ -513,8 +642,13 @@ optional<constant_info> type_checker::is_delta(expr const & e) const {
 optional<expr> type_checker::unfold_definition_core(expr const & e) {
     if (is_constant(e)) {
         if (auto d = is_delta(e)) {
-            if (length(const_levels(e)) == d->get_num_lparams())
+            if (length(const_levels(e)) == d->get_num_lparams()) {
+                if (m_st->m_stats) {
+                    m_st->m_stats->m_unfold_definition++;
+                    m_st->m_stats->m_unfolded.insert(mk_pair(const_name(e), static_cast<uint64>(0))).first->second++;
+                }
                 return some_expr(instantiate_value_lparams(*d, const_levels(e)));
+            }
         }
     }
     return none_expr();
@@ -569,6 +703,45 @@ optional<expr> reduce_native(environment const & env, expr const & e) {
     return none_expr();
 }
 
+/* `Nat` primitives reduced natively by `reduce_nat`, indexed by their name */
+struct nat_reduction {
+    enum class kind { UnOp, BinOp, BinPred };
+    kind m_kind;
+    union {
+        obj_res (*m_un_op)(b_obj_arg);
+        obj_res (*m_bin_op)(b_obj_arg, b_obj_arg);
+        bool (*m_bin_pred)(b_obj_arg, b_obj_arg);
+    };
+};
+typedef flat_hash_map<name, nat_reduction, name_hash_fn, name_eq_fn> nat_reduction_table;
+static nat_reduction_table * g_nat_reductions = nullptr;
+
+static void register_nat_un_op(name const & n, obj_res (*f)(b_obj_arg)) {
+    nat_reduction r; r.m_kind = nat_reduction::kind::UnOp; r.m_un_op = f;
+    g_nat_reductions->insert(mk_pair(n, r));
+}
+static void register_nat_bin_op(name const & n, obj_res (*f)(b_obj_arg, b_obj_arg)) {
+    nat_reduction r; r.m_kind = nat_reduction::kind::BinOp; r.m_bin_op = f;
+    g_nat_reductions->insert(mk_pair(n, r));
+}
+static void register_nat_bin_pred(name const & n, bool (*f)(b_obj_arg, b_obj_arg)) {
+    nat_reduction r; r.m_kind = nat_reduction::kind::BinPred; r.m_bin_pred = f;
+    g_nat_reductions->insert(mk_pair(n, r));
+}
+
+static obj_res nat_succ_fn(b_obj_arg a) { return lean_nat_succ(a); }
+static obj_res nat_pred_fn(b_obj_arg a) { return lean_nat_pred(a); }
+
+/* Literals for small numerals are shared instead of allocated on each reduction */
+#define LEAN_KERNEL_NAT_LIT_CACHE_SIZE 1024
+static expr * g_nat_lits = nullptr;
+
+static expr mk_nat_lit_cached(nat const & v) {
+    if (v.is_small() && v.get_small_value() < LEAN_KERNEL_NAT_LIT_CACHE_SIZE)
+        return g_nat_lits[v.get_small_value()];
+    return mk_lit(literal(v));
+}
+
 static inline bool is_nat_lit_ext(expr const & e) { return e == *g_nat_zero || is_nat_lit(e); }
 static inline nat get_nat_val(expr const & e) {
     lean_assert(is_nat_lit_ext(e));
@@ -576,6 +749,13 @@ static inline nat get_nat_val(expr const & e) {
     return lit_value(e).get_nat();
 }
 
+template<typename F> optional<expr> type_checker::reduce_un_nat_op(F const & f, expr const & e) {
+    expr arg = whnf(app_arg(e));
+    if (!is_nat_lit_ext(arg)) return none_expr();
+    nat v = get_nat_val(arg);
+    return some_expr(mk_nat_lit_cached(nat(f(v.raw()))));
+}
+
 template<typename F> optional<expr> type_checker::reduce_bin_nat_op(F const & f, expr const & e) {
     expr arg1 = whnf(app_arg(app_fn(e)));
     if (!is_nat_lit_ext(arg1)) return none_expr();
@@ -583,7 +763,7 @@ template<typename F> optional<expr> type_checker::reduce_bin_nat_op(F const & f,
     if (!is_nat_lit_ext(arg2)) return none_expr();
     nat v1 = get_nat_val(arg1);
     nat v2 = get_nat_val(arg2);
-    return some_expr(mk_lit(literal(nat(f(v1.raw(), v2.raw())))));
+    return some_expr(mk_nat_lit_cached(nat(f(v1.raw(), v2.raw()))));
 }
 
 template<typename F> optional<expr> type_checker::reduce_bin_nat_pred(F const & f, expr const & e) {
@@ -599,31 +779,22 @@ template<typename F> optional<expr> type_checker::reduce_bin_nat_pred(F const &
 optional<expr> type_checker::reduce_nat(expr const & e) {
     if (has_fvar(e)) return none_expr();
     unsigned nargs = get_app_num_args(e);
-    if (nargs == 1) {
-        expr const & f = app_fn(e);
-        if (f == *g_nat_succ) {
-            expr arg = whnf(app_arg(e));
-            if (!is_nat_lit_ext(arg)) return none_expr();
-            nat v = get_nat_val(arg);
-            return some_expr(mk_lit(literal(nat(v+nat(1)))));
-        }
-    } else if (nargs == 2) {
-        expr const & f = app_fn(app_fn(e));
-        if (!is_constant(f)) return none_expr();
-        if (f == *g_nat_add) return reduce_bin_nat_op(nat_add, e);
-        if (f == *g_nat_sub) return reduce_bin_nat_op(nat_sub, e);
-        if (f == *g_nat_mul) return reduce_bin_nat_op(nat_mul, e);
-        if (f == *g_nat_pow) return reduce_bin_nat_op(nat_pow, e);
-        if (f == *g_nat_gcd) return reduce_bin_nat_op(nat_gcd, e);
-        if (f == *g_nat_mod) return reduce_bin_nat_op(nat_mod, e);
-        if (f == *g_nat_div) return reduce_bin_nat_op(nat_div, e);
-        if (f == *g_nat_beq) return reduce_bin_nat_pred(nat_eq, e);
-        if (f == *g_nat_ble) return reduce_bin_nat_pred(nat_le, e);
-        if (f == *g_nat_land) return reduce_bin_nat_op(nat_land, e);
-        if (f == *g_nat_lor)  return reduce_bin_nat_op(nat_lor, e);
-        if (f == *g_nat_xor)  return reduce_bin_nat_op(nat_lxor, e);
-        if (f == *g_nat_shiftLeft) return reduce_bin_nat_op(lean_nat_shiftl, e);
-        if (f == *g_nat_shiftRight) return reduce_bin_nat_op(lean_nat_shiftr, e);
+    if (nargs != 1 && nargs != 2) return none_expr();
+    expr const & f = get_app_fn(e);
+    if (!is_constant(f)) return none_expr();
+    auto it = g_nat_reductions->find(const_name(f));
+    if (!it) return none_expr();
+    nat_reduction const * r = &it->second;
+    switch (r->m_kind) {
+    case nat_reduction::kind::UnOp:
+        if (nargs == 1) return reduce_un_nat_op(r->m_un_op, e);
+        break;
+    case nat_reduction::kind::BinOp:
+        if (nargs == 2) return reduce_bin_nat_op(r->m_bin_op, e);
+        break;
+    case nat_reduction::kind::BinPred:
+        if (nargs == 2) return reduce_bin_nat_pred(r->m_bin_pred, e);
+        break;
     }
     return none_expr();
 }
@@ -648,27 +819,41 @@ expr type_checker::whnf(expr const & e) {
     }
 
     // check cache
+    if (m_st->m_stats) m_st->m_stats->m_whnf++;
     auto it = m_st->m_whnf.find(e);
-    if (it != m_st->m_whnf.end())
+    if (it) {
+        if (m_st->m_stats) m_st->m_stats->m_whnf_hits++;
         return it->second;
+    }
+    if (m_st->m_shared) {
+        if (auto r = m_st->m_shared->find(m_st->m_shared->m_whnf, e)) {
+            if (m_st->m_stats) m_st->m_stats->m_whnf_hits++;
+            m_st->m_whnf.insert(mk_pair(e, *r));
+            return *r;
+        }
+    }
 
     expr t = e;
+    expr r;
     while (true) {
         expr t1 = whnf_core(t);
         if (auto v = reduce_native(env(), t1)) {
-            m_st->m_whnf.insert(mk_pair(e, *v));
-            return *v;
+            r = *v;
+            break;
         } else if (auto v = reduce_nat(t1)) {
-            m_st->m_whnf.insert(mk_pair(e, *v));
-            return *v;
+            r = *v;
+            break;
         } else if (auto next_t = unfold_definition(t1)) {
             t = *next_t;
         } else {
-            auto r = t1;
-            m_st->m_whnf.insert(mk_pair(e, r));
-            return r;
+            r = t1;
+            break;
         }
     }
+    m_st->m_whnf.insert(mk_pair(e, r));
+    if (m_st->m_shared)
+        stage_shared(m_st->m_shared->m_whnf, e, r);
+    return r;
 }
 
 /** \brief Given lambda/Pi expressions \c t and \c s, return true iff \c t is def eq to \c s.
@@ -834,15 +1019,18 @@ lbool type_checker::is_def_eq_proof_irrel(expr const & t, expr const & s) {
 }
 
 bool type_checker::failed_before(expr const & t, expr const & s) const {
+    bool r;
     if (hash(t) < hash(s)) {
-        return m_st->m_failure.find(mk_pair(t, s)) != m_st->m_failure.end();
+        r = m_st->m_failure.contains(mk_pair(t, s));
     } else if (hash(t) > hash(s)) {
-        return m_st->m_failure.find(mk_pair(s, t)) != m_st->m_failure.end();
+        r = m_st->m_failure.contains(mk_pair(s, t));
     } else {
-        return
-            m_st->m_failure.find(mk_pair(t, s)) != m_st->m_failure.end() ||
-            m_st->m_failure.find(mk_pair(s, t)) != m_st->m_failure.end();
+        r =
+            m_st->m_failure.contains(mk_pair(t, s)) ||
+            m_st->m_failure.contains(mk_pair(s, t));
     }
+    if (r && m_st->m_stats) m_st->m_stats->m_failure_hits++;
+    return r;
 }
 
 void type_checker::cache_failure(expr const & t, expr const & s) {
@@ -873,6 +1061,7 @@ optional<expr> type_checker::try_unfold_proj_app(expr const & e) {
 
      \remark t_n, s_n and cs are updated. */
 auto type_checker::lazy_delta_reduction_step(expr & t_n, expr & s_n) -> reduction_status {
+    if (m_st->m_stats) m_st->m_stats->m_lazy_delta_reduction_step++;
     auto d_t = is_delta(t_n);
     auto d_s = is_delta(s_n);
     if (!d_t && !d_s) {
@@ -1045,6 +1234,7 @@ bool type_checker::is_def_eq_unit_like(expr const & t, expr const & s) {
 
 bool type_checker::is_def_eq_core(expr const & t, expr const & s) {
     check_system("is_definitionally_equal", /* do_check_interrupted */ true);
+    if (m_st->m_stats) m_st->m_stats->m_is_def_eq_core++;
     bool use_hash = true;
     lbool r = quick_is_def_eq(t, s, use_hash);
     if (r != l_undef) return r == l_true;
@@ -1187,7 +1377,23 @@ inline static expr * new_persistent_expr_const(name const & n) {
     return e;
 }
 
+static lean_external_class * g_type_checker_cache_external_class = nullptr;
+static void type_checker_cache_finalizer(void * c) {
+    delete static_cast<type_checker_cache *>(c);
+}
+static void type_checker_cache_foreach(void *, b_obj_arg) {}
+
+type_checker_cache * to_type_checker_cache(b_obj_arg c) {
+    return static_cast<type_checker_cache *>(lean_get_external_data(c));
+}
+
+/* Kernel.Cache.new : BaseIO Kernel.Cache */
+extern "C" LEAN_EXPORT obj_res lean_kernel_cache_new(obj_arg) {
+    return io_result_mk_ok(lean_alloc_external(g_type_checker_cache_external_class, new type_checker_cache()));
+}
+
 void initialize_type_checker() {
+    g_type_checker_cache_external_class = lean_register_external_class(type_checker_cache_finalizer, type_checker_cache_foreach);
     g_kernel_fresh = new name("_kernel_fresh");
     mark_persistent(g_kernel_fresh->raw());
     g_bool_true    = new name{"Bool", "true"};
@@ -1195,20 +1401,29 @@ void initialize_type_checker() {
     g_dont_care    = new_persistent_expr_const("dontcare");
     g_nat_zero     = new_persistent_expr_const({"Nat", "zero"});
     g_nat_succ     = new_persistent_expr_const({"Nat", "succ"});
-    g_nat_add      = new_persistent_expr_const({"Nat", "add"});
-    g_nat_sub      = new_persistent_expr_const({"Nat", "sub"});
-    g_nat_mul      = new_persistent_expr_const({"Nat", "mul"});
-    g_nat_pow      = new_persistent_expr_const({"Nat", "pow"});
-    g_nat_gcd      = new_persistent_expr_const({"Nat", "gcd"});
-    g_nat_div      = new_persistent_expr_const({"Nat", "div"});
-    g_nat_mod      = new_persistent_expr_const({"Nat", "mod"});
-    g_nat_beq      = new_persistent_expr_const({"Nat", "beq"});
-    g_nat_ble      = new_persistent_expr_const({"Nat", "ble"});
-    g_nat_land     = new_persistent_expr_const({"Nat", "land"});
-    g_nat_lor      = new_persistent_expr_const({"Nat", "lor"});
-    g_nat_xor      = new_persistent_expr_const({"Nat", "xor"});
-    g_nat_shiftLeft  = new_persistent_expr_const({"Nat", "shiftLeft"});
-    g_nat_shiftRight = new_persistent_expr_const({"Nat", "shiftRight"});
+    g_nat_reductions = new nat_reduction_table();
+    register_nat_un_op({"Nat", "succ"}, nat_succ_fn);
+    register_nat_un_op({"Nat", "pred"}, nat_pred_fn);
+    register_nat_un_op({"Nat", "log2"}, lean_nat_log2);
+    register_nat_bin_op({"Nat", "add"}, nat_add);
+    register_nat_bin_op({"Nat", "sub"}, nat_sub);
+    register_nat_bin_op({"Nat", "mul"}, nat_mul);
+    register_nat_bin_op({"Nat", "pow"}, nat_pow);
+    register_nat_bin_op({"Nat", "gcd"}, nat_gcd);
+    register_nat_bin_op({"Nat", "div"}, nat_div);
+    register_nat_bin_op({"Nat", "mod"}, nat_mod);
+    register_nat_bin_op({"Nat", "land"}, nat_land);
+    register_nat_bin_op({"Nat", "lor"}, nat_lor);
+    register_nat_bin_op({"Nat", "xor"}, nat_lxor);
+    register_nat_bin_op({"Nat", "shiftLeft"}, lean_nat_shiftl);
+    register_nat_bin_op({"Nat", "shiftRight"}, lean_nat_shiftr);
+    register_nat_bin_pred({"Nat", "beq"}, nat_eq);
+    register_nat_bin_pred({"Nat", "ble"}, nat_le);
+    g_nat_lits = new expr[LEAN_KERNEL_NAT_LIT_CACHE_SIZE];
+    for (unsigned i = 0; i < LEAN_KERNEL_NAT_LIT_CACHE_SIZE; i++) {
+        g_nat_lits[i] = mk_lit(literal(nat(i)));
+        mark_persistent(g_nat_lits[i].raw());
+    }
     g_string_mk    = new_persistent_expr_const({"String", "mk"});
     g_lean_reduce_bool = new_persistent_expr_const({"Lean", "reduceBool"});
     g_lean_reduce_nat  = new_persistent_expr_const({"Lean", "reduceNat"});
@@ -1221,20 +1436,8 @@ void finalize_type_checker() {
     delete g_dont_care;
     delete g_nat_succ;
     delete g_nat_zero;
-    delete g_nat_add;
-    delete g_nat_sub;
-    delete g_nat_mul;
-    delete g_nat_pow;
-    delete g_nat_gcd;
-    delete g_nat_div;
-    delete g_nat_mod;
-    delete g_nat_beq;
-    delete g_nat_ble;
-    delete g_nat_land;
-    delete g_nat_lor;
-    delete g_nat_xor;
-    delete g_nat_shiftLeft;
-    delete g_nat_shiftRight;
+    delete g_nat_reductions;
+    delete[] g_nat_lits;
     delete g_string_mk;
     delete g_lean_reduce_bool;
     delete g_lean_reduce_nat;
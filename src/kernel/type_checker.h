@@ -7,31 +7,119 @@ Author: Leonardo de Moura
 #pragma once
 #include <unordered_set>
 #include <memory>
+#include <string>
 #include <utility>
 #include <algorithm>
+#include <tuple>
+#include <vector>
+#include "runtime/thread.h"
 #include "util/lbool.h"
 #include "util/name_set.h"
 #include "util/name_generator.h"
 #include "kernel/environment.h"
 #include "kernel/local_ctx.h"
+#include "kernel/instantiate.h"
 #include "kernel/expr_maps.h"
 #include "kernel/equiv_manager.h"
 
 namespace lean {
+/** \brief Type inference and weak head normalization results that can be shared by the type checkers of
+    several declarations, see `scope_type_checker_cache`.
+
+    Only results for closed terms without universe parameters are stored, as they depend on nothing but the
+    constants of the environment. Thus a cache must only be shared between environments that agree on all
+    constants they have in common, such as the environments obtained by adding the declarations of a module
+    one after the other.
+
+    Results are only added once the declaration they were computed for has been accepted, see
+    `scope_type_checker_cache::commit`. Otherwise a failed check could leave behind results that depend on
+    constants that never made it into the environment. */
+class type_checker_cache {
+public:
+    /* results computed by the type checkers of a `scope_type_checker_cache` that have not been added yet */
+    typedef std::vector<std::tuple<expr_flat_map<expr> *, expr, expr>> staged_entries;
+private:
+    mutex          m_mutex;
+    /* `m_infer_type[false]` only contains types inferred while checking in `definition_safety::safe` mode */
+    expr_flat_map<expr> m_infer_type[2];
+    expr_flat_map<expr> m_whnf_core;
+    expr_flat_map<expr> m_whnf;
+    friend class type_checker;
+    friend class scope_type_checker_cache;
+    static bool is_shareable(expr const & e) { return !has_fvar(e) && !has_univ_param(e); }
+    optional<expr> find(expr_flat_map<expr> & m, expr const & e);
+    void insert(staged_entries const & es);
+};
+
+/** \brief Return the cache wrapped by a `Kernel.Cache` object. */
+type_checker_cache * to_type_checker_cache(b_obj_arg c);
+
+/** \brief While in scope, type checkers created on this thread use the given shared cache. The results they
+    compute are only added to it by `commit`. */
+class scope_type_checker_cache {
+    type_checker_cache *                 m_cache;
+    type_checker_cache *                 m_old;
+    type_checker_cache::staged_entries * m_old_staged;
+    type_checker_cache::staged_entries   m_staged;
+public:
+    scope_type_checker_cache(type_checker_cache * c);
+    ~scope_type_checker_cache();
+    /** \brief Add the results computed in this scope to the cache. Must only be called after the declarations
+        checked in this scope have been accepted. */
+    void commit();
+};
+
+/** \brief Counters of the work done by the type checkers created on a thread while a `scope_type_checker_stats`
+    is active. Used to find out why a declaration is slow to check, see `Environment.addDeclWithStats`. */
+struct type_checker_stats {
+    typedef flat_hash_map<name, uint64, name_hash_fn, name_eq_fn> name_counters;
+    uint64        m_whnf_core{0};
+    uint64        m_whnf{0};
+    uint64        m_infer_type{0};
+    uint64        m_is_def_eq_core{0};
+    uint64        m_unfold_definition{0};
+    uint64        m_lazy_delta_reduction_step{0};
+    uint64        m_whnf_core_hits{0};
+    uint64        m_whnf_hits{0};
+    uint64        m_infer_type_hits{0};
+    uint64        m_failure_hits{0};
+    /* lookups in the cache of `instantiate_type_lparams`, `instantiate_value_lparams` and
+       `instantiate_rec_rule_lparams` (recursor rules) */
+    uint64        m_instantiate_lparams{0};
+    uint64        m_instantiate_lparams_hits{0};
+    /* number of times each constant was unfolded */
+    name_counters m_unfolded;
+    /** \brief Return the counters as a JSON object, including the `top_n` most frequently unfolded constants. */
+    std::string to_json(unsigned top_n) const;
+};
+
+/** \brief While in scope, type checkers created on this thread record their work in the given counters. */
+class scope_type_checker_stats {
+    type_checker_stats *      m_old;
+    instantiate_lparams_stats m_lparams_start;
+public:
+    scope_type_checker_stats(type_checker_stats * s);
+    ~scope_type_checker_stats();
+};
+
 /** \brief Lean Type Checker. It can also be used to infer types, check whether a
     type \c A is convertible to a type \c B, etc. */
 class type_checker {
 public:
     class state {
-        typedef expr_map<expr> infer_cache;
-        typedef std::unordered_set<expr_pair, expr_pair_hash, expr_pair_eq> expr_pair_set;
+        typedef expr_flat_map<expr> infer_cache;
+        typedef flat_hash_set<expr_pair, expr_pair_hash, expr_pair_eq> expr_pair_set;
         environment               m_env;
         name_generator            m_ngen;
         infer_cache               m_infer_type[2];
-        expr_map<expr>            m_whnf_core;
-        expr_map<expr>            m_whnf;
+        expr_flat_map<expr>       m_whnf_core;
+        expr_flat_map<expr>       m_whnf;
         equiv_manager             m_eqv_manager;
         expr_pair_set             m_failure;
+        type_checker_cache *      m_shared;
+        /* results for `m_shared`, added to it when the scope commits */
+        type_checker_cache::staged_entries * m_staged;
+        type_checker_stats *      m_stats;
         friend type_checker;
     public:
         state(environment const & env);
@@ -51,6 +139,7 @@ private:
     expr ensure_sort_core(expr e, expr const & s);
     expr ensure_pi_core(expr e, expr const & s);
     void check_level(level const & l);
+    void stage_shared(expr_flat_map<expr> & m, expr const & e, expr const & r);
     expr infer_fvar(expr const & e);
     expr infer_constant(expr const & e, bool infer_only);
     expr infer_lambda(expr const & e, bool infer_only);
@@ -98,6 +187,7 @@ private:
     expr check_ignore_undefined_universes(expr const & e);
     optional<expr> try_unfold_proj_app(expr const & e);
 
+    template<typename F> optional<expr> reduce_un_nat_op(F const & f, expr const & e);
     template<typename F> optional<expr> reduce_bin_nat_op(F const & f, expr const & e);
     template<typename F> optional<expr> reduce_bin_nat_pred(F const & f, expr const & e);
     optional<expr> reduce_nat(expr const & e);
@@ -10,24 +10,30 @@ Motivation
 ==========
 
 Even with a JIT compiler, we still have a need for a simpler interpreter on platforms LLVM JIT does not support (i.e.
-WebAssembly). Because this is mostly an edge case, we strive for simplicity instead of performance and thus reuse the
-existing compiler IR instead of inventing something like a new bytecode format.
+WebAssembly). The interpreter is also used by `#eval`, `Lean.reduceBool`, and for running tactics and other
+extensions from the same package, so its speed still matters.
 
 Implementation
 ==============
 
 The interpreter mainly consists of a homogeneous stack of `value`s, which are either unboxed values or pointers to boxed
 objects. The IR type system tells us which union member is active at any time. IR variables are mapped to stack
-slots by adding the current base pointer to the variable index. Further stacks are used for storing join points and call
-stack metadata. The interpreted IR is taken directly from the environment. Whenever possible, we try to switch to native
-code by checking for the mangled symbol via dlsym/GetProcAddress, which is also how we can call external functions
-(which only works if the file declaring them has already been compiled). We always call the "boxed" versions of native
-functions, which have a (relatively) homogeneous ABI that we can use without runtime code generation; see also
-`call/lookup_symbol` below.
+slots by adding the current base pointer to the variable index. A further stack is used for call stack metadata. The IR
+is taken from the environment and, before its first interpretation, lowered to a flat array of instructions (`code`)
+whose operands are decoded in advance: the frame size is known, join points and `case` alternatives become jump
+targets, and call sites point directly to the entry of the called function after their first execution. The lowered code
+is cached per environment; see `code_cache`. Whenever possible, we try to switch to native code by checking for the
+mangled symbol via dlsym/GetProcAddress, which is also how we can call external functions (which only works if the file
+declaring them has already been compiled). The results of these lookups are shared by all environments; see
+`symbol_cache`. We always call the "boxed" versions of native functions, which have a (relatively) homogeneous ABI that
+we can use without runtime code generation; see also `call/lookup_fn` below.
 
 */
 #include <string>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <unordered_map>
 #ifdef LEAN_WINDOWS
 #include <windows.h>
 #include <psapi.h>
@@ -40,6 +46,8 @@ functions, which have a (relatively) homogeneous ABI that we can use without run
 #include "runtime/io.h"
 #include "runtime/option_ref.h"
 #include "runtime/array_ref.h"
+#include "runtime/load_dynlib.h"
+#include "runtime/thread.h"
 #include "kernel/trace.h"
 #include "library/time_task.h"
 #include "library/compiler/ir.h"
@@ -319,21 +327,585 @@ void * lookup_symbol_in_cur_exe(char const * sym) {
 #endif
 }
 
+/** \brief Stack slot of an IR variable relative to the base pointer of the current frame. */
+typedef unsigned slot;
+/** \brief Pseudo slot of irrelevant (type- or proof-erased) arguments. */
+constexpr slot irrelevant_slot = static_cast<slot>(-1);
+/** \brief Jump target of missing `case` alternatives. */
+constexpr unsigned no_target = static_cast<unsigned>(-1);
+
+/** \brief Operations of the lowered code. The operations up to `IsTaggedPtr` correspond to `expr_kind` and declare the
+    variable `m_dst` (`FAp` of nullary functions becomes `Const`), the other ones correspond to `fn_body_kind`. Join point
+    declarations and metadata do not exist in the lowered code. */
+enum class opcode : uint8 {
+    Ctor, Reset, Reuse, Proj, UProj, SProj, FAp, Const, PAp, Ap, Box, Unbox, Lit, IsShared, IsTaggedPtr,
+    TailCall, Set, SetTag, USet, SSet, Inc, Dec, Del, Case, Ret, Jmp, Unreachable
+};
+
+/** \brief A lowered IR instruction. All operands are decoded from the IR objects in advance. */
+struct instr {
+    opcode   m_op;
+    // type of `m_dst` for variable declarations; type of `m_src` for `Case`; type of the stored field for `SSet`
+    type     m_type;
+    // `Reuse`: whether the constructor tag must be updated
+    bool     m_update_header;
+    slot     m_dst;
+    slot     m_src;
+    // arguments are `code::m_slots[m_args], ..., code::m_slots[m_args + m_num_args - 1]`, followed by the join point
+    // parameters for `Jmp`
+    unsigned m_args;
+    unsigned m_num_args;
+    // field index, byte offset, tag, reference count delta, jump target, boxed type (`Box`),
+    // or index into `code::m_ctors`, `code::m_calls`, `code::m_lits`, or `code::m_cases`
+    size_t   m_n;
+};
+
+struct ctor_desc {
+    unsigned m_tag;
+    // number of boxed object fields
+    unsigned m_num_objs;
+    // byte size of all unboxed fields
+    unsigned m_scalar_sz;
+};
+
+struct fn_entry;
+
+/** \brief Call target of `FAp`, `Const`, and `PAp`, resolved on first execution. */
+struct call_site {
+    name       m_fn;
+    fn_entry * m_entry;
+};
+
+/** \brief Jump table of a `Case` instruction indexed by constructor tag. */
+struct case_table {
+    std::vector<unsigned> m_targets;
+    unsigned              m_default;
+};
+
+/** \brief Body of an IR declaration lowered to a flat array of instructions over a fixed-size stack frame. */
+struct code {
+    unsigned                m_frame_size = 0;
+    std::vector<instr>      m_instrs;
+    std::vector<slot>       m_slots;
+    std::vector<ctor_desc>  m_ctors;
+    std::vector<call_site>  m_calls;
+    std::vector<value>      m_lits;
+    // keeps the object literals in `m_lits` alive
+    std::vector<object_ref> m_lit_objs;
+    std::vector<case_table> m_cases;
+    // IR node of each instruction, for tracing
+    DEBUG_CODE(std::vector<fn_body> m_bodies;)
+};
+
+/** \brief Function declaration together with its native symbol, if any, and its lowered code. */
+struct fn_entry {
+    decl                  m_decl;
+    // symbol address; `nullptr` if function does not have native code
+    void *                m_addr;
+    // true iff we chose the boxed version of a function where the IR uses the unboxed version
+    bool                  m_boxed;
+    type                  m_type;
+    std::vector<type>     m_param_types;
+    std::vector<bool>     m_param_borrow;
+    // lowered on first interpretation
+    std::unique_ptr<code> m_code;
+
+    fn_entry(decl const & d, void * addr, bool boxed):m_decl(d), m_addr(addr), m_boxed(boxed), m_type(decl_type(d)) {
+        for (param const & p : decl_params(d)) {
+            m_param_types.push_back(param_type(p));
+            m_param_borrow.push_back(param_borrow(p));
+        }
+    }
+    unsigned get_arity() const { return m_param_types.size(); }
+};
+
+/** \brief Lower IR function body to `code`. */
+class lower_fn {
+    code &       m_code;
+    name const & m_fn;
+    struct jp_info {
+        size_t                m_idx;
+        // parameters are `m_code.m_slots[m_params], ...`
+        unsigned              m_params;
+        unsigned              m_num_params;
+        // `Jmp` instructions to be patched once the join point body has been lowered
+        std::vector<unsigned> m_jumps;
+    };
+    // join points in scope
+    std::vector<jp_info> m_jps;
+
+    slot to_slot(var_id const & x) {
+        // variables are 1-indexed
+        slot s = x.get_small_value() - 1;
+        if (s >= m_code.m_frame_size)
+            m_code.m_frame_size = s + 1;
+        return s;
+    }
+
+    slot to_slot(arg const & a) {
+        return arg_is_irrelevant(a) ? irrelevant_slot : to_slot(arg_var_id(a));
+    }
+
+    unsigned add_args(array_ref<arg> const & args) {
+        unsigned r = m_code.m_slots.size();
+        for (arg const & a : args) {
+            slot s = to_slot(a);
+            m_code.m_slots.push_back(s);
+        }
+        return r;
+    }
+
+    unsigned pc() const { return m_code.m_instrs.size(); }
+
+    instr & emit(opcode op, fn_body const & DEBUG_CODE(b)) {
+        m_code.m_instrs.push_back(instr { op, type::Irrelevant, false, 0, 0, 0, 0, 0 });
+        DEBUG_CODE(m_code.m_bodies.push_back(b);)
+        return m_code.m_instrs.back();
+    }
+
+    size_t add_ctor(ctor_info const & i) {
+        m_code.m_ctors.push_back(ctor_desc {
+            static_cast<unsigned>(ctor_info_tag(i).get_small_value()),
+            static_cast<unsigned>(ctor_info_size(i).get_small_value()),
+            // the IR is ignorant of the byte size of USize fields
+            static_cast<unsigned>(ctor_info_usize(i).get_small_value() * sizeof(void *) + ctor_info_ssize(i).get_small_value())
+        });
+        return m_code.m_ctors.size() - 1;
+    }
+
+    size_t add_call(name const & fn) {
+        m_code.m_calls.push_back(call_site { fn, nullptr });
+        return m_code.m_calls.size() - 1;
+    }
+
+    size_t add_lit(lit_val const & l, type t) {
+        value v;
+        switch (lit_val_tag(l)) {
+            case lit_val_kind::Num: {
+                nat const & n = lit_val_num(l);
+                switch (t) {
+                    case type::Float:
+                        lean_inc(n.raw());
+                        v = value::from_float(lean_float_of_nat(n.raw()));
+                        break;
+                    case type::UInt8:
+                    case type::UInt16:
+                    case type::UInt32:
+                    case type::USize:
+                        v = lean_usize_of_nat(n.raw());
+                        break;
+                    case type::UInt64:
+                        v = lean_uint64_of_nat(n.raw());
+                        break;
+                    // `nat` literal
+                    case type::Object:
+                    case type::TObject:
+                        v = n.raw();
+                        m_code.m_lit_objs.push_back(n);
+                        break;
+                    case type::Irrelevant:
+                        throw exception("invalid instruction");
+                }
+                break;
+            }
+            case lit_val_kind::Str:
+                v = lit_val_str(l).raw();
+                m_code.m_lit_objs.push_back(lit_val_str(l));
+                break;
+        }
+        m_code.m_lits.push_back(v);
+        return m_code.m_lits.size() - 1;
+    }
+
+    bool is_self_tail_call(fn_body const & b) {
+        expr const & e = fn_body_vdecl_expr(b);
+        fn_body const & cont = fn_body_vdecl_cont(b);
+        return
+            expr_tag(e) == expr_kind::FAp && expr_fap_fun(e) == m_fn &&
+            fn_body_tag(cont) == fn_body_kind::Ret && !arg_is_irrelevant(fn_body_ret_arg(cont)) &&
+            arg_var_id(fn_body_ret_arg(cont)) == fn_body_vdecl_var(b);
+    }
+
+    void lower_vdecl(fn_body const & b) {
+        expr const & e = fn_body_vdecl_expr(b);
+        slot dst = to_slot(fn_body_vdecl_var(b));
+        instr i { opcode::Unreachable, fn_body_vdecl_type(b), false, dst, 0, 0, 0, 0 };
+        switch (expr_tag(e)) {
+            case expr_kind::Ctor:
+                i.m_op = opcode::Ctor;
+                i.m_n = add_ctor(expr_ctor_info(e));
+                i.m_args = add_args(expr_ctor_args(e));
+                i.m_num_args = expr_ctor_args(e).size();
+                break;
+            case expr_kind::Reset:
+                i.m_op = opcode::Reset;
+                i.m_src = to_slot(expr_reset_obj(e));
+                i.m_n = expr_reset_num_objs(e).get_small_value();
+                break;
+            case expr_kind::Reuse:
+                i.m_op = opcode::Reuse;
+                i.m_src = to_slot(expr_reuse_obj(e));
+                i.m_update_header = expr_reuse_update_header(e);
+                i.m_n = add_ctor(expr_reuse_ctor(e));
+                i.m_args = add_args(expr_reuse_args(e));
+                i.m_num_args = expr_reuse_args(e).size();
+                break;
+            case expr_kind::Proj:
+                i.m_op = opcode::Proj;
+                i.m_src = to_slot(expr_proj_obj(e));
+                i.m_n = expr_proj_idx(e).get_small_value();
+                break;
+            case expr_kind::UProj:
+                i.m_op = opcode::UProj;
+                i.m_src = to_slot(expr_uproj_obj(e));
+                i.m_n = expr_uproj_idx(e).get_small_value();
+                break;
+            case expr_kind::SProj:
+                i.m_op = opcode::SProj;
+                i.m_src = to_slot(expr_sproj_obj(e));
+                i.m_n = expr_sproj_idx(e).get_small_value() * sizeof(void *) + expr_sproj_offset(e).get_small_value();
+                break;
+            case expr_kind::FAp:
+                i.m_op = expr_fap_args(e).size() ? opcode::FAp : opcode::Const;
+                i.m_n = add_call(expr_fap_fun(e));
+                i.m_args = add_args(expr_fap_args(e));
+                i.m_num_args = expr_fap_args(e).size();
+                break;
+            case expr_kind::PAp:
+                i.m_op = opcode::PAp;
+                i.m_n = add_call(expr_pap_fun(e));
+                i.m_args = add_args(expr_pap_args(e));
+                i.m_num_args = expr_pap_args(e).size();
+                break;
+            case expr_kind::Ap:
+                i.m_op = opcode::Ap;
+                i.m_src = to_slot(expr_ap_fun(e));
+                i.m_args = add_args(expr_ap_args(e));
+                i.m_num_args = expr_ap_args(e).size();
+                break;
+            case expr_kind::Box:
+                i.m_op = opcode::Box;
+                i.m_src = to_slot(expr_box_obj(e));
+                i.m_n = static_cast<size_t>(expr_box_type(e));
+                break;
+            case expr_kind::Unbox:
+                i.m_op = opcode::Unbox;
+                i.m_src = to_slot(expr_unbox_obj(e));
+                break;
+            case expr_kind::Lit:
+                i.m_op = opcode::Lit;
+                i.m_n = add_lit(expr_lit_val(e), fn_body_vdecl_type(b));
+                break;
+            case expr_kind::IsShared:
+                i.m_op = opcode::IsShared;
+                i.m_src = to_slot(expr_is_shared_obj(e));
+                break;
+            case expr_kind::IsTaggedPtr:
+                i.m_op = opcode::IsTaggedPtr;
+                i.m_src = to_slot(expr_is_tagged_ptr_obj(e));
+                break;
+            default:
+                throw exception(sstream() << "unexpected instruction kind " << static_cast<unsigned>(expr_tag(e)));
+        }
+        emit(i.m_op, b) = i;
+    }
+
+    void lower_case(fn_body const & b) {
+        size_t idx = m_code.m_cases.size();
+        m_code.m_cases.push_back(case_table { {}, no_target });
+        instr & i = emit(opcode::Case, b);
+        i.m_src = to_slot(fn_body_case_var(b));
+        i.m_type = fn_body_case_var_type(b);
+        i.m_n = idx;
+        // as in a linear search, the first matching alternative wins and alternatives after a default one are dead
+        std::vector<unsigned> targets;
+        unsigned dflt = no_target;
+        for (alt_core const & a : fn_body_case_alts(b)) {
+            if (alt_core_tag(a) == alt_core_kind::Default) {
+                dflt = pc();
+                lower(alt_core_default_cont(a));
+                break;
+            }
+            size_t tag = ctor_info_tag(alt_core_ctor_info(a)).get_small_value();
+            if (tag >= targets.size())
+                targets.resize(tag + 1, no_target);
+            if (targets[tag] == no_target) {
+                targets[tag] = pc();
+                lower(alt_core_ctor_cont(a));
+            }
+        }
+        for (unsigned & t : targets) {
+            if (t == no_target)
+                t = dflt;
+        }
+        m_code.m_cases[idx] = case_table { std::move(targets), dflt };
+    }
+
+    void lower_jdecl(fn_body const & b) {
+        array_ref<param> const & params = fn_body_jdecl_params(b);
+        unsigned ps = m_code.m_slots.size();
+        for (param const & p : params) {
+            slot s = to_slot(param_var(p));
+            m_code.m_slots.push_back(s);
+        }
+        m_jps.push_back(jp_info { fn_body_jdecl_id(b).get_small_value(), ps, static_cast<unsigned>(params.size()), {} });
+        // the join point is only visible in the continuation, whose lowering ends with a terminator, so we can put the
+        // join point body after it
+        lower(fn_body_jdecl_cont(b));
+        jp_info jp = std::move(m_jps.back());
+        m_jps.pop_back();
+        unsigned target = pc();
+        lower(fn_body_jdecl_body(b));
+        for (unsigned j : jp.m_jumps)
+            m_code.m_instrs[j].m_n = target;
+    }
+
+    void lower_jmp(fn_body const & b) {
+        size_t idx = fn_body_jmp_jp(b).get_small_value();
+        for (auto it = m_jps.rbegin(); it != m_jps.rend(); it++) {
+            if (it->m_idx == idx) {
+                lean_assert(it->m_num_params == fn_body_jmp_args(b).size());
+                unsigned args = add_args(fn_body_jmp_args(b));
+                for (unsigned k = 0; k < it->m_num_params; k++) {
+                    slot s = m_code.m_slots[it->m_params + k];
+                    m_code.m_slots.push_back(s);
+                }
+                it->m_jumps.push_back(pc());
+                instr & i = emit(opcode::Jmp, b);
+                i.m_args = args;
+                i.m_num_args = it->m_num_params;
+                return;
+            }
+        }
+        throw exception(sstream() << "unknown join point in '" << m_fn << "'");
+    }
+
+    void lower(fn_body const & b0) {
+        // make reference reassignable...
+        std::reference_wrapper<fn_body const> b(b0);
+        while (true) {
+            switch (fn_body_tag(b)) {
+                case fn_body_kind::VDecl:
+                    if (is_self_tail_call(b)) {
+                        // tail recursion! copy argument values to parameter slots and jump to the beginning
+                        array_ref<arg> const & args = expr_fap_args(fn_body_vdecl_expr(b));
+                        unsigned first = add_args(args);
+                        instr & i = emit(opcode::TailCall, b);
+                        i.m_args = first;
+                        i.m_num_args = args.size();
+                        return;
+                    }
+                    lower_vdecl(b);
+                    b = fn_body_vdecl_cont(b);
+                    break;
+                case fn_body_kind::JDecl:
+                    lower_jdecl(b);
+                    return;
+                case fn_body_kind::Set: {
+                    slot src = to_slot(fn_body_set_arg(b));
+                    instr & i = emit(opcode::Set, b);
+                    i.m_dst = to_slot(fn_body_set_var(b));
+                    i.m_src = src;
+                    i.m_n = fn_body_set_idx(b).get_small_value();
+                    b = fn_body_set_cont(b);
+                    break;
+                }
+                case fn_body_kind::SetTag: {
+                    instr & i = emit(opcode::SetTag, b);
+                    i.m_dst = to_slot(fn_body_set_tag_var(b));
+                    i.m_n = fn_body_set_tag_cidx(b).get_small_value();
+                    b = fn_body_set_tag_cont(b);
+                    break;
+                }
+                case fn_body_kind::USet: {
+                    instr & i = emit(opcode::USet, b);
+                    i.m_dst = to_slot(fn_body_uset_target(b));
+                    i.m_src = to_slot(fn_body_uset_source(b));
+                    i.m_n = fn_body_uset_idx(b).get_small_value();
+                    b = fn_body_uset_cont(b);
+                    break;
+                }
+                case fn_body_kind::SSet: {
+                    instr & i = emit(opcode::SSet, b);
+                    i.m_dst = to_slot(fn_body_sset_target(b));
+                    i.m_src = to_slot(fn_body_sset_source(b));
+                    i.m_type = fn_body_sset_type(b);
+                    i.m_n = fn_body_sset_idx(b).get_small_value() * sizeof(void *) +
+                            fn_body_sset_offset(b).get_small_value();
+                    b = fn_body_sset_cont(b);
+                    break;
+                }
+                case fn_body_kind::Inc: {
+                    instr & i = emit(opcode::Inc, b);
+                    i.m_src = to_slot(fn_body_inc_var(b));
+                    i.m_n = fn_body_inc_val(b).get_small_value();
+                    b = fn_body_inc_cont(b);
+                    break;
+                }
+                case fn_body_kind::Dec: {
+                    instr & i = emit(opcode::Dec, b);
+                    i.m_src = to_slot(fn_body_dec_var(b));
+                    i.m_n = fn_body_dec_val(b).get_small_value();
+                    b = fn_body_dec_cont(b);
+                    break;
+                }
+                case fn_body_kind::Del: {
+                    instr & i = emit(opcode::Del, b);
+                    i.m_src = to_slot(fn_body_del_var(b));
+                    b = fn_body_del_cont(b);
+                    break;
+                }
+                case fn_body_kind::MData: // metadata; no-op
+                    b = fn_body_mdata_cont(b);
+                    break;
+                case fn_body_kind::Case:
+                    lower_case(b);
+                    return;
+                case fn_body_kind::Ret: {
+                    slot src = to_slot(fn_body_ret_arg(b));
+                    emit(opcode::Ret, b).m_src = src;
+                    return;
+                }
+                case fn_body_kind::Jmp:
+                    lower_jmp(b);
+                    return;
+                case fn_body_kind::Unreachable:
+                    emit(opcode::Unreachable, b);
+                    return;
+            }
+        }
+    }
+
+public:
+    lower_fn(code & c, name const & fn):m_code(c), m_fn(fn) {}
+
+    void operator()(decl const & d) {
+        // parameters occupy the first slots
+        for (param const & p : decl_params(d))
+            to_slot(param_var(p));
+        lower(decl_fun_body(d));
+    }
+};
+
+/** \brief Process-wide cache of native symbol lookups.
+
+    Looking up a symbol means mangling its name and searching all loaded libraries, which would otherwise be repeated
+    for every new environment, e.g. for each snapshot in the language server. The result does not depend on the
+    environment, so it is shared by all threads and environments. Each entry remembers the declaration it was resolved
+    for and is recomputed only if a later environment has a different declaration of that name. Imported declarations
+    are the same objects in all environments importing their module, so their entries stay valid. Failed lookups are
+    retried after a library has been loaded. */
+class symbol_cache {
+    struct entry {
+        decl     m_decl;
+        // symbol address; `nullptr` if function does not have native code
+        void *   m_addr;
+        // true iff the boxed version of the function was found
+        bool     m_boxed;
+        // value of `get_num_loaded_dynlibs()` at lookup time
+        unsigned m_num_dynlibs;
+    };
+    mutex                                                     m_mutex;
+    std::unordered_map<name, entry, name_hash_fn, name_eq_fn> m_entries;
+public:
+    /** \brief Return the native symbol of function `fn` declared as `d`, if any, and set `boxed` if it is the boxed
+        version of `fn`. */
+    void * lookup(name const & fn, decl const & d, bool & boxed) {
+        unsigned num_dynlibs = get_num_loaded_dynlibs();
+        {
+            lock_guard<mutex> lock(m_mutex);
+            auto it = m_entries.find(fn);
+            if (it != m_entries.end() && it->second.m_decl.raw() == d.raw() &&
+                (it->second.m_addr || it->second.m_num_dynlibs == num_dynlibs)) {
+                boxed = it->second.m_boxed;
+                return it->second.m_addr;
+            }
+        }
+        void * addr = nullptr;
+        boxed = false;
+        string_ref mangled = name_mangle(fn, *g_mangle_prefix);
+        string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
+        // check for boxed version first
+        if (void * p_boxed = lookup_symbol_in_cur_exe(boxed_mangled.data())) {
+            addr = p_boxed;
+            boxed = true;
+        } else if (void * p = lookup_symbol_in_cur_exe(mangled.data())) {
+            // if there is no boxed version, there are no unboxed parameters, so use default version
+            addr = p;
+        }
+        /* the entry may be used and released by other threads */
+        mark_mt(fn.raw());
+        mark_mt(d.raw());
+        lock_guard<mutex> lock(m_mutex);
+        auto it = m_entries.find(fn);
+        if (it != m_entries.end()) {
+            it->second = entry{d, addr, boxed, num_dynlibs};
+        } else {
+            m_entries.emplace(fn, entry{d, addr, boxed, num_dynlibs});
+        }
+        return addr;
+    }
+};
+static symbol_cache * g_symbol_cache = nullptr;
+
+/** \brief Declarations and lowered code of an environment. */
+struct code_cache {
+    environment m_env;
+    bool        m_prefer_native;
+    // caches symbol lookup successes _and_ failures; `std::unordered_map` keeps references to entries stable
+    std::unordered_map<name, fn_entry, name_hash_fn, name_eq_fn> m_fns;
+
+    code_cache(environment const & env, bool prefer_native):m_env(env), m_prefer_native(prefer_native) {}
+};
+
+/* The code caches of the environments recently interpreted in this thread, most recently used first. They are reused
+   by later interpreters for the same environment, e.g. when a tactic or `reduceBool` is evaluated repeatedly. Each
+   cache keeps its environment alive, so whenever an outermost interpreter starts or finishes, we drop the caches
+   whose environment is not referenced by anything else anymore; at most `max_caches` caches are kept. The entries
+   are only accessed by the thread owning the cache, so call sites can be resolved without synchronization. */
+struct code_cache_slot {
+    static constexpr size_t max_caches = 4;
+    std::vector<std::shared_ptr<code_cache>> m_caches;
+
+    std::shared_ptr<code_cache> get(environment const & env, bool prefer_native) {
+        for (size_t i = 0; i < m_caches.size(); i++) {
+            if (is_eqp(m_caches[i]->m_env, env) && m_caches[i]->m_prefer_native == prefer_native) {
+                std::rotate(m_caches.begin(), m_caches.begin() + i, m_caches.begin() + i + 1);
+                return m_caches[0];
+            }
+        }
+        if (m_caches.size() >= max_caches)
+            m_caches.pop_back();
+        m_caches.insert(m_caches.begin(), std::make_shared<code_cache>(env, prefer_native));
+        return m_caches[0];
+    }
+
+    /* Drop the caches that hold the last reference to their environment. */
+    void release_unused() {
+        m_caches.erase(std::remove_if(m_caches.begin(), m_caches.end(), [](std::shared_ptr<code_cache> const & c) {
+                    object * env = c->m_env.raw();
+                    if (lean_is_st(env))
+                        return lean_is_exclusive(env);
+                    // other threads may still be releasing their references
+                    return lean_is_mt(env) &&
+                        std::atomic_load_explicit(lean_get_rc_mt_addr(env), std::memory_order_acquire) == -1;
+                }), m_caches.end());
+    }
+};
+MK_THREAD_LOCAL_GET_DEF(code_cache_slot, get_code_cache_slot);
+
 class interpreter;
 LEAN_THREAD_PTR(interpreter, g_interpreter);
 
 class interpreter {
     // stack of IR variable slots
     std::vector<value> m_arg_stack;
-    // stack of join points
-    std::vector<fn_body const *> m_jp_stack;
     struct frame {
-        name m_fn;
-        // base pointers into the stack above
+        name const * m_fn;
+        // base pointer into the stack above
         size_t m_arg_bp;
-        size_t m_jp_bp;
 
-        frame(name const & mFn, size_t mArgBp, size_t mJpBp) : m_fn(mFn), m_arg_bp(mArgBp), m_jp_bp(mJpBp) {}
+        frame(name const * mFn, size_t mArgBp) : m_fn(mFn), m_arg_bp(mArgBp) {}
     };
     std::vector<frame> m_call_stack;
     environment const & m_env;
@@ -345,16 +917,11 @@ class interpreter {
       value m_val;
     };
     // caches values of nullary functions ("constants")
-    name_map<constant_cache_entry> m_constant_cache;
-    struct symbol_cache_entry {
-        decl m_decl;
-        // symbol address; `nullptr` if function does not have native code
-        void * m_addr;
-        // true iff we chose the boxed version of a function where the IR uses the unboxed version
-        bool m_boxed;
-    };
-    // caches symbol lookup successes _and_ failures
-    name_map<symbol_cache_entry> m_symbol_cache;
+    std::unordered_map<fn_entry const *, constant_cache_entry> m_constant_cache;
+    // declarations and lowered code, shared with other interpreters of the same environment in this thread
+    std::shared_ptr<code_cache> m_code_cache;
+    // whether no other interpreter was active in this thread when this one was created
+    bool m_outermost;
 
     /** \brief Get current stack frame */
     inline frame & get_frame() {
@@ -362,14 +929,9 @@ class interpreter {
     }
 
     /** \brief Get reference to stack slot of IR variable */
-    inline value & var(var_id const & v) {
-        // variables are 1-indexed
-        size_t i = get_frame().m_arg_bp + v.get_small_value() - 1;
-        // we don't know the frame size (unless we do an additional IR pass), so we extend it dynamically
-        if (i >= m_arg_stack.size()) {
-            m_arg_stack.resize(i + 1);
-        }
-        return m_arg_stack[i];
+    inline value & var(slot s) {
+        lean_assert(get_frame().m_arg_bp + s < m_arg_stack.size());
+        return m_arg_stack[get_frame().m_arg_bp + s];
     }
 
 public:
@@ -389,27 +951,25 @@ public:
     }
 
 private:
-    value eval_arg(arg const & a) {
+    value eval_arg(slot s) {
         // an "irrelevant" argument is type- or proof-erased; we can use an arbitrary value for it
-        return arg_is_irrelevant(a) ? box(0) : var(arg_var_id(a));
+        return s == irrelevant_slot ? box(0) : var(s);
+    }
+
+    value eval_arg(code const & c, instr const & i, unsigned k) {
+        return eval_arg(c.m_slots[i.m_args + k]);
     }
 
     /** \brief Allocate constructor object with given tag and arguments */
-    object * alloc_ctor(ctor_info const & i, array_ref<arg> const & args) {
-        size_t tag = ctor_info_tag(i).get_small_value();
-        // number of boxed object fields
-        size_t size = ctor_info_size(i).get_small_value();
-        // number of unboxed USize fields (whose byte size the IR is ignorant of)
-        size_t usize = ctor_info_usize(i).get_small_value();
-        // byte size of all other unboxed fields
-        size_t ssize = ctor_info_ssize(i).get_small_value();
-        if (size == 0 && usize == 0 && ssize == 0) {
+    object * alloc_ctor(code const & c, instr const & i) {
+        ctor_desc const & d = c.m_ctors[i.m_n];
+        if (d.m_num_objs == 0 && d.m_scalar_sz == 0) {
             // a constructor without data is optimized to a tagged pointer
-            return box(tag);
+            return box(d.m_tag);
         } else {
-            object *o = alloc_cnstr(tag, size, usize * sizeof(void *) + ssize);
-            for (size_t i = 0; i < args.size(); i++) {
-                cnstr_set(o, i, eval_arg(args[i]).m_obj);
+            object *o = alloc_cnstr(d.m_tag, d.m_num_objs, d.m_scalar_sz);
+            for (unsigned k = 0; k < i.m_num_args; k++) {
+                cnstr_set(o, k, eval_arg(c, i, k).m_obj);
             }
             return o;
         }
@@ -428,15 +988,23 @@ private:
         return cls;
     }
 
-    value eval_expr(expr const & e, type t) {
-        switch (expr_tag(e)) {
-            case expr_kind::Ctor:
-                return value { alloc_ctor(expr_ctor_info(e), expr_ctor_args(e)) };
-            case expr_kind::Reset: { // release fields if unique reference in preparation for `Reuse` below
-                object * o = var(expr_reset_obj(e)).m_obj;
+    /** \brief Return the entry of the call target of `i`, resolving it on first use. */
+    fn_entry & get_callee(code & c, instr const & i) {
+        call_site & s = c.m_calls[i.m_n];
+        if (!s.m_entry)
+            s.m_entry = &lookup_fn(s.m_fn);
+        return *s.m_entry;
+    }
+
+    value eval_expr(code & c, instr const & i) {
+        switch (i.m_op) {
+            case opcode::Ctor:
+                return value { alloc_ctor(c, i) };
+            case opcode::Reset: { // release fields if unique reference in preparation for `Reuse` below
+                object * o = var(i.m_src).m_obj;
                 if (is_exclusive(o)) {
-                    for (size_t i = 0; i < expr_reset_num_objs(e).get_small_value(); i++) {
-                        cnstr_release(o, i);
+                    for (size_t k = 0; k < i.m_n; k++) {
+                        cnstr_release(o, k);
                     }
                     return o;
                 } else {
@@ -444,37 +1012,35 @@ private:
                     return box(0);
                 }
             }
-            case expr_kind::Reuse: { // reuse dead allocation if possible
-                object * o = var(expr_reuse_obj(e)).m_obj;
+            case opcode::Reuse: { // reuse dead allocation if possible
+                object * o = var(i.m_src).m_obj;
                 // check if `Reset` above had a unique reference it consumed
                 if (is_scalar(o)) {
                     // fall back to regular allocation
-                    return alloc_ctor(expr_reuse_ctor(e), expr_reuse_args(e));
+                    return alloc_ctor(c, i);
                 } else {
                     // create new constructor object in-place
-                    if (expr_reuse_update_header(e)) {
-                        cnstr_set_tag(o, ctor_info_tag(expr_reuse_ctor(e)).get_small_value());
+                    if (i.m_update_header) {
+                        cnstr_set_tag(o, c.m_ctors[i.m_n].m_tag);
                     }
-                    for (size_t i = 0; i < expr_reuse_args(e).size(); i++) {
-                        cnstr_set(o, i, eval_arg(expr_reuse_args(e)[i]).m_obj);
+                    for (unsigned k = 0; k < i.m_num_args; k++) {
+                        cnstr_set(o, k, eval_arg(c, i, k).m_obj);
                     }
                     return o;
                 }
             }
-            case expr_kind::Proj: // object field access
-                return cnstr_get(var(expr_proj_obj(e)).m_obj, expr_proj_idx(e).get_small_value());
-            case expr_kind::UProj: // USize field access
-                return cnstr_get_usize(var(expr_uproj_obj(e)).m_obj, expr_uproj_idx(e).get_small_value());
-            case expr_kind::SProj: { // other unboxed field access
-                size_t offset = expr_sproj_idx(e).get_small_value() * sizeof(void *) +
-                                expr_sproj_offset(e).get_small_value();
-                object * o = var(expr_sproj_obj(e)).m_obj;
-                switch (t) {
-                    case type::Float: return value::from_float(cnstr_get_float(o, offset));
-                    case type::UInt8: return cnstr_get_uint8(o, offset);
-                    case type::UInt16: return cnstr_get_uint16(o, offset);
-                    case type::UInt32: return cnstr_get_uint32(o, offset);
-                    case type::UInt64: return cnstr_get_uint64(o, offset);
+            case opcode::Proj: // object field access
+                return cnstr_get(var(i.m_src).m_obj, i.m_n);
+            case opcode::UProj: // USize field access
+                return cnstr_get_usize(var(i.m_src).m_obj, i.m_n);
+            case opcode::SProj: { // other unboxed field access
+                object * o = var(i.m_src).m_obj;
+                switch (i.m_type) {
+                    case type::Float: return value::from_float(cnstr_get_float(o, i.m_n));
+                    case type::UInt8: return cnstr_get_uint8(o, i.m_n);
+                    case type::UInt16: return cnstr_get_uint16(o, i.m_n);
+                    case type::UInt32: return cnstr_get_uint32(o, i.m_n);
+                    case type::UInt64: return cnstr_get_uint64(o, i.m_n);
                     case type::USize:
                     case type::Irrelevant:
                     case type::Object:
@@ -483,78 +1049,54 @@ private:
                 }
                 throw exception("invalid instruction");
             }
-            case expr_kind::FAp: { // satured ("full") application of top-level function
-                if (expr_fap_args(e).size()) {
-                    return call(expr_fap_fun(e), expr_fap_args(e));
-                } else {
-                    // nullary function ("constant")
-                    return load(expr_fap_fun(e), t);
-                }
-            }
-            case expr_kind::PAp: { // unsatured (partial) application of top-level function
-                symbol_cache_entry sym = lookup_symbol(expr_pap_fun(e));
-                if (sym.m_addr) {
+            case opcode::FAp: // satured ("full") application of top-level function
+                return call(get_callee(c, i), c, i);
+            case opcode::Const: // nullary function ("constant")
+                return load(get_callee(c, i), i.m_type);
+            case opcode::PAp: { // unsatured (partial) application of top-level function
+                fn_entry & e = get_callee(c, i);
+                if (e.m_addr) {
                     // point closure directly at native symbol
-                    object * cls = alloc_closure(sym.m_addr, decl_params(sym.m_decl).size(), expr_pap_args(e).size());
-                    for (unsigned i = 0; i < expr_pap_args(e).size(); i++) {
-                        closure_set(cls, i, eval_arg(expr_pap_args(e)[i]).m_obj);
+                    object * cls = alloc_closure(e.m_addr, e.get_arity(), i.m_num_args);
+                    for (unsigned k = 0; k < i.m_num_args; k++) {
+                        closure_set(cls, k, eval_arg(c, i, k).m_obj);
                     }
                     return cls;
                 } else {
                     // point closure at interpreter stub
-                    object ** args = static_cast<object **>(LEAN_ALLOCA(expr_pap_args(e).size() * sizeof(object *))); // NOLINT
-                    for (size_t i = 0; i < expr_pap_args(e).size(); i++) {
-                        args[i] = eval_arg(expr_pap_args(e)[i]).m_obj;
+                    object ** args = static_cast<object **>(LEAN_ALLOCA(i.m_num_args * sizeof(object *))); // NOLINT
+                    for (unsigned k = 0; k < i.m_num_args; k++) {
+                        args[k] = eval_arg(c, i, k).m_obj;
                     }
-                    return mk_stub_closure(sym.m_decl, expr_pap_args(e).size(), args);
+                    return mk_stub_closure(e.m_decl, i.m_num_args, args);
                 }
             }
-            case expr_kind::Ap: { // (saturated or unsatured) application of closure; mostly handled by runtime
-                object ** args = static_cast<object **>(LEAN_ALLOCA(expr_ap_args(e).size() * sizeof(object *))); // NOLINT
-                for (size_t i = 0; i < expr_ap_args(e).size(); i++) {
-                    args[i] = eval_arg(expr_ap_args(e)[i]).m_obj;
+            case opcode::Ap: { // (saturated or unsatured) application of closure; mostly handled by runtime
+                object ** args = static_cast<object **>(LEAN_ALLOCA(i.m_num_args * sizeof(object *))); // NOLINT
+                for (unsigned k = 0; k < i.m_num_args; k++) {
+                    args[k] = eval_arg(c, i, k).m_obj;
                 }
-                object * r = apply_n(var(expr_ap_fun(e)).m_obj, expr_ap_args(e).size(), args);
-                return r;
+                return apply_n(var(i.m_src).m_obj, i.m_num_args, args);
             }
-            case expr_kind::Box: // box unboxed value
-                return box_t(var(expr_box_obj(e)).m_num, expr_box_type(e));
-            case expr_kind::Unbox: // unbox boxed value
-                return unbox_t(var(expr_unbox_obj(e)).m_obj, t);
-            case expr_kind::Lit: // load numeric or string literal
-                switch (lit_val_tag(expr_lit_val(e))) {
-                    case lit_val_kind::Num: {
-                        nat const & n = lit_val_num(expr_lit_val(e));
-                        switch (t) {
-                            case type::Float:
-                                lean_inc(n.raw());
-                                return value::from_float(lean_float_of_nat(n.raw()));
-                            case type::UInt8:
-                            case type::UInt16:
-                            case type::UInt32:
-                            case type::USize:
-                                return lean_usize_of_nat(n.raw());
-                            case type::UInt64:
-                                return lean_uint64_of_nat(n.raw());
-                            // `nat` literal
-                            case type::Object:
-                            case type::TObject:
-                                return n.to_obj_arg();
-                            case type::Irrelevant:
-                                break;
-                        }
-                        throw exception("invalid instruction");
-                    }
-                    case lit_val_kind::Str:
-                        return lit_val_str(expr_lit_val(e)).to_obj_arg();
+            case opcode::Box: // box unboxed value
+                return box_t(var(i.m_src).m_num, static_cast<type>(i.m_n));
+            case opcode::Unbox: // unbox boxed value
+                return unbox_t(var(i.m_src).m_obj, i.m_type);
+            case opcode::Lit: { // load numeric or string literal
+                value v = c.m_lits[i.m_n];
+                if (!type_is_scalar(i.m_type)) {
+                    inc(v.m_obj);
                 }
+                return v;
+            }
+            case opcode::IsShared:
+                return !is_exclusive(var(i.m_src).m_obj);
+            case opcode::IsTaggedPtr:
+                return !is_scalar(var(i.m_src).m_obj);
+            default:
                 break;
-            case expr_kind::IsShared:
-                return !is_exclusive(var(expr_is_shared_obj(e)).m_obj);
-            case expr_kind::IsTaggedPtr:
-                return !is_scalar(var(expr_is_tagged_ptr_obj(e)).m_obj);
         }
-        throw exception(sstream() << "unexpected instruction kind " << static_cast<unsigned>(expr_tag(e)));
+        throw exception(sstream() << "unexpected instruction kind " << static_cast<unsigned>(i.m_op));
     }
 
     void check_system() {
@@ -565,170 +1107,138 @@ private:
             ss << ex.what() << "\n";
             ss << "interpreter stacktrace:\n";
             for (unsigned i = 0; i < m_call_stack.size(); i++) {
-                ss << "#" << (i + 1) << " " << m_call_stack[m_call_stack.size() - i - 1].m_fn << "\n";
+                ss << "#" << (i + 1) << " " << *m_call_stack[m_call_stack.size() - i - 1].m_fn << "\n";
             }
             throw throwable(ss);
         }
     }
 
-    value eval_body(fn_body const & b0) {
+    /** \brief Evaluate lowered code in the current stack frame. */
+    value eval_code(code & c) {
         check_system();
 
-        // make reference reassignable...
-        std::reference_wrapper<fn_body const> b(b0);
+        size_t pc = 0;
         while (true) {
+            instr const & i = c.m_instrs[pc];
             DEBUG_CODE(lean_trace(name({"interpreter", "step"}),
-                                  tout() << std::string(m_call_stack.size(), ' ') << format_fn_body_head(b) << "\n";);)
-            switch (fn_body_tag(b)) {
-                case fn_body_kind::VDecl: { // variable declaration
-                    expr const & e = fn_body_vdecl_expr(b);
-                    fn_body const & cont = fn_body_vdecl_cont(b);
-                    // tail recursion?
-                    if (expr_tag(e) == expr_kind::FAp && expr_fap_fun(e) == get_frame().m_fn &&
-                        fn_body_tag(cont) == fn_body_kind::Ret && !arg_is_irrelevant(fn_body_ret_arg(cont)) &&
-                        arg_var_id(fn_body_ret_arg(cont)) == fn_body_vdecl_var(b)) {
-                        // tail recursion! copy argument values to parameter slots and reset `b`
-                        array_ref<arg> const & args = expr_fap_args(e);
-                        // argument and parameter slots may overlap, so first copy arguments to end of stack
-                        size_t old_size = m_arg_stack.size();
-                        for (const auto & arg : args) {
-                            m_arg_stack.push_back(eval_arg(arg));
-                        }
-                        // now copy to parameter slots
-                        for (size_t i = 0; i < args.size(); i++) {
-                            m_arg_stack[get_frame().m_arg_bp + i] = m_arg_stack[old_size + i];
-                        }
-                        m_arg_stack.resize(get_frame().m_arg_bp + args.size());
-                        b = b0;
-                        check_system();
-                        break;
+                                  tout() << std::string(m_call_stack.size(), ' ') << format_fn_body_head(c.m_bodies[pc]) << "\n";);)
+            if (i.m_op <= opcode::IsTaggedPtr) { // variable declaration
+                value v = eval_expr(c, i);
+                // NOTE: `var` must be called *after* `eval_expr` because the stack may get resized and invalidate
+                // the reference
+                var(i.m_dst) = v;
+                DEBUG_CODE(lean_trace(name({"interpreter", "step"}),
+                                      tout() << std::string(m_call_stack.size(), ' ') << "=> x_";
+                                      tout() << i.m_dst + 1 << " = ";
+                                      print_value(tout(), var(i.m_dst), i.m_type);
+                                      tout() << "\n";);)
+                pc++;
+                continue;
+            }
+            switch (i.m_op) {
+                case opcode::TailCall: {
+                    // argument and parameter slots may overlap, so first copy arguments to end of stack
+                    size_t old_size = m_arg_stack.size();
+                    for (unsigned k = 0; k < i.m_num_args; k++) {
+                        value v = eval_arg(c, i, k);
+                        m_arg_stack.push_back(v);
                     }
-                    value v = eval_expr(fn_body_vdecl_expr(b), fn_body_vdecl_type(b));
-                    // NOTE: `var` must be called *after* `eval_expr` because the stack may get resized and invalidate
-                    // the pointer
-                    var(fn_body_vdecl_var(b)) = v;
-                    DEBUG_CODE(lean_trace(name({"interpreter", "step"}),
-                                          tout() << std::string(m_call_stack.size(), ' ') << "=> x_";
-                                          tout() << fn_body_vdecl_var(b).get_small_value() << " = ";
-                                          print_value(tout(), var(fn_body_vdecl_var(b)), fn_body_vdecl_type(b));
-                                          tout() << "\n";);)
-                    b = fn_body_vdecl_cont(b);
-                    break;
-                }
-                case fn_body_kind::JDecl: { // join-point declaration; store in stack slot just like variables
-                    size_t i = get_frame().m_jp_bp + fn_body_jdecl_id(b).get_small_value();
-                    if (i >= m_jp_stack.size()) {
-                        m_jp_stack.resize(i + 1);
+                    // now copy to parameter slots
+                    for (unsigned k = 0; k < i.m_num_args; k++) {
+                        var(k) = m_arg_stack[old_size + k];
                     }
-                    m_jp_stack[i] = &b.get();
-                    b = fn_body_jdecl_cont(b);
+                    m_arg_stack.resize(old_size);
+                    pc = 0;
+                    check_system();
                     break;
                 }
-                case fn_body_kind::Set: { // set boxed field of unique reference
-                    object * o = var(fn_body_set_var(b)).m_obj;
+                case opcode::Set: { // set boxed field of unique reference
+                    object * o = var(i.m_dst).m_obj;
                     lean_assert(is_exclusive(o));
-                    cnstr_set(o, fn_body_set_idx(b).get_small_value(), eval_arg(fn_body_set_arg(b)).m_obj);
-                    b = fn_body_set_cont(b);
+                    cnstr_set(o, i.m_n, eval_arg(i.m_src).m_obj);
+                    pc++;
                     break;
                 }
-                case fn_body_kind::SetTag: { // set constructor tag of unique reference
-                    object * o = var(fn_body_set_tag_var(b)).m_obj;
+                case opcode::SetTag: { // set constructor tag of unique reference
+                    object * o = var(i.m_dst).m_obj;
                     lean_assert(is_exclusive(o));
-                    cnstr_set_tag(o, fn_body_set_tag_cidx(b).get_small_value());
-                    b = fn_body_set_tag_cont(b);
+                    cnstr_set_tag(o, i.m_n);
+                    pc++;
                     break;
                 }
-                case fn_body_kind::USet: { // set USize field of unique reference
-                    object * o = var(fn_body_uset_target(b)).m_obj;
+                case opcode::USet: { // set USize field of unique reference
+                    object * o = var(i.m_dst).m_obj;
                     lean_assert(is_exclusive(o));
-                    cnstr_set_usize(o, fn_body_uset_idx(b).get_small_value(), var(fn_body_uset_source(b)).m_num);
-                    b = fn_body_uset_cont(b);
+                    cnstr_set_usize(o, i.m_n, var(i.m_src).m_num);
+                    pc++;
                     break;
                 }
-                case fn_body_kind::SSet: { // set other unboxed field of unique reference
-                    object * o = var(fn_body_sset_target(b)).m_obj;
-                    size_t offset = fn_body_sset_idx(b).get_small_value() * sizeof(void *) +
-                                    fn_body_sset_offset(b).get_small_value();
-                    value v = var(fn_body_sset_source(b));
+                case opcode::SSet: { // set other unboxed field of unique reference
+                    object * o = var(i.m_dst).m_obj;
+                    value v = var(i.m_src);
                     lean_assert(is_exclusive(o));
-                    switch (fn_body_sset_type(b)) {
-                        case type::Float: cnstr_set_float(o, offset, v.m_float); break;
-                        case type::UInt8: cnstr_set_uint8(o, offset, v.m_num); break;
-                        case type::UInt16: cnstr_set_uint16(o, offset, v.m_num); break;
-                        case type::UInt32: cnstr_set_uint32(o, offset, v.m_num); break;
-                        case type::UInt64: cnstr_set_uint64(o, offset, v.m_num); break;
+                    switch (i.m_type) {
+                        case type::Float: cnstr_set_float(o, i.m_n, v.m_float); break;
+                        case type::UInt8: cnstr_set_uint8(o, i.m_n, v.m_num); break;
+                        case type::UInt16: cnstr_set_uint16(o, i.m_n, v.m_num); break;
+                        case type::UInt32: cnstr_set_uint32(o, i.m_n, v.m_num); break;
+                        case type::UInt64: cnstr_set_uint64(o, i.m_n, v.m_num); break;
                         case type::USize:
                         case type::Irrelevant:
                         case type::Object:
                         case type::TObject:
                             throw exception(sstream() << "invalid instruction");
                     }
-                    b = fn_body_sset_cont(b);
+                    pc++;
                     break;
                 }
-                case fn_body_kind::Inc: // increment reference counter
-                    inc(var(fn_body_inc_var(b)).m_obj, fn_body_inc_val(b).get_small_value());
-                    b = fn_body_inc_cont(b);
+                case opcode::Inc: // increment reference counter
+                    inc(var(i.m_src).m_obj, i.m_n);
+                    pc++;
                     break;
-                case fn_body_kind::Dec: { // decrement reference counter
-                    size_t n = fn_body_dec_val(b).get_small_value();
-                    for (size_t i = 0; i < n; i++) {
-                        dec(var(fn_body_dec_var(b)).m_obj);
+                case opcode::Dec: // decrement reference counter
+                    for (size_t k = 0; k < i.m_n; k++) {
+                        dec(var(i.m_src).m_obj);
                     }
-                    b = fn_body_dec_cont(b);
+                    pc++;
                     break;
-                }
-                case fn_body_kind::Del: // delete object of unique reference
-                    lean_free_object(var(fn_body_del_var(b)).m_obj);
-                    b = fn_body_del_cont(b);
-                    break;
-                case fn_body_kind::MData: // metadata; no-op
-                    b = fn_body_mdata_cont(b);
+                case opcode::Del: // delete object of unique reference
+                    lean_free_object(var(i.m_src).m_obj);
+                    pc++;
                     break;
-                case fn_body_kind::Case: { // branch according to constructor tag
-                    array_ref<alt_core> const & alts = fn_body_case_alts(b);
+                case opcode::Case: { // branch according to constructor tag
                     unsigned tag;
-                    value v = var(fn_body_case_var(b));
-                    if (type_is_scalar(fn_body_case_var_type(b))) {
+                    value v = var(i.m_src);
+                    if (type_is_scalar(i.m_type)) {
                         tag = v.m_num;
                     } else {
                         tag = lean_obj_tag(v.m_obj);
                     }
-                    for (alt_core const & a : alts) {
-                        switch (alt_core_tag(a)) {
-                            case alt_core_kind::Ctor:
-                                if (tag == ctor_info_tag(alt_core_ctor_info(a)).get_small_value()) {
-                                    b = alt_core_ctor_cont(a);
-                                    goto done;
-                                }
-                                break;
-                            case alt_core_kind::Default:
-                                b = alt_core_default_cont(a);
-                                goto done;
-                        }
-                    }
-                    throw exception("incomplete case");
-                    done: break;
+                    case_table const & t = c.m_cases[i.m_n];
+                    pc = tag < t.m_targets.size() ? t.m_targets[tag] : t.m_default;
+                    if (pc == no_target)
+                        throw exception("incomplete case");
+                    break;
                 }
-                case fn_body_kind::Ret:
-                    return eval_arg(fn_body_ret_arg(b));
-                case fn_body_kind::Jmp: { // jump to join-point
-                    fn_body const & jp = *m_jp_stack[get_frame().m_jp_bp + fn_body_jmp_jp(b).get_small_value()];
-                    lean_assert(fn_body_jdecl_params(jp).size() == fn_body_jmp_args(b).size());
-                    for (size_t i = 0; i < fn_body_jdecl_params(jp).size(); i++) {
-                        var(param_var(fn_body_jdecl_params(jp)[i])) = eval_arg(fn_body_jmp_args(b)[i]);
+                case opcode::Ret:
+                    return eval_arg(i.m_src);
+                case opcode::Jmp: // jump to join-point
+                    for (unsigned k = 0; k < i.m_num_args; k++) {
+                        value v = eval_arg(c, i, k);
+                        var(c.m_slots[i.m_args + i.m_num_args + k]) = v;
                     }
-                    b = fn_body_jdecl_body(jp);
+                    pc = i.m_n;
                     break;
-                }
-                case fn_body_kind::Unreachable:
+                case opcode::Unreachable:
                     throw exception("unreachable code");
+                default:
+                    throw exception(sstream() << "unexpected instruction kind " << static_cast<unsigned>(i.m_op));
             }
         }
     }
 
     // specify argument base pointer explicitly because we've usually already pushed some function arguments
-    void push_frame(decl const & d, size_t arg_bp) {
+    void push_frame(decl const & d, size_t arg_bp, unsigned frame_size) {
         DEBUG_CODE({
             lean_trace(name({"interpreter", "call"}),
                        tout() << std::string(m_call_stack.size(), ' ')
@@ -738,12 +1248,13 @@ private:
                        }
                        tout() << "\n";);
         });
-        m_call_stack.emplace_back(decl_fun_id(d), arg_bp, m_jp_stack.size());
+        m_call_stack.emplace_back(&decl_fun_id(d), arg_bp);
+        if (arg_bp + frame_size > m_arg_stack.size())
+            m_arg_stack.resize(arg_bp + frame_size);
     }
 
     void pop_frame(value DEBUG_CODE(r), type DEBUG_CODE(t)) {
         m_arg_stack.resize(get_frame().m_arg_bp);
-        m_jp_stack.resize(get_frame().m_jp_bp);
         m_call_stack.pop_back();
         DEBUG_CODE({
             lean_trace(name({"interpreter", "call"}),
@@ -754,29 +1265,33 @@ private:
        });
     }
 
-    /** \brief Return cached lookup result for given unmangled function name in the current binary. */
-    symbol_cache_entry lookup_symbol(name const & fn) {
-        if (symbol_cache_entry const * e = m_symbol_cache.find(fn)) {
-            return *e;
+    /** \brief Return cached entry of given unmangled function name, including the result of looking up its symbol in
+        the current binary (see `symbol_cache`). */
+    fn_entry & lookup_fn(name const & fn) {
+        auto it = m_code_cache->m_fns.find(fn);
+        if (it != m_code_cache->m_fns.end()) {
+            return it->second;
         } else {
-            symbol_cache_entry e_new { get_decl(fn), nullptr, false };
-            if (m_prefer_native || decl_tag(e_new.m_decl) == decl_kind::Extern || has_init_attribute(m_env, fn)) {
-                string_ref mangled = name_mangle(fn, *g_mangle_prefix);
-                string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
-                // check for boxed version first
-                if (void *p_boxed = lookup_symbol_in_cur_exe(boxed_mangled.data())) {
-                    e_new.m_addr = p_boxed;
-                    e_new.m_boxed = true;
-                } else if (void *p = lookup_symbol_in_cur_exe(mangled.data())) {
-                    // if there is no boxed version, there are no unboxed parameters, so use default version
-                    e_new.m_addr = p;
-                }
+            decl d = get_decl(fn);
+            void * addr = nullptr;
+            bool boxed = false;
+            if (m_prefer_native || decl_tag(d) == decl_kind::Extern || has_init_attribute(m_env, fn)) {
+                addr = g_symbol_cache->lookup(fn, d, boxed);
             }
-            m_symbol_cache.insert(fn, e_new);
-            return e_new;
+            return m_code_cache->m_fns.emplace(fn, fn_entry(d, addr, boxed)).first->second;
         }
     }
 
+    /** \brief Return lowered body of an interpreted function, lowering it on first use. */
+    code & get_code(fn_entry & e) {
+        if (!e.m_code) {
+            std::unique_ptr<code> c(new code());
+            lower_fn(*c, decl_fun_id(e.m_decl))(e.m_decl);
+            e.m_code = std::move(c);
+        }
+        return *e.m_code;
+    }
+
     /** \brief Retrieve Lean declaration from environment. */
     decl get_decl(name const & fn) {
         option_ref<decl> d = find_ir_decl(m_env, fn);
@@ -787,19 +1302,20 @@ private:
     }
 
     /** \brief Evaluate nullary function ("constant"). */
-    value load(name const & fn, type t) {
-        if (constant_cache_entry const * cached = m_constant_cache.find(fn)) {
-            if (!cached->m_is_scalar) {
-                inc(cached->m_val.m_obj);
+    value load(fn_entry & e, type t) {
+        auto cached = m_constant_cache.find(&e);
+        if (cached != m_constant_cache.end()) {
+            if (!cached->second.m_is_scalar) {
+                inc(cached->second.m_val.m_obj);
             }
-            return cached->m_val;
+            return cached->second.m_val;
         }
+        name const & fn = decl_fun_id(e.m_decl);
         if (object * const * o = g_init_globals->find(fn)) {
             // persistent, so no `inc` needed
             return *o;
         }
 
-        symbol_cache_entry e = lookup_symbol(fn);
         if (e.m_addr) {
             // we can assume that all native code has been initialized (see e.g. `evalConst`)
 
@@ -823,45 +1339,44 @@ private:
             // We don't know whether `[init]` decls can be re-executed, so let's not.
             throw exception(sstream() << "cannot evaluate `[init]` declaration '" << fn << "' in the same module");
         }
-        push_frame(e.m_decl, m_arg_stack.size());
-        value r = eval_body(decl_fun_body(e.m_decl));
-        pop_frame(r, decl_type(e.m_decl));
+        code & c = get_code(e);
+        push_frame(e.m_decl, m_arg_stack.size(), c.m_frame_size);
+        value r = eval_code(c);
+        pop_frame(r, e.m_type);
         if (!type_is_scalar(t)) {
             inc(r.m_obj);
         }
-        m_constant_cache.insert(fn, constant_cache_entry { type_is_scalar(t), r });
+        m_constant_cache.insert(std::make_pair(&e, constant_cache_entry { type_is_scalar(t), r }));
         return r;
     }
 
-    value call(name const & fn, array_ref<arg> const & args) {
+    value call(fn_entry & e, code const & c, instr const & i) {
         size_t old_size = m_arg_stack.size();
         value r;
-        symbol_cache_entry e = lookup_symbol(fn);
         if (e.m_addr) {
-            object ** args2 = static_cast<object **>(LEAN_ALLOCA(args.size() * sizeof(object *))); // NOLINT
-            for (size_t i = 0; i < args.size(); i++) {
-                type t = param_type(decl_params(e.m_decl)[i]);
-                args2[i] = box_t(eval_arg(args[i]), t);
-                if (e.m_boxed && param_borrow(decl_params(e.m_decl)[i])) {
+            object ** args2 = static_cast<object **>(LEAN_ALLOCA(i.m_num_args * sizeof(object *))); // NOLINT
+            for (unsigned k = 0; k < i.m_num_args; k++) {
+                args2[k] = box_t(eval_arg(c, i, k), e.m_param_types[k]);
+                if (e.m_boxed && e.m_param_borrow[k]) {
                     // NOTE: If we chose the boxed version where the IR chose the unboxed one, we need to manually increment
                     // originally borrowed parameters because the wrapper will decrement these after the call.
                     // Basically the wrapper is more homogeneous (removing both unboxed and borrowed parameters) than we
                     // would need in this instance.
-                    inc(args2[i]);
+                    inc(args2[k]);
                 }
             }
-            push_frame(e.m_decl, old_size);
-            object * o = curry(e.m_addr, args.size(), args2);
-            type t = decl_type(e.m_decl);
-            if (type_is_scalar(t)) {
+            push_frame(e.m_decl, old_size, 0);
+            object * o = curry(e.m_addr, i.m_num_args, args2);
+            if (type_is_scalar(e.m_type)) {
                 lean_assert(e.m_boxed);
                 // NOTE: this unboxing does not exist in the IR, so we should manually consume `o`
-                r = unbox_t(o, t);
+                r = unbox_t(o, e.m_type);
                 lean_dec(o);
             } else {
                 r = o;
             }
         } else {
+            name const & fn = decl_fun_id(e.m_decl);
             if (decl_tag(e.m_decl) == decl_kind::Extern) {
                 string_ref mangled = name_mangle(fn, *g_mangle_prefix);
                 string_ref boxed_mangled(string_append(mangled.to_obj_arg(), g_boxed_mangled_suffix->raw()));
@@ -870,26 +1385,39 @@ private:
                                           << "For declarations from `Init` or `Lean`, you need to set `supportInterpreter := true` "
                                           << "in the relevant `lean_exe` statement in your `lakefile.lean`.");
             }
+            code & callee = get_code(e);
             // evaluate args in old stack frame
-            for (const auto & arg : args) {
-                m_arg_stack.push_back(eval_arg(arg));
+            for (unsigned k = 0; k < i.m_num_args; k++) {
+                value v = eval_arg(c, i, k);
+                m_arg_stack.push_back(v);
             }
-            push_frame(e.m_decl, old_size);
-            r = eval_body(decl_fun_body(e.m_decl));
+            push_frame(e.m_decl, old_size, callee.m_frame_size);
+            r = eval_code(callee);
         }
-        pop_frame(r, decl_type(e.m_decl));
+        pop_frame(r, e.m_type);
         return r;
     }
 
     // closure stub
     object * stub_m(object ** args) {
         decl d(args[2]);
+        fn_entry & e = lookup_fn(decl_fun_id(d));
+        std::unique_ptr<code> tmp;
+        code * c;
+        if (e.m_decl.raw() == d.raw()) {
+            c = &get_code(e);
+        } else {
+            // not the declaration of the current environment
+            tmp.reset(new code());
+            lower_fn(*tmp, decl_fun_id(d))(d);
+            c = tmp.get();
+        }
         size_t old_size = m_arg_stack.size();
         for (size_t i = 0; i < decl_params(d).size(); i++) {
             m_arg_stack.push_back(args[3 + i]);
         }
-        push_frame(d, old_size);
-        object * r = eval_body(decl_fun_body(d)).m_obj;
+        push_frame(d, old_size, c->m_frame_size);
+        object * r = eval_code(*c).m_obj;
         pop_frame(r, type::TObject);
         return r;
     }
@@ -946,16 +1474,24 @@ private:
 public:
     explicit interpreter(environment const & env, options const & opts) : m_env(env), m_opts(opts) {
         m_prefer_native = opts.get_bool(*g_interpreter_prefer_native, LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE);
+        m_outermost = g_interpreter == nullptr;
+        code_cache_slot & s = get_code_cache_slot();
+        if (m_outermost)
+            s.release_unused();
+        m_code_cache = s.get(env, m_prefer_native);
     }
 
     interpreter(interpreter const &) = delete;
 
     ~interpreter() {
-        for_each(m_constant_cache, [](name const &, constant_cache_entry const & e) {
-            if (!e.m_is_scalar) {
-                dec(e.m_val.m_obj);
+        for (auto const & p : m_constant_cache) {
+            if (!p.second.m_is_scalar) {
+                dec(p.second.m_val.m_obj);
             }
-        });
+        }
+        m_code_cache.reset();
+        if (m_outermost)
+            get_code_cache_slot().release_unused();
     }
 
     /** A variant of `call` designed for external uses.
@@ -963,11 +1499,11 @@ public:
      *  * supports under- and over-application.
      *  * supports "calling" (evaluating) nullary constants. */
     object * call_boxed(name const & fn, unsigned n, object ** args) {
-        symbol_cache_entry e = lookup_symbol(fn);
-        unsigned arity = decl_params(e.m_decl).size();
+        fn_entry & e = lookup_fn(fn);
+        unsigned arity = e.get_arity();
         object * r;
         if (arity == 0) {
-            r = box_t(load(fn, decl_type(e.m_decl)), decl_type(e.m_decl));
+            r = box_t(load(e, e.m_type), e.m_type);
         } else {
             // First allocate a closure with zero fixed parameters. This is slightly wasteful in the under-application
             // case, but simpler to handle.
@@ -1037,7 +1573,7 @@ public:
                 object * o = io_result_get_value(r);
                 mark_persistent(o);
                 dec_ref(r);
-                symbol_cache_entry e = lookup_symbol(decl);
+                fn_entry & e = lookup_fn(decl);
                 if (e.m_addr) {
                     *((object **)e.m_addr) = o;
                 } else {
@@ -1114,6 +1650,7 @@ void initialize_ir_interpreter() {
     mark_persistent(ir::g_boxed_mangled_suffix->raw());
     ir::g_interpreter_prefer_native = new name({"interpreter", "prefer_native"});
     ir::g_init_globals = new name_map<object *>();
+    ir::g_symbol_cache = new ir::symbol_cache();
     register_bool_option(*ir::g_interpreter_prefer_native, LEAN_DEFAULT_INTERPRETER_PREFER_NATIVE, "(interpreter) whether to use precompiled code where available");
     DEBUG_CODE({
         register_trace_class({"interpreter"});
@@ -1123,6 +1660,7 @@ void initialize_ir_interpreter() {
 }
 
 void finalize_ir_interpreter() {
+    delete ir::g_symbol_cache;
     delete ir::g_init_globals;
     delete ir::g_interpreter_prefer_native;
     delete ir::g_boxed_mangled_suffix;
@@ -49,8 +49,8 @@ namespace lean {
 struct olean_header {
     // 5 bytes: magic number
     char marker[5] = {'o', 'l', 'e', 'a', 'n'};
-    // 1 byte: version, currently always `1`
-    uint8_t version = 1;
+    // 1 byte: version, `1` or `2`; see `olean_trailer` for the latter
+    uint8_t version = 2;
     // 42 bytes: build githash, padded with `\0` to the right
     char githash[42];
     // address at which the beginning of the file (including header) is attempted to be mmapped
@@ -61,6 +61,14 @@ struct olean_header {
 // make sure we don't have any padding bytes, which also ensures `data` is properly aligned
 static_assert(sizeof(olean_header) == 5 + 1 + 42 + sizeof(size_t), "olean_header must be packed");
 
+/** End of a version 2 .olean file. In version 2, the payload is followed by its relocation table (see
+    `object_compactor::relocation_table`) and then this trailer. If the file cannot be `mmap`ed at `base_addr`, the
+    table lets us patch only the pointer fields instead of parsing every object of the payload. */
+struct olean_trailer {
+    // size of the payload in bytes
+    size_t data_size;
+};
+
 extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg mod, b_obj_arg mdata, object *) {
     std::string olean_fn(string_cstr(fname));
     // we first write to a temp file and then move it to the correct path (possibly deleting an older file)
@@ -99,6 +107,11 @@ extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg
         strncpy(header.githash, LEAN_GITHASH, sizeof(header.githash));
         out.write(reinterpret_cast<char *>(&header), sizeof(header));
         out.write(static_cast<char const *>(compactor.data()), compactor.size());
+        std::vector<uint8> relocs = compactor.relocation_table();
+        out.write(reinterpret_cast<char const *>(relocs.data()), relocs.size());
+        olean_trailer trailer = {};
+        trailer.data_size = compactor.size();
+        out.write(reinterpret_cast<char *>(&trailer), sizeof(trailer));
         out.close();
         while (std::rename(olean_tmp_fn.c_str(), olean_fn.c_str()) != 0) {
 #ifdef LEAN_WINDOWS
@@ -126,8 +139,7 @@ extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg
     }
 }
 
-extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *) {
-    std::string olean_fn(string_cstr(fname));
+static object * read_module_data(std::string const & olean_fn) {
     try {
         std::ifstream in(olean_fn, std::ios_base::binary);
         if (in.fail()) {
@@ -144,16 +156,29 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
             return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
         }
         if (memcmp(header.marker, default_header.marker, sizeof(header.marker)) != 0
-            || header.version != default_header.version
+            || (header.version != 1 && header.version != default_header.version)
 #ifdef LEAN_CHECK_OLEAN_VERSION
             || strncmp(header.githash, LEAN_GITHASH, sizeof(header.githash)) != 0
 #endif
         ) {
             return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
         }
+        size_t data_size = size - sizeof(olean_header);
+        if (header.version >= 2) {
+            olean_trailer trailer;
+            if (size < sizeof(olean_header) + sizeof(olean_trailer)
+                || !in.seekg(size - sizeof(olean_trailer)) || !in.read(reinterpret_cast<char *>(&trailer), sizeof(trailer))
+                || trailer.data_size > size - sizeof(olean_header) - sizeof(olean_trailer)) {
+                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid trailer").str());
+            }
+            data_size = trailer.data_size;
+            in.seekg(sizeof(olean_header));
+        }
         char * base_addr = reinterpret_cast<char *>(header.base_addr);
         char * buffer = nullptr;
         bool is_mmap = false;
+        // whether `buffer` is a private, writable mapping of the file at an address other than `base_addr`
+        bool is_relocatable_mmap = false;
         std::function<void()> free_data;
 #ifdef LEAN_WINDOWS
         // `FILE_SHARE_DELETE` is necessary to allow the file to (be marked to) be deleted while in use
@@ -180,6 +205,15 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
         }
 #ifdef LEAN_MMAP
         buffer = static_cast<char *>(mmap(base_addr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        if (buffer != MAP_FAILED && buffer != base_addr) {
+            // `base_addr` is taken. Instead of copying the whole file into a `malloc`ed buffer, we relocate the
+            // mapping in place: pages are only copied when written to, so the file is not read twice and pages
+            // without pointers (strings, scalar arrays, ...) stay shared with the page cache.
+            is_relocatable_mmap = mprotect(buffer, size, PROT_READ | PROT_WRITE) == 0;
+            // `compacted_region::read` is going to walk the whole file, so ask for it to be read ahead
+            if (is_relocatable_mmap)
+                madvise(buffer, size, MADV_WILLNEED);
+        }
 #endif
         close(fd);
         free_data = [=]() {
@@ -191,6 +225,8 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
         if (buffer && buffer == base_addr) {
             buffer += sizeof(olean_header);
             is_mmap = true;
+        } else if (is_relocatable_mmap) {
+            buffer += sizeof(olean_header);
         } else {
 #ifdef LEAN_MMAP
             free_data();
@@ -206,15 +242,24 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
         }
         in.close();
 
+        // empty for version 1
+        size_t relocs_size = size - sizeof(olean_header) - data_size - (header.version >= 2 ? sizeof(olean_trailer) : 0);
         compacted_region * region =
-          new compacted_region(size - sizeof(olean_header), buffer, base_addr + sizeof(olean_header), is_mmap, free_data);
+          new compacted_region(data_size, buffer, base_addr + sizeof(olean_header), is_mmap, free_data,
+                               header.version >= 2 ? buffer + data_size : nullptr, relocs_size);
 #if defined(__has_feature)
 #if __has_feature(address_sanitizer)
         // do not report as leak
         __lsan_ignore_object(region);
 #endif
 #endif
-        object * mod = region->read();
+        object * mod;
+        try {
+            mod = region->read();
+        } catch (exception &) {
+            delete region;
+            throw;
+        }
         object * mod_region = alloc_cnstr(0, 2, 0);
         cnstr_set(mod_region, 0, mod);
         cnstr_set(mod_region, 1, box_size_t(reinterpret_cast<size_t>(region)));
@@ -224,6 +269,49 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
     }
 }
 
+extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *) {
+    return read_module_data(string_cstr(fname));
+}
+
+/*
+@[extern "lean_read_module_data_parallel"]
+opaque readModuleDataParallel (fnames : @& Array System.FilePath) : IO (Array (ModuleData × CompactedRegion)) */
+extern "C" LEAN_EXPORT object * lean_read_module_data_parallel(b_obj_arg fnames, object *) {
+    // Mapping, reading, and especially relocating the files is independent for each module, so read them on
+    // threads of our own. We must not spawn tasks and wait for them here: when called from a task worker, the
+    // tasks could be queued behind the waiting worker itself.
+    size_t n = array_size(fnames);
+    std::vector<object *> results(n, nullptr);
+    // `fnames` is borrowed and only read by the helper threads
+    parallel_for(n, [&](size_t i) {
+        results[i] = read_module_data(string_cstr(array_get(fnames, i)));
+    });
+    object * err = nullptr;
+    for (object * res : results) {
+        if (!err && io_result_is_error(res)) {
+            inc(res);
+            err = res;
+        }
+    }
+    if (err) {
+        // nothing refers to the contents of the regions that were read successfully yet, so we can free them
+        for (object * res : results) {
+            if (!io_result_is_error(res))
+                delete reinterpret_cast<compacted_region *>(unbox_size_t(cnstr_get(io_result_get_value(res), 1)));
+            dec(res);
+        }
+        return err;
+    }
+    object * r = alloc_array(0, n);
+    for (object * res : results) {
+        object * mod_region = io_result_get_value(res);
+        inc(mod_region);
+        r = array_push(r, mod_region);
+        dec(res);
+    }
+    return io_result_mk_ok(r);
+}
+
 /*
 @[export lean.write_module_core]
 def writeModule (env : Environment) (fname : String) : IO Unit := */
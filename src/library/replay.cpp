@@ -0,0 +1,411 @@
+/*
+Copyright (c) 2024 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Native, parallel version of `Lean.Environment.replay`.
+*/
+#include <vector>
+#include <algorithm>
+#include "runtime/sstream.h"
+#include "runtime/thread.h"
+#include "runtime/flat_hash_map.h"
+#include "runtime/buffer.h"
+#include "kernel/environment.h"
+#include "kernel/for_each_fn.h"
+#include "kernel/kernel_exception.h"
+
+namespace lean {
+/* index of a constant that does not belong to any declaration */
+static constexpr unsigned no_unit = static_cast<unsigned>(-1);
+
+/** \brief Send the given constants to the kernel for checking and add them to an environment.
+
+    The constants are grouped into declarations (an inductive declaration contains all types of a mutual block and
+    their constructors, the quotient constants form a single declaration). A declaration is checked as soon as all
+    declarations it depends on have been added to the environment, concurrently with the other declarations that are
+    ready (see `replay_units`), and then added to the environment without checking it again.
+
+    As in `Lean.Environment.replay`, unsafe and partial constants are skipped, and constructors and recursors are not
+    sent to the kernel: we check that they are identical to the ones generated by the kernel for their inductive
+    declaration instead. */
+class replay_fn {
+    struct unit {
+        name                  m_name;
+        declaration           m_decl;
+        std::vector<unsigned> m_deps;
+    };
+    typedef flat_hash_map<name, unsigned, name_hash_fn, name_eq_fn> name2idx;
+
+    environment                m_env;
+    std::vector<constant_info> m_infos;
+    /* constant name -> index in `m_infos` */
+    name2idx                   m_info_idx;
+    /* index in `m_infos` -> index in `m_units` */
+    std::vector<unsigned>      m_unit_of;
+    std::vector<unit>          m_units;
+    object *                   m_error = nullptr;
+
+    static bool is_skipped(constant_info const & info) {
+        return info.is_unsafe() || (info.is_definition() && info.to_definition_val().get_safety() == definition_safety::partial);
+    }
+
+    unsigned unit_of(name const & n) const {
+        auto it = m_info_idx.find(n);
+        return it ? m_unit_of[it->second] : no_unit;
+    }
+
+    constant_info const & get_info(name const & n) const {
+        auto it = m_info_idx.find(n);
+        if (!it)
+            throw kernel_exception(m_env, sstream() << "unknown constant '" << n << "'");
+        return m_infos[it->second];
+    }
+
+    void set_unit(name const & n, unsigned u) {
+        if (auto it = m_info_idx.find(n))
+            m_unit_of[it->second] = u;
+    }
+
+    unsigned mk_unit(name const & n, declaration const & d) {
+        m_units.push_back(unit{n, d, {}});
+        return m_units.size() - 1;
+    }
+
+    unsigned mk_inductive_unit(constant_info const & info) {
+        inductive_val const & val = info.to_inductive_val();
+        buffer<inductive_type> types;
+        for (name const & ind : val.get_all()) {
+            constant_info const & ind_info = get_info(ind);
+            if (!ind_info.is_inductive())
+                throw kernel_exception(m_env, sstream() << "inductive type expected '" << ind << "'");
+            buffer<constructor> cnstrs;
+            for (name const & c : ind_info.to_inductive_val().get_cnstrs())
+                cnstrs.push_back(constructor(c, get_info(c).get_type()));
+            types.push_back(inductive_type(ind, ind_info.get_type(), constructors(cnstrs)));
+        }
+        unsigned u = mk_unit(info.get_name(), mk_inductive_decl(info.get_lparams(), nat(val.get_nparams()),
+                                                                inductive_types(types), false));
+        for (name const & ind : val.get_all()) {
+            set_unit(ind, u);
+            for (name const & c : get_info(ind).to_inductive_val().get_cnstrs())
+                set_unit(c, u);
+        }
+        return u;
+    }
+
+    void mk_units() {
+        unsigned quot_unit = no_unit;
+        for (unsigned i = 0; i < m_infos.size(); i++) {
+            constant_info const & info = m_infos[i];
+            if (is_skipped(info) || m_unit_of[i] != no_unit)
+                continue;
+            switch (info.kind()) {
+            case constant_info_kind::Axiom:
+                m_unit_of[i] = mk_unit(info.get_name(), declaration(mk_cnstr(static_cast<unsigned>(declaration_kind::Axiom), info.to_axiom_val())));
+                break;
+            case constant_info_kind::Definition:
+                m_unit_of[i] = mk_unit(info.get_name(), declaration(mk_cnstr(static_cast<unsigned>(declaration_kind::Definition), info.to_definition_val())));
+                break;
+            case constant_info_kind::Theorem:
+                m_unit_of[i] = mk_unit(info.get_name(), declaration(mk_cnstr(static_cast<unsigned>(declaration_kind::Theorem), info.to_theorem_val())));
+                break;
+            case constant_info_kind::Opaque:
+                m_unit_of[i] = mk_unit(info.get_name(), declaration(mk_cnstr(static_cast<unsigned>(declaration_kind::Opaque), info.to_opaque_val())));
+                break;
+            case constant_info_kind::Quot:
+                if (quot_unit == no_unit)
+                    quot_unit = mk_unit(info.get_name(), declaration(box(static_cast<unsigned>(declaration_kind::Quot))));
+                m_unit_of[i] = quot_unit;
+                break;
+            case constant_info_kind::Inductive:
+                mk_inductive_unit(info);
+                break;
+            case constant_info_kind::Constructor: case constant_info_kind::Recursor:
+                break;
+            }
+        }
+        /* Constructors not reachable from their inductive type are not replayed. Recursors are generated together
+           with their inductive types, so depending on a recursor means depending on its inductive declaration. */
+        for (unsigned i = 0; i < m_infos.size(); i++) {
+            constant_info const & info = m_infos[i];
+            if (!is_skipped(info) && info.is_recursor())
+                m_unit_of[i] = unit_of(head(info.to_recursor_val().get_all()));
+            if (!is_skipped(info) && m_unit_of[i] == no_unit)
+                throw kernel_exception(m_env, sstream() << "no inductive declaration for '" << info.get_name() << "'");
+        }
+    }
+
+    void add_deps(unsigned u, expr const & e) {
+        std::vector<unsigned> & deps = m_units[u].m_deps;
+        for_each(e, [&](expr const & c, unsigned) {
+                if (is_constant(c)) {
+                    unsigned v = unit_of(const_name(c));
+                    if (v != no_unit && v != u)
+                        deps.push_back(v);
+                }
+                return true;
+            });
+    }
+
+    void mk_deps() {
+        for (unsigned i = 0; i < m_infos.size(); i++) {
+            constant_info const & info = m_infos[i];
+            unsigned u = m_unit_of[i];
+            /* the expressions of recursors are generated by the kernel */
+            if (u == no_unit || info.is_recursor())
+                continue;
+            add_deps(u, info.get_type());
+            if (info.is_definition() || info.is_theorem())
+                add_deps(u, info.get_value());
+            else if (info.is_opaque())
+                add_deps(u, info.to_opaque_val().get_value());
+        }
+        for (unit & d : m_units) {
+            std::sort(d.m_deps.begin(), d.m_deps.end());
+            d.m_deps.erase(std::unique(d.m_deps.begin(), d.m_deps.end()), d.m_deps.end());
+        }
+    }
+
+    /* Make sure the dependencies do not contain cycles, which would make `replay_units` wait forever. We use an
+       explicit stack because dependency chains can be very long. */
+    void check_acyclic() {
+        enum class status { Todo, Visiting, Done };
+        std::vector<status> st(m_units.size(), status::Todo);
+        /* pairs (unit, index of the next dependency to visit) */
+        std::vector<std::pair<unsigned, unsigned>> todo;
+        for (unsigned root = 0; root < m_units.size(); root++) {
+            if (st[root] != status::Todo)
+                continue;
+            st[root] = status::Visiting;
+            todo.emplace_back(root, 0);
+            while (!todo.empty()) {
+                unsigned u = todo.back().first;
+                unsigned i = todo.back().second;
+                std::vector<unsigned> const & deps = m_units[u].m_deps;
+                if (i < deps.size()) {
+                    todo.back().second++;
+                    unsigned v = deps[i];
+                    if (st[v] == status::Visiting)
+                        throw kernel_exception(m_env, sstream() << "cyclic dependency at '" << m_units[v].m_name << "'");
+                    if (st[v] == status::Todo) {
+                        st[v] = status::Visiting;
+                        todo.emplace_back(v, 0);
+                    }
+                } else {
+                    st[u] = status::Done;
+                    todo.pop_back();
+                }
+            }
+        }
+    }
+
+    /* Check all units and add them to `m_env`. A unit is ready once all its dependencies have been added. It is then
+       checked against the environment at that time and added to `m_env` without checking it again.
+
+       Ready units are processed by a fixed set of threads, see `parallel_for`, which are used for the whole replay so
+       that their thread-local kernel caches are reused. We do not spawn tasks and wait for them: when called from a
+       task worker, the tasks could be queued behind the waiting worker. */
+    void replay_units() {
+        std::vector<std::vector<unsigned>> dependents(m_units.size());
+        std::vector<size_t> num_missing(m_units.size());
+        std::vector<unsigned> ready;
+        for (unsigned u = 0; u < m_units.size(); u++) {
+            num_missing[u] = m_units[u].m_deps.size();
+            for (unsigned v : m_units[u].m_deps)
+                dependents[v].push_back(u);
+            if (num_missing[u] == 0)
+                ready.push_back(u);
+            /* the declarations and the environment are used by all threads */
+            mark_mt(m_units[u].m_decl.raw());
+        }
+        mark_mt(m_env.raw());
+        /* protects `m_env`, `m_error` and the variables below */
+        mutex mtx;
+        condition_variable cv;
+        size_t num_added = 0;
+        bool stop = false;
+        unsigned failed = no_unit;
+        auto done = [&]() { return stop || num_added == m_units.size(); };
+        /* Report the error of the failed unit with the smallest index, independently of the order the checks
+           finished in. */
+        auto fail = [&](unsigned u, object * err) {
+            if (failed == no_unit || u < failed) {
+                if (m_error) dec(m_error);
+                m_error = err;
+                failed = u;
+            } else {
+                dec(err);
+            }
+            stop = true;
+            cv.notify_all();
+        };
+        auto added = [&](unsigned u) {
+            mark_mt(m_env.raw());
+            num_added++;
+            for (unsigned v : dependents[u]) {
+                if (--num_missing[v] == 0)
+                    ready.push_back(v);
+            }
+            cv.notify_all();
+        };
+        auto worker = [&](size_t) {
+            unique_lock<mutex> lock(mtx);
+            bool locked = true;
+            try {
+                while (true) {
+                    while (!done() && ready.empty())
+                        cv.wait(lock);
+                    if (done())
+                        return;
+                    unsigned u = ready.back();
+                    ready.pop_back();
+                    declaration const & d = m_units[u].m_decl;
+                    if (d.is_inductive() || d.kind() == declaration_kind::Quot) {
+                        /* The kernel generates constants while checking these declarations, so we have to add its
+                           result. They are rare and cheap enough to be added while holding the lock. */
+                        environment new_env = m_env;
+                        object * r = catch_kernel_exceptions<object_ref>([&]() {
+                                new_env = m_env.add(d);
+                                return object_ref(box(0));
+                            });
+                        if (obj_tag(r) == 0) {
+                            fail(u, r);
+                            return;
+                        }
+                        dec(r);
+                        m_env = new_env;
+                    } else {
+                        environment env = m_env;
+                        lock.unlock();
+                        locked = false;
+                        object * r = catch_kernel_exceptions<object_ref>([&]() {
+                                env.add(d);
+                                return object_ref(box(0));
+                            });
+                        lock.lock();
+                        locked = true;
+                        if (obj_tag(r) == 0) {
+                            fail(u, r);
+                            return;
+                        }
+                        dec(r);
+                        m_env = m_env.add(d, /* check */ false);
+                    }
+                    added(u);
+                }
+            } catch (...) {
+                // e.g. interruption: make sure the other threads do not wait for this one
+                if (!locked)
+                    lock.lock();
+                stop = true;
+                cv.notify_all();
+                throw;
+            }
+        };
+        parallel_for(std::max(hardware_concurrency(), 1u), worker);
+        if (m_error)
+            throw check_failed();
+    }
+
+    /* Whether the natural numbers in field `i` of `o1` and `o2` are equal. Given values may be arbitrary, so we do
+       not assume they are small. */
+    static bool eq_nat_field(object_ref const & o1, object_ref const & o2, unsigned i) {
+        return static_cast<nat const &>(cnstr_get_ref(o1, i)) == static_cast<nat const &>(cnstr_get_ref(o2, i));
+    }
+
+    static bool eq_constructor(constructor_val const & v1, constructor_val const & v2) {
+        return
+            v1.get_induct() == v2.get_induct() &&
+            eq_nat_field(v1, v2, 2) && // cidx
+            eq_nat_field(v1, v2, 3) && // nparams
+            eq_nat_field(v1, v2, 4) && // nfields
+            v1.is_unsafe() == v2.is_unsafe();
+    }
+
+    static bool eq_recursor(recursor_val const & v1, recursor_val const & v2) {
+        if (!(v1.get_all() == v2.get_all() &&
+              eq_nat_field(v1, v2, 2) && // nparams
+              eq_nat_field(v1, v2, 3) && // nindices
+              eq_nat_field(v1, v2, 4) && // nmotives
+              eq_nat_field(v1, v2, 5) && // nminors
+              v1.is_k() == v2.is_k() &&
+              v1.is_unsafe() == v2.is_unsafe()))
+            return false;
+        recursor_rules rs1 = v1.get_rules();
+        recursor_rules rs2 = v2.get_rules();
+        for (; !is_nil(rs1) && !is_nil(rs2); rs1 = tail(rs1), rs2 = tail(rs2)) {
+            recursor_rule const & r1 = head(rs1);
+            recursor_rule const & r2 = head(rs2);
+            if (!(r1.get_cnstr() == r2.get_cnstr() && eq_nat_field(r1, r2, 1) && r1.get_rhs() == r2.get_rhs()))
+                return false;
+        }
+        return is_nil(rs1) && is_nil(rs2);
+    }
+
+    /* Check that the given constructors and recursors are identical to the ones generated by the kernel, in all
+       fields, as `Lean.Environment.replay` does. */
+    void check_generated() {
+        for (constant_info const & info : m_infos) {
+            if (is_skipped(info) || !(info.is_constructor() || info.is_recursor()))
+                continue;
+            char const * what = info.is_constructor() ? "constructor" : "recursor";
+            optional<constant_info> new_info = m_env.find(info.get_name());
+            if (!new_info || new_info->kind() != info.kind())
+                throw kernel_exception(m_env, sstream() << "no such " << what << " '" << info.get_name() << "'");
+            bool ok = new_info->get_lparams() == info.get_lparams() && new_info->get_type() == info.get_type();
+            if (ok && info.is_constructor())
+                ok = eq_constructor(info.to_constructor_val(), new_info->to_constructor_val());
+            else if (ok)
+                ok = eq_recursor(info.to_recursor_val(), new_info->to_recursor_val());
+            if (!ok)
+                throw kernel_exception(m_env, sstream() << "invalid " << what << " '" << info.get_name() << "'");
+        }
+    }
+
+public:
+    /* Thrown after a check performed in parallel failed, see `steal_error` */
+    struct check_failed {};
+
+    replay_fn(environment const & env, b_obj_arg infos):m_env(env) {
+        for (size_t i = 0; i < array_size(infos); i++) {
+            constant_info info(array_get(infos, i), true);
+            m_info_idx.insert(mk_pair(info.get_name(), static_cast<unsigned>(m_infos.size())));
+            m_infos.push_back(info);
+        }
+        m_unit_of.resize(m_infos.size(), no_unit);
+    }
+
+    ~replay_fn() {
+        if (m_error) dec(m_error);
+    }
+
+    /* Return the `Except.error` object produced by the failed check. */
+    object * steal_error() {
+        object * r = m_error;
+        m_error = nullptr;
+        return r;
+    }
+
+    environment operator()() {
+        mk_units();
+        mk_deps();
+        check_acyclic();
+        replay_units();
+        check_generated();
+        return m_env;
+    }
+};
+
+/*
+@[extern "lean_kernel_replay_parallel"]
+opaque replayParallelCore (env : Environment) (constants : @& Array ConstantInfo) :
+  Except KernelException Environment */
+extern "C" LEAN_EXPORT object * lean_kernel_replay_parallel(object * env, b_obj_arg constants) {
+    replay_fn fn(environment(env), constants);
+    try {
+        return catch_kernel_exceptions<environment>([&]() { return fn(); });
+    } catch (replay_fn::check_failed &) {
+        return fn.steal_error();
+    }
+}
+}
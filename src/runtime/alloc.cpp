@@ -5,10 +5,21 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <vector>
+#include <cstring>
 #include <lean/lean.h>
 #include "runtime/thread.h"
 #include "runtime/debug.h"
 #include "runtime/alloc.h"
+#include "runtime/flet.h"
+
+#if defined(LEAN_MMAP) && !defined(LEAN_WINDOWS) && !defined(LEAN_EMSCRIPTEN)
+#define LEAN_MMAP_SEGMENTS
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
 
 #ifdef LEAN_RUNTIME_STATS
 #define LEAN_RUNTIME_STAT_CODE(c) c
@@ -24,11 +35,13 @@ Author: Leonardo de Moura
 
 #define LEAN_PAGE_SIZE             8192        // 8 Kb
 #define LEAN_SEGMENT_SIZE          8*1024*1024 // 8 Mb
-#define LEAN_NUM_SLOTS             (LEAN_MAX_SMALL_OBJECT_SIZE / LEAN_OBJECT_SIZE_DELTA)
+#define LEAN_HUGE_PAGE_SIZE        2*1024*1024 // 2 Mb, x86-64 and aarch64 (with 4 Kb base pages) default
+#define LEAN_NUM_SLOTS             LEAN_NUM_SMALL_SLOTS
 #define LEAN_MAX_TO_EXPORT_OBJS    1024
 
 LEAN_CASSERT(LEAN_PAGE_SIZE > LEAN_MAX_SMALL_OBJECT_SIZE);
 LEAN_CASSERT(LEAN_SEGMENT_SIZE > LEAN_PAGE_SIZE);
+LEAN_CASSERT(LEAN_SEGMENT_SIZE % LEAN_HUGE_PAGE_SIZE == 0);
 
 namespace lean {
 
@@ -40,25 +53,55 @@ static atomic<uint64> g_num_alloc(0);
 static atomic<uint64> g_num_small_alloc(0);
 static atomic<uint64> g_num_dealloc(0);
 static atomic<uint64> g_num_small_dealloc(0);
-static atomic<uint64> g_num_segments(0);
-static atomic<uint64> g_num_pages(0);
-static atomic<uint64> g_num_exports(0);
-static atomic<uint64> g_num_recycled_pages(0);
 struct alloc_stats {
     ~alloc_stats() {
+        lean_small_alloc_stats s;
+        lean_get_small_alloc_stats(&s);
         std::cerr << "num. alloc.:         " << g_num_alloc << "\n";
         std::cerr << "num. small alloc.:   " << g_num_small_alloc << "\n";
         std::cerr << "num. dealloc.:       " << g_num_dealloc << "\n";
         std::cerr << "num. small dealloc.: " << g_num_small_dealloc << "\n";
-        std::cerr << "num. segments:       " << g_num_segments << "\n";
-        std::cerr << "num. pages:          " << g_num_pages << "\n";
-        std::cerr << "num. recycled pages: " << g_num_recycled_pages << "\n";
-        std::cerr << "num. exports:        " << g_num_exports << "\n";
+        std::cerr << "num. segments:       " << s.m_num_segments << "\n";
+        std::cerr << "num. pages:          " << s.m_num_pages << "\n";
+        std::cerr << "num. recycled pages: " << s.m_num_recycled_pages << "\n";
+        std::cerr << "num. exports:        " << s.m_num_exports << "\n";
     }
 };
 static alloc_stats g_alloc_stats;
 #endif
 
+/* Counters that are always maintained. They are only updated on slow paths
+   (new segments and pages, page recycling, cross-heap exports), so the cost is
+   negligible. They are atomic because `lean_get_small_alloc_stats` reads the
+   counters of every heap. */
+struct heap_stats {
+    atomic<uint64_t> m_num_segments;
+    atomic<uint64_t> m_num_recycled_pages;
+    atomic<uint64_t> m_num_exports;
+    atomic<uint64_t> m_num_exported_objs;
+    atomic<uint64_t> m_num_imported_objs;
+    atomic<uint64_t> m_num_released_segments;
+    atomic<uint64_t> m_slot_pages[LEAN_NUM_SLOTS];
+    heap_stats() {
+        m_num_segments       = 0;
+        m_num_recycled_pages = 0;
+        m_num_exports        = 0;
+        m_num_exported_objs  = 0;
+        m_num_imported_objs  = 0;
+        m_num_released_segments = 0;
+        for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++)
+            m_slot_pages[i] = 0;
+    }
+};
+
+static inline void inc_stat(atomic<uint64_t> & c, uint64_t n = 1) {
+    atomic_fetch_add_explicit(&c, n, memory_order_relaxed);
+}
+
+static inline void dec_stat(atomic<uint64_t> & c) {
+    atomic_fetch_sub_explicit(&c, static_cast<uint64_t>(1), memory_order_relaxed);
+}
+
 struct heap;
 struct page;
 struct page_header {
@@ -92,10 +135,18 @@ inline char * align_ptr(char * p, size_t a) {
     return reinterpret_cast<char*>(lean_align(reinterpret_cast<size_t>(p), a));
 }
 
-struct segment {
+struct segment;
+struct segment_header {
     segment *    m_next{nullptr};
     char *       m_next_page_mem;
-    char         m_data[LEAN_SEGMENT_SIZE];
+    /* True if the segment was allocated by `mmap_segment` instead of `new`. */
+    bool         m_mmapped{false};
+};
+
+/* A segment occupies exactly `LEAN_SEGMENT_SIZE` bytes, so that segments allocated using
+   `mmap_segment` are aligned to and made up of whole huge pages. */
+struct segment : public segment_header {
+    char         m_data[LEAN_SEGMENT_SIZE - sizeof(segment_header)];
 
     char * get_first_page_mem() {
         lean_assert(align_ptr(m_data, LEAN_PAGE_SIZE) >= m_data);
@@ -108,10 +159,103 @@ struct segment {
     }
 
     bool is_full() const {
-        return m_next_page_mem + LEAN_PAGE_SIZE > m_data + LEAN_SEGMENT_SIZE;
+        return m_next_page_mem + LEAN_PAGE_SIZE > m_data + sizeof(m_data);
     }
 };
 
+LEAN_CASSERT(sizeof(segment) == LEAN_SEGMENT_SIZE);
+
+static uint8_t g_huge_pages = LEAN_HUGE_PAGES_NONE;
+static bool    g_numa_local = false;
+
+#ifdef LEAN_MMAP_SEGMENTS
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_getcpu)
+#define LEAN_NUMA_SEGMENTS
+/* We invoke the system calls directly instead of depending on libnuma. */
+#define LEAN_MPOL_PREFERRED 1
+
+/* Prefer the NUMA node of the CPU the current thread is running on for the pages of `mem`. */
+static void bind_to_local_numa_node(void * mem, size_t sz) {
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+        return;
+    unsigned long mask[16] = {0};
+    unsigned long bits_per_word = 8 * sizeof(unsigned long);
+    if (node >= 16 * bits_per_word)
+        return;
+    mask[node / bits_per_word] = 1ul << (node % bits_per_word);
+    /* Failure is not fatal, the memory is simply not bound. */
+    syscall(SYS_mbind, mem, sz, LEAN_MPOL_PREFERRED, mask, 16 * bits_per_word + 1, 0);
+}
+#endif
+
+/* Reserve `sz` bytes aligned to `align` by over-allocating and unmapping the excess. */
+static void * mmap_aligned(size_t sz, size_t align) {
+    size_t total = sz + align;
+    char * mem = static_cast<char *>(mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (mem == MAP_FAILED)
+        return nullptr;
+    char * r = align_ptr(mem, align);
+    if (r > mem)
+        munmap(mem, r - mem);
+    if (r + sz < mem + total)
+        munmap(r + sz, mem + total - (r + sz));
+    return r;
+}
+
+static void * mmap_segment() {
+    void * mem = nullptr;
+#ifdef MAP_HUGETLB
+    if (g_huge_pages == LEAN_HUGE_PAGES_EXPLICIT) {
+        /* Explicit huge pages must be reserved by the administrator (`vm.nr_hugepages`), we fall back to
+           transparent huge pages if there are not enough of them. The mapping is aligned to the huge page size. */
+        mem = mmap(nullptr, LEAN_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem == MAP_FAILED)
+            mem = nullptr;
+    }
+#endif
+    if (!mem) {
+        mem = mmap_aligned(LEAN_SEGMENT_SIZE, LEAN_HUGE_PAGE_SIZE);
+        if (!mem)
+            return nullptr;
+#ifdef MADV_HUGEPAGE
+        if (g_huge_pages != LEAN_HUGE_PAGES_NONE)
+            madvise(mem, LEAN_SEGMENT_SIZE, MADV_HUGEPAGE);
+#endif
+    }
+#ifdef LEAN_NUMA_SEGMENTS
+    if (g_numa_local)
+        bind_to_local_numa_node(mem, LEAN_SEGMENT_SIZE);
+#endif
+    return mem;
+}
+#endif
+
+static segment * alloc_segment_mem() {
+#ifdef LEAN_MMAP_SEGMENTS
+    if (void * mem = mmap_segment()) {
+        segment * s   = new (mem) segment();
+        s->m_mmapped  = true;
+        return s;
+    }
+#endif
+    return new segment();
+}
+
+static void free_segment_mem(segment * s) {
+#ifdef LEAN_MMAP_SEGMENTS
+    if (s->m_mmapped) {
+        munmap(s, LEAN_SEGMENT_SIZE);
+        return;
+    }
+#endif
+    delete s;
+}
+
+/* Number of pages that must become empty before a heap looks for segments to release,
+   0 disables automatic release. */
+static unsigned g_release_threshold = 4 * (LEAN_SEGMENT_SIZE / LEAN_PAGE_SIZE);
+
 struct heap {
     segment * m_curr_segment{nullptr};
     heap *    m_next_orphan{nullptr};
@@ -120,20 +264,34 @@ struct heap {
     /* Objects that must be sent to other heaps. */
     void *    m_to_export_list{nullptr};
     unsigned  m_to_export_list_size{0};
+    /* Number of pages that became empty since the last call to `release_free_segments`. */
+    unsigned  m_num_emptied_pages{0};
+    bool      m_releasing{false};
     mutex     m_mutex; /* for the following fields */
     /* The following list contains object by this heap that were deallocated
        by other heaps. */
     void *    m_to_import_list{nullptr};
     uint64_t  m_heartbeat{0}; /* Counter for implementing "deterministic timeouts". It is currently the number of small allocations */
+    heap_stats m_stats;
     void import_objs();
     void export_objs();
     void alloc_segment();
+    bool can_release(segment * s);
+    void unlink_pages(segment * s);
+    size_t release_free_segments();
 };
 
 struct heap_manager {
-    /* The mutex protects the list of orphan segments. */
+    /* The mutex protects the list of orphan segments and `m_heaps`. */
     mutex             m_mutex;
     heap *            m_orphans{nullptr};
+    /* All heaps ever created, heaps are never deleted. */
+    std::vector<heap *> m_heaps;
+
+    void register_heap(heap * h) {
+        lock_guard<mutex> lock(m_mutex);
+        m_heaps.push_back(h);
+    }
 
     void push_orphan(heap * h) {
         /* TODO(Leo): avoid mutex */
@@ -210,12 +368,23 @@ void page::push_free_obj(void * o) {
         heap * h = get_heap();
         unsigned slot_idx = m_header.m_slot_idx;
         if (this != h->m_curr_page[slot_idx]) {
-            LEAN_RUNTIME_STAT_CODE(g_num_recycled_pages++);
+            inc_stat(h->m_stats.m_num_recycled_pages);
             m_header.m_in_page_free_list = true;
             page_list_remove(h->m_curr_page[slot_idx], this);
             page_list_insert(h->m_page_free_list[slot_idx], this);
         }
     }
+    if (LEAN_UNLIKELY(m_header.m_num_free == m_header.m_max_free)) {
+        heap * h = get_heap();
+        /* Objects are only allocated from the first page of `m_curr_page`, we do not count it so that
+           allocating and freeing a single object repeatedly does not trigger the release. */
+        if (this == h->m_curr_page[m_header.m_slot_idx])
+            return;
+        h->m_num_emptied_pages++;
+        /* Note that `this` may be released by `release_free_segments`. */
+        if (h->m_num_emptied_pages >= g_release_threshold && g_release_threshold > 0 && !h->m_releasing)
+            h->release_free_segments();
+    }
 }
 
 void heap::import_objs() {
@@ -225,12 +394,16 @@ void heap::import_objs() {
         to_import = m_to_import_list;
         m_to_import_list = nullptr;
     }
+    uint64_t num_imported = 0;
     while (to_import) {
         page * p = get_page_of(to_import);
         void * n = get_next_obj(to_import);
         p->push_free_obj(to_import);
         to_import = n;
+        num_imported++;
     }
+    if (num_imported > 0)
+        inc_stat(m_stats.m_num_imported_objs, num_imported);
 }
 
 struct export_entry {
@@ -260,6 +433,10 @@ void heap::export_objs() {
         }
         o = n;
     }
+    if (m_to_export_list_size > 0) {
+        inc_stat(m_stats.m_num_exports);
+        inc_stat(m_stats.m_num_exported_objs, m_to_export_list_size);
+    }
     m_to_export_list      = nullptr;
     m_to_export_list_size = 0;
     for (export_entry const & e : to_export) {
@@ -270,16 +447,70 @@ void heap::export_objs() {
 }
 
 void heap::alloc_segment() {
-    LEAN_RUNTIME_STAT_CODE(g_num_segments++);
-    segment * s = new segment();
+    inc_stat(m_stats.m_num_segments);
+    segment * s = alloc_segment_mem();
     s->m_next   = m_curr_segment;
     m_curr_segment = s;
 }
 
+/* A segment can be released if all its pages are empty. The current segment is still being
+   carved into pages, and the first page of `m_curr_page[i]` must stay valid for the fast
+   path of `lean_alloc_small`. */
+bool heap::can_release(segment * s) {
+    if (s == m_curr_segment)
+        return false;
+    for (char * it = s->get_first_page_mem(); it < s->m_next_page_mem; it += LEAN_PAGE_SIZE) {
+        page * p = reinterpret_cast<page *>(it);
+        if (p->m_header.m_num_free != p->m_header.m_max_free)
+            return false;
+        if (m_curr_page[p->get_slot_idx()] == p)
+            return false;
+    }
+    return true;
+}
+
+void heap::unlink_pages(segment * s) {
+    for (char * it = s->get_first_page_mem(); it < s->m_next_page_mem; it += LEAN_PAGE_SIZE) {
+        page * p          = reinterpret_cast<page *>(it);
+        unsigned slot_idx = p->get_slot_idx();
+        dec_stat(m_stats.m_slot_pages[slot_idx]);
+        if (!p->in_page_free_list()) {
+            /* `can_release` guarantees that `p` is not the head of the list */
+            page_list_remove(m_curr_page[slot_idx], p);
+        } else if (m_page_free_list[slot_idx] == p) {
+            page_list_pop(m_page_free_list[slot_idx]);
+        } else {
+            page_list_remove(m_page_free_list[slot_idx], p);
+        }
+    }
+}
+
+/* Return segments whose pages are all empty to the OS. Must be invoked by the thread owning the heap.
+   Returns the number of bytes released. */
+size_t heap::release_free_segments() {
+    flet<bool> releasing(m_releasing, true);
+    import_objs();
+    m_num_emptied_pages = 0;
+    size_t released     = 0;
+    segment ** it       = &m_curr_segment;
+    while (*it) {
+        segment * s = *it;
+        if (can_release(s)) {
+            *it = s->m_next;
+            unlink_pages(s);
+            free_segment_mem(s);
+            inc_stat(m_stats.m_num_released_segments);
+            released += LEAN_SEGMENT_SIZE;
+        } else {
+            it = &s->m_next;
+        }
+    }
+    return released;
+}
+
 static page * alloc_page(heap * h, unsigned obj_size) {
     lean_assert(lean_align(obj_size, LEAN_OBJECT_SIZE_DELTA) == obj_size);
     segment * s = h->m_curr_segment;
-    LEAN_RUNTIME_STAT_CODE(g_num_pages++);
     page * p    = new (s->m_next_page_mem) page();
     s->m_next_page_mem += LEAN_PAGE_SIZE;
     if (s->is_full()) {
@@ -287,6 +518,7 @@ static page * alloc_page(heap * h, unsigned obj_size) {
         h->alloc_segment();
     }
     unsigned slot_idx        = lean_get_slot_idx(obj_size);
+    inc_stat(h->m_stats.m_slot_pages[slot_idx]);
     p->m_header.m_heap       = h;
     page_list_insert(h->m_curr_page[slot_idx], p);
     p->m_header.m_slot_idx   = slot_idx;
@@ -325,6 +557,8 @@ static void finalize_heap(void * _h) {
     heap * h = static_cast<heap*>(_h);
     h->export_objs();
     h->import_objs();
+    if (g_release_threshold > 0)
+        h->release_free_segments();
     g_heap_manager->push_orphan(h);
 }
 
@@ -336,6 +570,7 @@ static void init_heap(bool main) {
         g_heap = h;
     } else {
         g_heap = new heap();
+        g_heap_manager->register_heap(g_heap);
         g_curr_pages = g_heap->m_curr_page;
         for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
             g_heap->m_curr_page[i] = nullptr;
@@ -414,7 +649,6 @@ static void dealloc_small_core_cold(void * o) {
     g_heap->m_to_export_list = o;
     g_heap->m_to_export_list_size++;
     if (g_heap->m_to_export_list_size > LEAN_MAX_TO_EXPORT_OBJS) {
-        LEAN_RUNTIME_STAT_CODE(g_num_exports++);
         g_heap->export_objs();
     }
 }
@@ -451,10 +685,94 @@ extern "C" LEAN_EXPORT unsigned lean_small_mem_size(void * o) {
     return p->m_header.m_obj_size;
 }
 
+static void add_page_list_occupancy(page * p, lean_small_alloc_stats * r) {
+    for (; p != nullptr; p = p->get_next()) {
+        unsigned slot_idx = p->get_slot_idx();
+        r->m_slot_used[slot_idx] += p->m_header.m_max_free - p->m_header.m_num_free;
+        r->m_slot_free[slot_idx] += p->m_header.m_num_free;
+    }
+}
+
+extern "C" LEAN_EXPORT void lean_get_small_alloc_stats(lean_small_alloc_stats * r) {
+    memset(r, 0, sizeof(lean_small_alloc_stats));
+    {
+        lock_guard<mutex> lock(g_heap_manager->m_mutex);
+        r->m_num_heaps = g_heap_manager->m_heaps.size();
+        for (heap * h : g_heap_manager->m_heaps) {
+            heap_stats const & s   = h->m_stats;
+            r->m_num_segments       += s.m_num_segments;
+            r->m_num_recycled_pages += s.m_num_recycled_pages;
+            r->m_num_exports        += s.m_num_exports;
+            r->m_num_exported_objs  += s.m_num_exported_objs;
+            r->m_num_imported_objs  += s.m_num_imported_objs;
+            r->m_num_released_segments += s.m_num_released_segments;
+            for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
+                uint64_t n = s.m_slot_pages[i];
+                r->m_slot_pages[i] += n;
+                r->m_num_pages     += n;
+            }
+        }
+    }
+    if (g_heap) {
+        for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
+            add_page_list_occupancy(g_heap->m_curr_page[i], r);
+            add_page_list_occupancy(g_heap->m_page_free_list[i], r);
+        }
+    }
+}
+
+extern "C" LEAN_EXPORT size_t lean_release_free_segments() {
+    if (g_heap == nullptr)
+        return 0;
+    return g_heap->release_free_segments();
+}
+
+extern "C" LEAN_EXPORT void lean_set_small_alloc_release_threshold(unsigned num_pages) {
+    g_release_threshold = num_pages;
+}
+
+void export_freed_objs() {
+    if (g_heap != nullptr && g_heap->m_to_export_list != nullptr)
+        g_heap->export_objs();
+}
+
+#else
+
+void export_freed_objs() {
+}
+
+extern "C" LEAN_EXPORT void lean_get_small_alloc_stats(lean_small_alloc_stats * r) {
+    memset(r, 0, sizeof(lean_small_alloc_stats));
+}
+
+extern "C" LEAN_EXPORT size_t lean_release_free_segments() {
+    return 0;
+}
+
+extern "C" LEAN_EXPORT void lean_set_small_alloc_release_threshold(unsigned) {
+}
+
 #endif
 
+extern "C" LEAN_EXPORT void lean_set_small_alloc_options(uint8_t huge_pages, bool numa_local) {
+#ifdef LEAN_SMALL_ALLOCATOR
+    g_huge_pages = huge_pages;
+    g_numa_local = numa_local;
+#endif
+}
+
 void initialize_alloc() {
 #ifdef LEAN_SMALL_ALLOCATOR
+#ifndef LEAN_EMSCRIPTEN
+    if (char const * mode = std::getenv("LEAN_HUGE_PAGES")) {
+        if (strcmp(mode, "transparent") == 0 || strcmp(mode, "1") == 0)
+            g_huge_pages = LEAN_HUGE_PAGES_TRANSPARENT;
+        else if (strcmp(mode, "explicit") == 0)
+            g_huge_pages = LEAN_HUGE_PAGES_EXPLICIT;
+    }
+    if (char const * numa = std::getenv("LEAN_NUMA_LOCAL"))
+        g_numa_local = strcmp(numa, "0") != 0;
+#endif
     g_heap_manager = new heap_manager();
     init_heap(true);
 #endif
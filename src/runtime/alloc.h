@@ -12,6 +12,10 @@ namespace lean {
 void init_thread_heap();
 void * alloc(size_t sz);
 void dealloc(void * o, size_t sz);
+/* Send the objects of other heaps freed by the current thread back to their heaps. This happens on its own once
+   enough of them have accumulated; a thread that frees objects of other threads and then becomes idle must call it
+   so that they do not stay unusable. */
+void export_freed_objs();
 uint64_t get_num_heartbeats();
 void initialize_alloc();
 void finalize_alloc();
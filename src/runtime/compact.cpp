@@ -4,13 +4,13 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
-#include <unordered_set>
 #include <algorithm>
 #include <string>
 #include <vector>
 #include <cstring>
 #include <lean/lean.h>
 #include "runtime/hash.h"
+#include "runtime/exception.h"
 #include "runtime/compact.h"
 
 #ifndef LEAN_WINDOWS
@@ -18,7 +18,8 @@ Author: Leonardo de Moura
 #endif
 
 #define LEAN_COMPACTOR_INIT_SZ 1024*1024
-#define LEAN_MAX_SHARING_TABLE_INITIAL_SIZE 1024*1024
+#define LEAN_OBJ_TABLE_INITIAL_SIZE 64*1024
+#define LEAN_MAX_SHARING_TABLE_INITIAL_SIZE 64*1024
 
 // uncomment to track the number of each kind of object in an .olean file
 // #define LEAN_TAG_COUNTERS
@@ -34,7 +35,7 @@ struct max_sharing_key {
 struct max_sharing_hash {
     object_compactor * m;
     max_sharing_hash(object_compactor * manager):m(manager) {}
-    unsigned operator()(max_sharing_key const & k) const {
+    uint64 operator()(max_sharing_key const & k) const {
         return hash_str(k.m_size, reinterpret_cast<unsigned char const *>(m->m_begin) + k.m_offset, 17);
     }
 };
@@ -50,13 +51,14 @@ struct max_sharing_eq {
 
 
 struct object_compactor::max_sharing_table {
-    std::unordered_set<max_sharing_key, max_sharing_hash, max_sharing_eq> m_table;
+    flat_hash_set<max_sharing_key, max_sharing_hash, max_sharing_eq> m_table;
     max_sharing_table(object_compactor * manager):
         m_table(LEAN_MAX_SHARING_TABLE_INITIAL_SIZE, max_sharing_hash(manager), max_sharing_eq(manager)) {
     }
 };
 
 object_compactor::object_compactor(void * base_addr):
+    m_obj_table(LEAN_OBJ_TABLE_INITIAL_SIZE),
     m_max_sharing_table(new max_sharing_table(this)),
     m_base_addr(base_addr),
     m_begin(malloc(LEAN_COMPACTOR_INIT_SZ)),
@@ -95,6 +97,11 @@ void * object_compactor::alloc(size_t sz) {
     return r;
 }
 
+void object_compactor::add_reloc(void * field, object_offset v) {
+    if (!lean_is_scalar(v))
+        m_relocs.push_back(static_cast<char*>(field) - static_cast<char*>(m_begin));
+}
+
 void object_compactor::save(object * o, object * new_o) {
     lean_assert(m_begin <= new_o && new_o < m_end);
     m_obj_table.insert(std::make_pair(o, reinterpret_cast<object_offset>(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin) + reinterpret_cast<size_t>(m_base_addr))));
@@ -102,9 +109,12 @@ void object_compactor::save(object * o, object * new_o) {
 
 void object_compactor::save_max_sharing(object * o, object * new_o, size_t new_o_sz) {
     max_sharing_key k(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin), new_o_sz);
-    auto it = m_max_sharing_table->m_table.find(k);
-    if (it != m_max_sharing_table->m_table.end()) {
+    max_sharing_key const * it = m_max_sharing_table->m_table.find(k);
+    if (it != nullptr) {
         m_end = new_o;
+        // drop the relocations of the discarded copy
+        while (!m_relocs.empty() && m_relocs.back() >= k.m_offset)
+            m_relocs.pop_back();
         new_o = reinterpret_cast<lean_object*>(reinterpret_cast<char*>(m_begin) + it->m_offset);
     } else {
         m_max_sharing_table->m_table.insert(k);
@@ -117,7 +127,7 @@ object_offset object_compactor::to_offset(object * o) {
         return o;
     } else {
         auto it = m_obj_table.find(o);
-        if (it == m_obj_table.end()) {
+        if (it == nullptr) {
             m_todo.push_back(o);
             return g_null_offset;
         } else {
@@ -191,8 +201,10 @@ bool object_compactor::insert_constructor(object * o) {
     }
 #endif
     object * new_o = copy_object(o);
-    for (unsigned i = 0; i < lean_ctor_num_objs(o); i++)
+    for (unsigned i = 0; i < lean_ctor_num_objs(o); i++) {
         lean_ctor_set(new_o, i, offsets[i]);
+        add_reloc(lean_ctor_obj_cptr(new_o) + i, offsets[i]);
+    }
     save_max_sharing(o, new_o, lean_object_byte_size(o));
     return true;
 }
@@ -220,6 +232,7 @@ bool object_compactor::insert_array(object * o) {
     new_o->m_capacity = sz;
     for (size_t i = 0; i < sz; i++) {
         lean_array_set_core((lean_object*)new_o, i, offsets[i]);
+        add_reloc(new_o->m_data + i, offsets[i]);
     }
     save_max_sharing(o, (lean_object*)new_o, obj_sz);
     return true;
@@ -232,6 +245,7 @@ bool object_compactor::insert_thunk(object * o) {
         return false;
     object * r = copy_object(o);
     lean_to_thunk(r)->m_value = c;
+    add_reloc(&lean_to_thunk(r)->m_value, c);
     save_max_sharing(o, r, lean_object_byte_size(o));
     return true;
 }
@@ -243,6 +257,7 @@ bool object_compactor::insert_ref(object * o) {
         return false;
     object * r = copy_object(o);
     lean_to_ref(r)->m_value = c;
+    add_reloc(&lean_to_ref(r)->m_value, c);
     save_max_sharing(o, r, lean_object_byte_size(o));
     return true;
 }
@@ -253,8 +268,12 @@ bool object_compactor::insert_task(object * o) {
     if (c == g_null_offset)
         return false;
     object * r = copy_object(o);
-    lean_assert(lean_to_task(r)->m_imp == nullptr);
+    /* `o` is finished, but may still own its `m_imp` until it is freed, see `free_task`. The compacted copy must
+       not point to it. */
+    lean_assert(lean_to_task(o)->m_value != nullptr);
+    lean_to_task(r)->m_imp   = nullptr;
     lean_to_task(r)->m_value = c;
+    add_reloc(&lean_to_task(r)->m_value, c);
     save_max_sharing(o, r, lean_object_byte_size(o));
     return true;
 }
@@ -273,6 +292,7 @@ void object_compactor::insert_mpz(object * o) {
     memcpy(data, m._mp_d, data_sz);
     m._mp_d = reinterpret_cast<mp_limb_t *>(reinterpret_cast<char *>(data) - reinterpret_cast<char *>(m_begin) + reinterpret_cast<ptrdiff_t>(m_base_addr));
     m._mp_alloc = nlimbs;
+    add_reloc(&m._mp_d, reinterpret_cast<object_offset>(m._mp_d));
     save(o, (lean_object*)new_o);
 #else
     size_t data_sz = sizeof(mpn_digit) * to_mpz(o)->m_value.m_size;
@@ -283,6 +303,7 @@ void object_compactor::insert_mpz(object * o) {
     void * data = reinterpret_cast<char*>(new_o) + sizeof(mpz_object);
     memcpy(data, to_mpz(o)->m_value.m_digits, data_sz);
     new_o->m_value.m_digits = reinterpret_cast<mpn_digit *>(reinterpret_cast<char *>(data) - reinterpret_cast<char *>(m_begin) + reinterpret_cast<ptrdiff_t>(m_base_addr));
+    add_reloc(&new_o->m_value.m_digits, reinterpret_cast<object_offset>(new_o->m_value.m_digits));
     save(o, (lean_object*)new_o);
 #endif
 }
@@ -332,7 +353,7 @@ void object_compactor::operator()(object * o) {
         m_todo.push_back(o);
         while (!m_todo.empty()) {
             object * curr = m_todo.back();
-            if (m_obj_table.find(curr) != m_obj_table.end()) {
+            if (m_obj_table.contains(curr)) {
                 m_todo.pop_back();
                 continue;
             }
@@ -361,19 +382,40 @@ void object_compactor::operator()(object * o) {
     *static_cast<object_offset *>(m_begin) = to_offset(o);
 }
 
-compacted_region::compacted_region(size_t sz, void * data, void * base_addr, bool is_mmap, std::function<void()> free_data):
+std::vector<uint8> object_compactor::relocation_table() const {
+    std::vector<uint8> r;
+    size_t prev = 0;
+    for (size_t off : m_relocs) {
+        lean_assert(off >= prev && off % sizeof(void*) == 0);
+        size_t d = (off - prev) / sizeof(void*);
+        prev = off;
+        while (d >= 0x80) {
+            r.push_back(static_cast<uint8>(d) | 0x80);
+            d >>= 7;
+        }
+        r.push_back(static_cast<uint8>(d));
+    }
+    return r;
+}
+
+compacted_region::compacted_region(size_t sz, void * data, void * base_addr, bool is_mmap, std::function<void()> free_data,
+                                   void const * relocs, size_t relocs_sz):
     m_base_addr(base_addr),
     m_is_mmap(is_mmap),
     m_free_data(free_data),
     m_begin(data),
     m_next(data),
-    m_end(static_cast<char*>(data)+sz) {
+    m_end(static_cast<char*>(data)+sz),
+    m_relocs(static_cast<uint8 const *>(relocs)),
+    m_relocs_end(static_cast<uint8 const *>(relocs) + relocs_sz) {
 }
 
 compacted_region::compacted_region(object_compactor const & c):
     m_begin(malloc(c.size())),
     m_next(m_begin),
-    m_end(static_cast<char*>(m_begin) + c.size()) {
+    m_end(static_cast<char*>(m_begin) + c.size()),
+    m_relocs(nullptr),
+    m_relocs_end(nullptr) {
     memcpy(m_begin, c.data(), c.size());
 }
 
@@ -433,6 +475,39 @@ inline void compacted_region::fix_task(object * o) {
     move(sizeof(lean_task_object));
 }
 
+static void throw_corrupt_relocation_table() {
+    throw exception("corrupt .olean file, invalid relocation table");
+}
+
+void compacted_region::apply_relocation_table() {
+    char * begin = static_cast<char *>(m_begin);
+    size_t size = static_cast<size_t>(static_cast<char *>(m_end) - begin);
+    size_t base = reinterpret_cast<size_t>(m_base_addr);
+    size_t off = 0;
+    uint8 const * it = m_relocs;
+    while (it != m_relocs_end) {
+        size_t d = 0;
+        unsigned shift = 0;
+        uint8 b;
+        do {
+            if (it == m_relocs_end || shift >= 8 * sizeof(size_t))
+                throw_corrupt_relocation_table();
+            b = *it++;
+            d |= static_cast<size_t>(b & 0x7f) << shift;
+            shift += 7;
+        } while (b & 0x80);
+        // the patched field must lie completely inside the region
+        if (size < sizeof(void*) || d > (size - sizeof(void*) - off) / sizeof(void*))
+            throw_corrupt_relocation_table();
+        off += d * sizeof(void*);
+        char ** field = reinterpret_cast<char **>(begin + off);
+        size_t ptr = reinterpret_cast<size_t>(*field);
+        if (ptr < base || ptr - base >= size)
+            throw_corrupt_relocation_table();
+        *field = begin + (ptr - base);
+    }
+}
+
 void compacted_region::fix_mpz(object * o) {
 #ifdef LEAN_USE_GMP
     __mpz_struct & m = to_mpz(o)->m_value.m_val[0];
@@ -457,6 +532,13 @@ object * compacted_region::read() {
     }
     lean_assert(!m_is_mmap);
 
+    if (m_relocs) {
+        // we know where all pointers are, no need to parse the objects
+        apply_relocation_table();
+        m_next = m_end;
+        return root;
+    }
+
     while (m_next < m_end) {
         object * curr = reinterpret_cast<object*>(m_next);
         uint8 tag = lean_ptr_tag(curr);
@@ -7,8 +7,8 @@ Author: Leonardo de Moura
 #pragma once
 #include <functional>
 #include <vector>
-#include <unordered_map>
 #include "runtime/object.h"
+#include "runtime/flat_hash_map.h"
 
 namespace lean {
 typedef lean_object * object_offset;
@@ -17,10 +17,15 @@ class LEAN_EXPORT object_compactor {
     struct max_sharing_table;
     friend struct max_sharing_hash;
     friend struct max_sharing_eq;
-    std::unordered_map<object*, object_offset, std::hash<object*>, std::equal_to<object*>> m_obj_table;
+    struct object_ptr_hash {
+        uint64 operator()(object * o) const { return reinterpret_cast<size_t>(o) / sizeof(void*); }
+    };
+    flat_hash_map<object*, object_offset, object_ptr_hash> m_obj_table;
     std::unique_ptr<max_sharing_table> m_max_sharing_table;
     std::vector<object*> m_todo;
     std::vector<object_offset> m_tmp;
+    // Offsets (relative to `m_begin`) of all pointer fields written so far, in increasing order
+    std::vector<size_t> m_relocs;
     // On-disk base address used for `mmap`ing compacted regions without relocations
     // References within the compacted region are rewritten by subtracting `m_begin` and adding `m_base_addr`
     // In the simplest case `base_addr == nullptr`, we get region-relative pointers
@@ -32,6 +37,7 @@ class LEAN_EXPORT object_compactor {
     void save(object * o, object * new_o);
     void save_max_sharing(object * o, object * new_o, size_t new_o_sz);
     void * alloc(size_t sz);
+    void add_reloc(void * field, object_offset v);
     object_offset to_offset(object * o);
     void insert_terminator(object * o);
     object * copy_object(object * o);
@@ -53,6 +59,9 @@ public:
     void operator()(object * o);
     size_t size() const { return static_cast<char*>(m_end) - static_cast<char*>(m_begin); }
     void const * data() const { return m_begin; }
+    /* Returns the relocation table of the compacted region: the offsets of all pointer fields except for the root,
+       as LEB128-encoded word differences to the previous offset. */
+    std::vector<uint8> relocation_table() const;
 };
 
 class LEAN_EXPORT compacted_region {
@@ -63,6 +72,9 @@ class LEAN_EXPORT compacted_region {
     void * m_begin;
     void * m_next;
     void * m_end;
+    // see `object_compactor::relocation_table`, may be `nullptr`
+    uint8 const * m_relocs;
+    uint8 const * m_relocs_end;
     void move(size_t d);
     void move(object * o);
     object * fix_object_ptr(object * o);
@@ -72,10 +84,13 @@ class LEAN_EXPORT compacted_region {
     void fix_ref(object * o);
     void fix_task(object * o);
     void fix_mpz(object * o);
+    void apply_relocation_table();
 public:
     /* Creates a compacted object region using the given region in memory.
-       This object takes ownership of the region. */
-    compacted_region(size_t sz, void * data, void * base_addr, bool is_mmap, std::function<void()> free_data);
+       This object takes ownership of the region. If a relocation table of `relocs_sz` bytes is given, it must stay
+       valid until `read` has been called, and relocation only touches the fields listed in it. */
+    compacted_region(size_t sz, void * data, void * base_addr, bool is_mmap, std::function<void()> free_data,
+                     void const * relocs = nullptr, size_t relocs_sz = 0);
     /* Creates a compacted object region using the object_compactor current state.
        It creates a copy of the compacted region generated by the object compactor. */
     explicit compacted_region(object_compactor const & c);
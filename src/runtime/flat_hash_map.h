@@ -0,0 +1,146 @@
+/*
+Copyright (c) 2024 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <functional>
+#include <cstdint>
+#include "runtime/debug.h"
+#include "runtime/int64.h"
+
+namespace lean {
+/**
+    \brief Insert-only hash table using open addressing with linear probing.
+
+    Entries are stored densely in insertion order, and the probe array only contains
+    their indices together with 32 bits of their hash code. So probing touches a single
+    cache line in most cases, the key equality predicate is only invoked on (likely)
+    matches, and `clear` does not have to destroy entries scattered over a large array.
+
+    `KeyOf` projects an entry to its key. See `flat_hash_set` and `flat_hash_map` below.
+    Pointers to entries are invalidated by `insert`. */
+template<typename Entry, typename Key, typename KeyOf, typename Hash, typename Eq>
+class flat_hash_table {
+    struct slot {
+        uint32_t m_tag;
+        // index into `m_entries` plus one, `0` for empty slots
+        uint32_t m_idx;
+    };
+    std::vector<Entry> m_entries;
+    std::vector<slot>  m_slots;
+    unsigned           m_shift;
+    Hash               m_hash;
+    Eq                 m_eq;
+
+    static uint64 mix(uint64 h) { return h * 0x9E3779B97F4A7C15ull; }
+    static uint32_t tag_of(uint64 h) { return static_cast<uint32_t>(h); }
+    size_t home(uint64 h) const { return static_cast<size_t>(h >> m_shift); }
+    size_t mask() const { return m_slots.size() - 1; }
+
+    void init_slots(size_t capacity) {
+        unsigned log = 3;
+        while ((static_cast<size_t>(1) << log) < capacity) log++;
+        m_slots.assign(static_cast<size_t>(1) << log, slot{0, 0});
+        m_shift = 64 - log;
+    }
+
+    void grow() {
+        init_slots(m_slots.size() * 2);
+        for (size_t i = 0; i < m_entries.size(); i++) {
+            uint64 h = mix(m_hash(KeyOf()(m_entries[i])));
+            size_t j = home(h);
+            while (m_slots[j].m_idx != 0)
+                j = (j + 1) & mask();
+            m_slots[j] = slot{tag_of(h), static_cast<uint32_t>(i + 1)};
+        }
+    }
+
+    /* Return the slot containing `k` or the empty slot it would be inserted at. */
+    size_t find_slot(Key const & k, uint64 h) const {
+        uint32_t tag = tag_of(h);
+        size_t j   = home(h);
+        while (true) {
+            slot const & s = m_slots[j];
+            if (s.m_idx == 0 || (s.m_tag == tag && m_eq(KeyOf()(m_entries[s.m_idx - 1]), k)))
+                return j;
+            j = (j + 1) & mask();
+        }
+    }
+
+public:
+    typedef typename std::vector<Entry>::const_iterator const_iterator;
+
+    explicit flat_hash_table(size_t capacity = 8, Hash const & h = Hash(), Eq const & eq = Eq()):
+        m_hash(h), m_eq(eq) {
+        init_slots(capacity * 2);
+    }
+
+    size_t size() const { return m_entries.size(); }
+    bool empty() const { return m_entries.empty(); }
+
+    void clear() {
+        if (8 * m_entries.size() < m_slots.size()) {
+            /* Only reset the slots in use. We visit the entries in reverse insertion order,
+               so the probe sequence for each entry is still intact when we look up its slot. */
+            for (size_t i = m_entries.size(); i > 0; i--) {
+                Key const & k = KeyOf()(m_entries[i - 1]);
+                m_slots[find_slot(k, mix(m_hash(k)))] = slot{0, 0};
+            }
+        } else {
+            std::fill(m_slots.begin(), m_slots.end(), slot{0, 0});
+        }
+        m_entries.clear();
+    }
+
+    Entry const * find(Key const & k) const {
+        size_t j = find_slot(k, mix(m_hash(k)));
+        return m_slots[j].m_idx == 0 ? nullptr : &m_entries[m_slots[j].m_idx - 1];
+    }
+
+    Entry * find(Key const & k) {
+        return const_cast<Entry *>(static_cast<flat_hash_table const *>(this)->find(k));
+    }
+
+    bool contains(Key const & k) const { return find(k) != nullptr; }
+
+    /* Insert `e` unless there already is an entry with the same key. Return the entry in the table and
+       whether it was inserted. */
+    std::pair<Entry *, bool> insert(Entry const & e) {
+        Key const & k = KeyOf()(e);
+        uint64 h = mix(m_hash(k));
+        size_t j = find_slot(k, h);
+        if (m_slots[j].m_idx != 0)
+            return std::make_pair(&m_entries[m_slots[j].m_idx - 1], false);
+        // keep the load factor below 3/4
+        if (4 * (m_entries.size() + 1) > 3 * m_slots.size()) {
+            grow();
+            j = find_slot(k, h);
+        }
+        m_entries.push_back(e);
+        m_slots[j] = slot{tag_of(h), static_cast<uint32_t>(m_entries.size())};
+        return std::make_pair(&m_entries.back(), true);
+    }
+
+    const_iterator begin() const { return m_entries.begin(); }
+    const_iterator end() const { return m_entries.end(); }
+};
+
+template<typename T>
+struct flat_hash_identity {
+    T const & operator()(T const & e) const { return e; }
+};
+
+template<typename K, typename V>
+struct flat_hash_first {
+    K const & operator()(std::pair<K, V> const & e) const { return e.first; }
+};
+
+template<typename Key, typename Hash = std::hash<Key>, typename Eq = std::equal_to<Key>>
+using flat_hash_set = flat_hash_table<Key, Key, flat_hash_identity<Key>, Hash, Eq>;
+
+template<typename Key, typename Value, typename Hash = std::hash<Key>, typename Eq = std::equal_to<Key>>
+using flat_hash_map = flat_hash_table<std::pair<Key, Value>, Key, flat_hash_first<Key, Value>, Hash, Eq>;
+}
@@ -639,6 +639,60 @@ extern "C" LEAN_EXPORT obj_res lean_io_get_num_heartbeats(obj_arg /* w */) {
     return io_result_mk_ok(lean_uint64_to_nat(get_num_heartbeats()));
 }
 
+/* getAllocStats : BaseIO AllocStats */
+extern "C" LEAN_EXPORT obj_res lean_io_get_alloc_stats(obj_arg /* w */) {
+    lean_small_alloc_stats s;
+    lean_get_small_alloc_stats(&s);
+    object * slots = lean_mk_empty_array();
+    for (unsigned i = 0; i < LEAN_NUM_SMALL_SLOTS; i++) {
+        if (s.m_slot_pages[i] == 0 && s.m_slot_used[i] == 0 && s.m_slot_free[i] == 0)
+            continue;
+        object * slot = alloc_cnstr(0, 4, 0);
+        cnstr_set(slot, 0, lean_usize_to_nat((i + 1) * LEAN_OBJECT_SIZE_DELTA));
+        cnstr_set(slot, 1, lean_uint64_to_nat(s.m_slot_pages[i]));
+        cnstr_set(slot, 2, lean_uint64_to_nat(s.m_slot_used[i]));
+        cnstr_set(slot, 3, lean_uint64_to_nat(s.m_slot_free[i]));
+        slots = lean_array_push(slots, slot);
+    }
+    object * r = alloc_cnstr(0, 9, 0);
+    cnstr_set(r, 0, lean_uint64_to_nat(s.m_num_heaps));
+    cnstr_set(r, 1, lean_uint64_to_nat(s.m_num_segments));
+    cnstr_set(r, 2, lean_uint64_to_nat(s.m_num_pages));
+    cnstr_set(r, 3, lean_uint64_to_nat(s.m_num_recycled_pages));
+    cnstr_set(r, 4, lean_uint64_to_nat(s.m_num_exports));
+    cnstr_set(r, 5, lean_uint64_to_nat(s.m_num_exported_objs));
+    cnstr_set(r, 6, lean_uint64_to_nat(s.m_num_imported_objs));
+    cnstr_set(r, 7, lean_uint64_to_nat(s.m_num_released_segments));
+    cnstr_set(r, 8, slots);
+    return io_result_mk_ok(r);
+}
+
+/* releaseFreeMemory : BaseIO Nat */
+extern "C" LEAN_EXPORT obj_res lean_io_release_free_memory(obj_arg /* w */) {
+    return io_result_mk_ok(lean_usize_to_nat(lean_release_free_segments()));
+}
+
+/* setBackgroundDealloc (threshold : Nat) (maxQueue : Nat) : BaseIO Unit */
+extern "C" LEAN_EXPORT obj_res lean_io_set_bg_dealloc(b_obj_arg threshold, b_obj_arg max_queue, obj_arg /* w */) {
+    size_t t = lean_is_scalar(threshold) ? lean_unbox(threshold) : SIZE_MAX;
+    unsigned q = lean_is_scalar(max_queue) && lean_unbox(max_queue) < UINT_MAX ? lean_unbox(max_queue) : UINT_MAX;
+    lean_set_bg_dealloc(t, q);
+    return io_result_mk_ok(box(0));
+}
+
+/* getBgDeallocStats : BaseIO BgDeallocStats */
+extern "C" LEAN_EXPORT obj_res lean_io_get_bg_dealloc_stats(obj_arg /* w */) {
+    lean_bg_dealloc_stats s;
+    lean_get_bg_dealloc_stats(&s);
+    object * r = alloc_cnstr(0, 5, 0);
+    cnstr_set(r, 0, lean_uint64_to_nat(s.m_num_handoffs));
+    cnstr_set(r, 1, lean_uint64_to_nat(s.m_num_freed_objs));
+    cnstr_set(r, 2, lean_uint64_to_nat(s.m_num_rejected));
+    cnstr_set(r, 3, lean_uint64_to_nat(s.m_queue_depth));
+    cnstr_set(r, 4, lean_uint64_to_nat(s.m_max_queue_depth));
+    return io_result_mk_ok(r);
+}
+
 extern "C" LEAN_EXPORT obj_res lean_io_getenv(b_obj_arg env_var, obj_arg) {
 #if defined(LEAN_EMSCRIPTEN)
     // HACK(WN): getenv doesn't seem to work in Emscripten even though it should
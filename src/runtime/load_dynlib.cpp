@@ -4,6 +4,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura, Mac Malone
 */
+#include <atomic>
 #include "runtime/io.h"
 #include "runtime/object.h"
 #include "runtime/sstream.h"
@@ -17,6 +18,12 @@ Author: Leonardo de Moura, Mac Malone
 #endif
 
 namespace lean {
+static std::atomic<unsigned> g_num_loaded_dynlibs(0);
+
+unsigned get_num_loaded_dynlibs() {
+    return g_num_loaded_dynlibs.load();
+}
+
 void load_dynlib(std::string path) {
 #ifdef LEAN_WINDOWS
     HMODULE h = LoadLibrary(path.c_str());
@@ -29,6 +36,7 @@ void load_dynlib(std::string path) {
         throw exception(sstream() << "error loading library, " << dlerror());
     }
 #endif
+    g_num_loaded_dynlibs++;
     // NOTE: we never unload libraries
 }
 
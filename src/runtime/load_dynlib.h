@@ -9,4 +9,7 @@ Author: Mac Malone
 
 namespace lean {
 LEAN_EXPORT void load_dynlib(std::string path);
+/** \brief Number of libraries loaded via `load_dynlib` so far. Symbol lookups that failed before may succeed after
+    this number has changed. */
+LEAN_EXPORT unsigned get_num_loaded_dynlibs();
 }
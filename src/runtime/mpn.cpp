@@ -17,6 +17,7 @@ Revision History:
 
 --*/
 #include <stdint.h>
+#include <vector>
 #include "runtime/mpn.h"
 #include "runtime/debug.h"
 #include "runtime/buffer.h"
@@ -86,17 +87,102 @@ void mpn_sub(mpn_digit const * a, size_t const lnga,
     }
 }
 
-void mpn_mul(mpn_digit const * a, size_t const lnga,
-             mpn_digit const * b, size_t const lngb,
-             mpn_digit * c) {
+#define DIGIT_BITS (sizeof(mpn_digit)*8)
+#define HALF_BITS (sizeof(mpn_digit)*4)
+
+/* Operand sizes (in digits) from which Karatsuba and Toom-3 multiplication are used, respectively. */
+#define KARATSUBA_THRESHOLD 32
+#define TOOM3_THRESHOLD 300
+/* Quotient size (in digits) from which divide-and-conquer division is used. */
+#define DC_DIV_THRESHOLD 40
+/* Operand size (in digits) from which `mpn_to_string` splits the number using powers of 10. */
+#define DC_TO_STRING_THRESHOLD 20
+
+class  mpn_buffer : public buffer<mpn_digit> {
+public:
+    mpn_buffer() : buffer<mpn_digit>() {}
+
+    mpn_buffer(size_t nsz, const mpn_digit & elem = 0):buffer<mpn_digit>() {
+        resize(nsz, elem);
+    }
+
+    void resize(size_t nsz, const mpn_digit & elem = 0) {
+        buffer<mpn_digit>::resize(static_cast<unsigned>(nsz), elem);
+    }
+
+    mpn_digit & operator[](size_t idx) {
+        return buffer<mpn_digit>::operator[](static_cast<unsigned>(idx));
+    }
+
+    const mpn_digit & operator[](size_t idx) const {
+        return buffer<mpn_digit>::operator[](static_cast<unsigned>(idx));
+    }
+};
+
+// r[0..n) := a[0..n) + b[0..n), returns the carry. `r` may be `a` or `b`.
+static mpn_digit add_n(mpn_digit * r, mpn_digit const * a, mpn_digit const * b, size_t n) {
+    mpn_double_digit k = 0;
+    for (size_t i = 0; i < n; i++) {
+        k += (mpn_double_digit)a[i] + (mpn_double_digit)b[i];
+        r[i] = (mpn_digit)k;
+        k >>= DIGIT_BITS;
+    }
+    return (mpn_digit)k;
+}
+
+// r[0..n) := a[0..n) - b[0..n), returns the borrow. `r` may be `a` or `b`.
+static mpn_digit sub_n(mpn_digit * r, mpn_digit const * a, mpn_digit const * b, size_t n) {
+    mpn_digit k = 0;
+    for (size_t i = 0; i < n; i++) {
+        mpn_double_digit t = (mpn_double_digit)a[i] - (mpn_double_digit)b[i] - (mpn_double_digit)k;
+        r[i] = (mpn_digit)t;
+        k = (t >> DIGIT_BITS) & 1;
+    }
+    return k;
+}
+
+// r[0..m) += a[0..n) where n <= m, returns the carry.
+static mpn_digit add_to(mpn_digit * r, size_t m, mpn_digit const * a, size_t n) {
+    lean_assert(n <= m);
+    mpn_digit k = add_n(r, r, a, n);
+    for (size_t i = n; i < m && k; i++) {
+        r[i] += k;
+        k = r[i] == 0;
+    }
+    return k;
+}
+
+// r[0..m) -= a[0..n) where n <= m, returns the borrow.
+static mpn_digit sub_from(mpn_digit * r, size_t m, mpn_digit const * a, size_t n) {
+    lean_assert(n <= m);
+    mpn_digit k = sub_n(r, r, a, n);
+    for (size_t i = n; i < m && k; i++) {
+        k = r[i] == 0;
+        r[i]--;
+    }
+    return k;
+}
+
+static int compare_n(mpn_digit const * a, mpn_digit const * b, size_t n) {
+    for (size_t i = n; i-- > 0; ) {
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static size_t normalized_size(mpn_digit const * a, size_t n) {
+    while (n > 1 && a[n-1] == 0) n--;
+    return n;
+}
+
+static void mul_basecase(mpn_digit const * a, size_t const lnga,
+                         mpn_digit const * b, size_t const lngb,
+                         mpn_digit * c) {
     // Essentially Knuth's Algorithm M.
-    // Perhaps implement a more efficient version, see e.g., Knuth, Section 4.3.3.
     size_t i;
     mpn_digit k;
 
-#define DIGIT_BITS (sizeof(mpn_digit)*8)
-#define HALF_BITS (sizeof(mpn_digit)*4)
-
     for (unsigned i = 0; i < lnga; i++)
         c[i] = 0;
 
@@ -122,31 +208,205 @@ void mpn_mul(mpn_digit const * a, size_t const lnga,
     }
 }
 
-#define MASK_FIRST (~((mpn_digit)(-1) >> 1))
-#define FIRST_BITS(N, X) ((X) >> (DIGIT_BITS-(N)))
-#define LAST_BITS(N, X) (((X) << (DIGIT_BITS-(N))) >> (DIGIT_BITS-(N)))
-#define BASE ((mpn_double_digit)0x01 << DIGIT_BITS)
+static void mul_n(mpn_digit const * a, mpn_digit const * b, size_t n, mpn_digit * c);
 
-class  mpn_buffer : public buffer<mpn_digit> {
-public:
-    mpn_buffer() : buffer<mpn_digit>() {}
+/* Signed number used for the intermediate values of Toom-3 multiplication. */
+struct toom_value {
+    bool       m_neg{false};
+    mpn_buffer m_digits;
 
-    mpn_buffer(size_t nsz, const mpn_digit & elem = 0):buffer<mpn_digit>() {
-        for (size_t i = 0; i < nsz; i++) push_back(elem);
+    toom_value() {}
+    toom_value(mpn_digit const * a, size_t n):m_digits(n) {
+        for (size_t i = 0; i < n; i++)
+            m_digits[i] = a[i];
+        trim();
     }
+    size_t size() const { return m_digits.size(); }
+    mpn_digit const * data() const { return m_digits.data(); }
+    void trim() {
+        size_t n = normalized_size(m_digits.data(), m_digits.size());
+        m_digits.shrink(static_cast<unsigned>(n));
+        if (n == 1 && m_digits[0] == 0)
+            m_neg = false;
+    }
+};
 
-    void resize(size_t nsz, const mpn_digit & elem = 0) {
-        buffer<mpn_digit>::resize(static_cast<unsigned>(nsz), elem);
+// r := a + (neg_b ? -b : b)
+static void toom_add(toom_value & r, toom_value const & a, toom_value const & b, bool neg_b = false) {
+    bool b_neg = b.m_neg != neg_b;
+    size_t n = max(a.size(), b.size());
+    mpn_buffer d(n + 1);
+    if (a.m_neg == b_neg) {
+        size_t real_size;
+        mpn_add(a.data(), a.size(), b.data(), b.size(), d.data(), n + 1, &real_size);
+        r.m_neg = a.m_neg;
+    } else {
+        mpn_digit borrow;
+        if (mpn_compare(a.data(), a.size(), b.data(), b.size()) >= 0) {
+            mpn_sub(a.data(), a.size(), b.data(), b.size(), d.data(), &borrow);
+            r.m_neg = a.m_neg;
+        } else {
+            mpn_sub(b.data(), b.size(), a.data(), a.size(), d.data(), &borrow);
+            r.m_neg = b_neg;
+        }
+        lean_assert(borrow == 0);
     }
+    r.m_digits = d;
+    r.trim();
+}
 
-    mpn_digit & operator[](size_t idx) {
-        return buffer<mpn_digit>::operator[](static_cast<unsigned>(idx));
+static void toom_mul(toom_value & r, toom_value const & a, toom_value const & b) {
+    mpn_buffer d(a.size() + b.size());
+    mpn_mul(a.data(), a.size(), b.data(), b.size(), d.data());
+    r.m_neg = a.m_neg != b.m_neg;
+    r.m_digits = d;
+    r.trim();
+}
+
+static void toom_shl1(toom_value & r) {
+    mpn_digit k = 0;
+    for (size_t i = 0; i < r.size(); i++) {
+        mpn_digit d = r.m_digits[i];
+        r.m_digits[i] = (d << 1) | k;
+        k = d >> (DIGIT_BITS - 1);
     }
+    if (k)
+        r.m_digits.push_back(k);
+}
 
-    const mpn_digit & operator[](size_t idx) const {
-        return buffer<mpn_digit>::operator[](static_cast<unsigned>(idx));
+// r := r / d for d in {2, 3}, the division must be exact
+static void toom_divexact(toom_value & r, mpn_digit d) {
+    mpn_double_digit rem = 0;
+    for (size_t i = r.size(); i-- > 0; ) {
+        mpn_double_digit t = (rem << DIGIT_BITS) | r.m_digits[i];
+        r.m_digits[i] = (mpn_digit)(t / d);
+        rem = t % d;
     }
-};
+    lean_assert(rem == 0);
+    r.trim();
+}
+
+/* Toom-3 multiplication of the `n` digits of `a` and `b`: both are split into three parts, evaluated at
+   0, 1, -1, -2 and infinity, and the product is interpolated using Bodrato's sequence. */
+static void mul_toom3(mpn_digit const * a, mpn_digit const * b, size_t n, mpn_digit * c) {
+    size_t k  = (n + 2) / 3;
+    size_t k2 = n - 2*k;
+    lean_assert(k2 > 0 && k2 <= k);
+    toom_value a0(a, k), a1(a + k, k), a2(a + 2*k, k2);
+    toom_value b0(b, k), b1(b + k, k), b2(b + 2*k, k2);
+    toom_value p, a_1, a_m1, a_m2, b_1, b_m1, b_m2;
+    // a(1), a(-1), a(-2)
+    toom_add(p, a0, a2);
+    toom_add(a_1, p, a1);
+    toom_add(a_m1, p, a1, true);
+    toom_add(a_m2, a_m1, a2);
+    toom_shl1(a_m2);
+    toom_add(a_m2, a_m2, a0, true);
+    // b(1), b(-1), b(-2)
+    toom_add(p, b0, b2);
+    toom_add(b_1, p, b1);
+    toom_add(b_m1, p, b1, true);
+    toom_add(b_m2, b_m1, b2);
+    toom_shl1(b_m2);
+    toom_add(b_m2, b_m2, b0, true);
+    // r(0) and r(infinity) are stored in place
+    for (size_t i = 0; i < 2*n; i++)
+        c[i] = 0;
+    mul_n(a, b, k, c);
+    mpn_mul(a + 2*k, k2, b + 2*k, k2, c + 4*k);
+    toom_value r0(c, 2*k), r4(c + 4*k, 2*k2), r1, r2, r3, r_m1;
+    toom_mul(r1, a_1, b_1);
+    toom_mul(r_m1, a_m1, b_m1);
+    toom_mul(r3, a_m2, b_m2);
+    // interpolation
+    toom_add(r3, r3, r1, true);
+    toom_divexact(r3, 3);
+    toom_add(r1, r1, r_m1, true);
+    toom_divexact(r1, 2);
+    toom_add(r2, r_m1, r0, true);
+    toom_add(r3, r2, r3, true);
+    toom_divexact(r3, 2);
+    toom_add(r3, r3, r4);
+    toom_add(r3, r3, r4);
+    toom_add(r2, r2, r1);
+    toom_add(r2, r2, r4, true);
+    toom_add(r1, r1, r3, true);
+    lean_assert(!r1.m_neg && !r2.m_neg && !r3.m_neg);
+    // recomposition, the coefficients do not overlap the space of their higher neighbors' carries
+    toom_value const * rs[3] = { &r1, &r2, &r3 };
+    for (size_t i = 0; i < 3; i++) {
+        size_t offset = (i + 1) * k;
+        size_t len    = normalized_size(rs[i]->data(), rs[i]->size());
+        lean_assert(len <= 2*n - offset);
+        mpn_digit carry = add_to(c + offset, 2*n - offset, rs[i]->data(), len);
+        lean_assert(carry == 0);
+        (void)carry;
+    }
+}
+
+/* Karatsuba multiplication of the `n` digits of `a` and `b`, with Toom-3 for larger operands. */
+static void mul_n(mpn_digit const * a, mpn_digit const * b, size_t n, mpn_digit * c) {
+    if (n < KARATSUBA_THRESHOLD) {
+        mul_basecase(a, n, b, n, c);
+        return;
+    }
+    if (n >= TOOM3_THRESHOLD) {
+        mul_toom3(a, b, n, c);
+        return;
+    }
+    // a = a1*B^m + a0, b = b1*B^m + b0 where a0 and b0 have m digits
+    size_t m = (n + 1) / 2;
+    size_t h = n - m;
+    mul_n(a, b, m, c);
+    mul_n(a + m, b + m, h, c + 2*m);
+    // (a0 + a1)*(b0 + b1) - a0*b0 - a1*b1 = a0*b1 + a1*b0
+    mpn_buffer sa(m + 1), sb(m + 1), z1(2*m + 2);
+    for (size_t i = 0; i < m; i++) {
+        sa[i] = a[i];
+        sb[i] = b[i];
+    }
+    sa[m] = add_to(sa.data(), m, a + m, h);
+    sb[m] = add_to(sb.data(), m, b + m, h);
+    size_t lsa = normalized_size(sa.data(), m + 1);
+    size_t lsb = normalized_size(sb.data(), m + 1);
+    for (size_t i = lsa + lsb; i < 2*m + 2; i++)
+        z1[i] = 0;
+    mpn_mul(sa.data(), lsa, sb.data(), lsb, z1.data());
+    sub_from(z1.data(), 2*m + 2, c, 2*m);
+    sub_from(z1.data(), 2*m + 2, c + 2*m, 2*h);
+    size_t lz1 = normalized_size(z1.data(), 2*m + 2);
+    lean_assert(lz1 <= 2*n - m);
+    add_to(c + m, 2*n - m, z1.data(), lz1);
+}
+
+void mpn_mul(mpn_digit const * a, size_t const lnga,
+             mpn_digit const * b, size_t const lngb,
+             mpn_digit * c) {
+    if (lnga < lngb) {
+        mpn_mul(b, lngb, a, lnga, c);
+        return;
+    }
+    if (lngb < KARATSUBA_THRESHOLD) {
+        mul_basecase(a, lnga, b, lngb, c);
+    } else if (lnga == lngb) {
+        mul_n(a, b, lnga, c);
+    } else {
+        // multiply `b` with chunks of `a` of the same size
+        mpn_buffer t(2*lngb);
+        for (size_t i = 0; i < lnga + lngb; i++)
+            c[i] = 0;
+        for (size_t i = 0; i < lnga; i += lngb) {
+            size_t l = lnga - i < lngb ? lnga - i : lngb;
+            mpn_mul(a + i, l, b, lngb, t.data());
+            add_to(c + i, lnga + lngb - i, t.data(), l + lngb);
+        }
+    }
+}
+
+#define MASK_FIRST (~((mpn_digit)(-1) >> 1))
+#define FIRST_BITS(N, X) ((X) >> (DIGIT_BITS-(N)))
+#define LAST_BITS(N, X) (((X) << (DIGIT_BITS-(N))) >> (DIGIT_BITS-(N)))
+#define BASE ((mpn_double_digit)0x01 << DIGIT_BITS)
 
 static size_t div_normalize(mpn_digit const * numer, size_t const lnum,
                             mpn_digit const * denom, size_t const lden,
@@ -220,49 +480,89 @@ static void div_1(mpn_buffer & numer, mpn_digit const denom,
     }
 }
 
-static void div_n(mpn_buffer & numer, mpn_buffer const & denom,
-                  mpn_digit * quot, mpn_digit * rem,
-                  mpn_buffer & ms, mpn_buffer & ab) {
-    lean_assert(denom.size() > 1);
-
-    // This is essentially Knuth's Algorithm D.
-    size_t m = numer.size() - denom.size();
-    size_t n = denom.size();
-
-    lean_assert(numer.size() == m+n);
-
-    ms.resize(n+1);
-
-    mpn_double_digit q_hat, temp, r_hat;
-    mpn_digit borrow;
+// a[0..n) := a[0..n) - 1
+static void decrement(mpn_digit * a, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (a[i]-- != 0)
+            break;
+    }
+}
 
-    for (size_t j = m-1; j != (size_t)-1; j--) {
-        temp = (((mpn_double_digit)numer[j+n]) << DIGIT_BITS) | ((mpn_double_digit)numer[j+n-1]);
-        q_hat = temp / (mpn_double_digit) denom[n-1];
-        r_hat = temp % (mpn_double_digit) denom[n-1];
-        recheck:
-        if (q_hat >= BASE ||
-            ((q_hat * denom[n-2]) > ((r_hat << DIGIT_BITS) + numer[j+n-2]))) {
-                q_hat--;
-                r_hat += denom[n-1];
-                if (r_hat < BASE) goto recheck;
+/* Divide the `n+k` digits of `a` by the `n` digits of `b` using Knuth's Algorithm D.
+   `b` must be normalized and `a[k..n+k)` must be smaller than `b`.
+   The `k` digits of the quotient are stored in `q`, and the remainder in `a[0..n)`. */
+static void div_basecase(mpn_digit * q, mpn_digit * a, mpn_digit const * b, size_t n, size_t k) {
+    lean_assert(n > 1);
+    mpn_digit const b_top  = b[n-1];
+    mpn_digit const b_next = b[n-2];
+    for (size_t j = k; j-- > 0; ) {
+        mpn_double_digit temp  = (((mpn_double_digit)a[j+n]) << DIGIT_BITS) | ((mpn_double_digit)a[j+n-1]);
+        mpn_double_digit q_hat = temp / (mpn_double_digit) b_top;
+        mpn_double_digit r_hat = temp % (mpn_double_digit) b_top;
+        while (q_hat >= BASE || ((q_hat * b_next) > ((r_hat << DIGIT_BITS) + a[j+n-2]))) {
+            q_hat--;
+            r_hat += b_top;
+            if (r_hat >= BASE)
+                break;
         }
         lean_assert(q_hat < BASE);
-        // Replace numer[j+n]...numer[j] with
-        // numer[j+n]...numer[j] - q * (denom[n-1]...denom[0])
+        // Replace a[j+n]...a[j] with a[j+n]...a[j] - q_hat * (b[n-1]...b[0])
         mpn_digit q_hat_small = (mpn_digit)q_hat;
-        mpn_mul(&q_hat_small, 1, denom.data(), n, ms.data());
-        mpn_sub(&numer[j], n+1, ms.data(), n+1, &numer[j], &borrow);
-        quot[j] = q_hat_small;
-        if (borrow) {
-            quot[j]--;
-            ab.resize(n+2);
-            size_t real_size;
-            mpn_add(denom.data(), n, &numer[j], n+1, ab.data(), n+2, &real_size);
-            for (size_t i = 0; i < n+1; i++)
-                numer[j+i] = ab[i];
+        mpn_digit mul_carry = 0;
+        mpn_digit borrow    = 0;
+        for (size_t i = 0; i < n; i++) {
+            mpn_double_digit p = (mpn_double_digit)q_hat_small * (mpn_double_digit)b[i] + mul_carry;
+            mul_carry = (mpn_digit)(p >> DIGIT_BITS);
+            mpn_double_digit t = (mpn_double_digit)a[j+i] - (mpn_double_digit)(mpn_digit)p - borrow;
+            a[j+i] = (mpn_digit)t;
+            borrow = (t >> DIGIT_BITS) & 1;
+        }
+        mpn_double_digit t = (mpn_double_digit)a[j+n] - mul_carry - borrow;
+        a[j+n] = (mpn_digit)t;
+        if ((t >> DIGIT_BITS) & 1) {
+            q_hat_small--;
+            a[j+n] += add_n(a + j, a + j, b, n);
+        }
+        q[j] = q_hat_small;
+    }
+}
+
+/* Divide-and-conquer division with the same interface as `div_basecase`, for `k <= n`.
+   When `k == n`, the quotient is computed in two halves. Otherwise, the top `2k` digits of `a` are divided by
+   the top `k` digits of `b`, and the resulting quotient is corrected using the remaining digits of `b`. */
+static void div_dc(mpn_digit * q, mpn_digit * a, mpn_digit const * b, size_t n, size_t k) {
+    lean_assert(k <= n);
+    if (k < DC_DIV_THRESHOLD) {
+        div_basecase(q, a, b, n, k);
+        return;
+    }
+    if (k == n) {
+        size_t lo = k / 2;
+        div_dc(q + lo, a + lo, b, n, k - lo);
+        div_dc(q, a, b, n, lo);
+        return;
+    }
+    mpn_digit * a1       = a + (n - k);
+    mpn_digit const * b1 = b + (n - k);
+    int top = 0;
+    if (compare_n(a + n, b1, k) < 0) {
+        div_dc(q, a1, b1, k, k);
+    } else {
+        // a[n..n+k) == b1, so the quotient estimate is B^k - 1
+        for (size_t i = 0; i < k; i++) {
+            q[i]     = (mpn_digit)-1;
+            a[n + i] = 0;
         }
+        top = add_n(a1, a1, b1, k);
+    }
+    mpn_buffer t(n);
+    mpn_mul(q, k, b, n - k, t.data());
+    top -= sub_n(a, a, t.data(), n);
+    while (top < 0) {
+        top += add_n(a, a, b, n);
+        decrement(q, k);
     }
+    lean_assert(top == 0);
 }
 
 void mpn_div(mpn_digit const * numer, size_t const lnum,
@@ -296,12 +596,19 @@ void mpn_div(mpn_digit const * numer, size_t const lnum,
             rem[i] = (i < lnum) ? numer[i] : 0;
     }
     else  {
-        mpn_buffer u, v, t_ms, t_ab;
+        mpn_buffer u, v;
         size_t d = div_normalize(numer, lnum, denom, lden, u, v);
-        if (lden == 1)
+        if (lden == 1) {
             div_1(u, v[0], quot);
-        else
-            div_n(u, v, quot, rem, t_ms, t_ab);
+        } else {
+            // compute the quotient in blocks of at most `lden` digits, starting with the most significant ones
+            size_t j = lnum - lden + 1;
+            while (j > 0) {
+                size_t k = j < lden ? j : lden;
+                j -= k;
+                div_dc(quot + j, u.data() + j, v.data(), lden, k);
+            }
+        }
         div_unnormalize(u, v, d, rem);
     }
 
@@ -318,6 +625,53 @@ void mpn_div(mpn_digit const * numer, size_t const lnum,
 #endif
 }
 
+#define CHUNK_BASE 1000000000u
+#define CHUNK_DIGITS 9
+
+/* Append the base 10^9 digits of `a[0..lng)` to `chunks`, least significant first and padded with zeros to
+   at least `min_chunks` digits. `pows[i]` is 10^(9*2^i); large numbers are split by the largest of these
+   powers that has at most half their size, which makes the conversion subquadratic. */
+static void to_chunks(mpn_digit const * a, size_t lng, std::vector<mpn_buffer> & pows,
+                      size_t min_chunks, std::vector<mpn_digit> & chunks) {
+    lng = normalized_size(a, lng);
+    size_t start = chunks.size();
+    if (lng < DC_TO_STRING_THRESHOLD) {
+        mpn_buffer temp(lng);
+        for (size_t i = 0; i < lng; i++)
+            temp[i] = a[i];
+        while (lng > 1 || temp[0] != 0) {
+            mpn_double_digit r = 0;
+            for (size_t i = lng; i-- > 0; ) {
+                mpn_double_digit t = (r << DIGIT_BITS) | temp[i];
+                temp[i] = (mpn_digit)(t / CHUNK_BASE);
+                r = t % CHUNK_BASE;
+            }
+            chunks.push_back((mpn_digit)r);
+            if (temp[lng-1] == 0 && lng > 1)
+                lng--;
+        }
+    } else {
+        while (2 * pows.back().size() <= lng + 1) {
+            mpn_buffer const & p = pows.back();
+            mpn_buffer sq(2 * p.size());
+            mpn_mul(p.data(), p.size(), p.data(), p.size(), sq.data());
+            sq.shrink(normalized_size(sq.data(), sq.size()));
+            pows.push_back(sq);
+        }
+        size_t i = pows.size() - 1;
+        while (2 * pows[i].size() > lng + 1)
+            i--;
+        mpn_buffer const & p = pows[i];
+        mpn_buffer q(lng - p.size() + 1), r(p.size());
+        mpn_div(a, lng, p.data(), p.size(), q.data(), r.data());
+        size_t low_chunks = (size_t)1 << i;
+        to_chunks(r.data(), r.size(), pows, low_chunks, chunks);
+        to_chunks(q.data(), q.size(), pows, min_chunks > low_chunks ? min_chunks - low_chunks : 0, chunks);
+    }
+    while (chunks.size() - start < min_chunks)
+        chunks.push_back(0);
+}
+
 char * mpn_to_string(mpn_digit const * a, size_t const lng, char * buf, size_t const lbuf) {
     lean_assert(buf && lbuf > 0);
 
@@ -329,27 +683,26 @@ char * mpn_to_string(mpn_digit const * a, size_t const lng, char * buf, size_t c
 #endif
     }
     else {
-        mpn_buffer temp(lng, 0), t_numer(lng+1, 0), t_denom(1, 0);
-        for (unsigned i = 0; i < lng; i++)
-            temp[i] = a[i];
-
-        size_t j = 0;
-        mpn_digit rem;
-        mpn_digit ten = 10;
-        while (!temp.empty() && (temp.size() > 1 || temp[0] != 0)) {
-            size_t d = div_normalize(&temp[0], temp.size(), &ten, 1, t_numer, t_denom);
-            div_1(t_numer, t_denom[0], &temp[0]);
-            div_unnormalize(t_numer, t_denom, d, &rem);
-            buf[j++] = '0' + rem;
-            while (!temp.empty() && temp.back() == 0)
-                temp.pop_back();
+        std::vector<mpn_buffer> pows;
+        pows.push_back(mpn_buffer(1, CHUNK_BASE));
+        std::vector<mpn_digit> chunks;
+        to_chunks(a, lng, pows, 1, chunks);
+        while (chunks.size() > 1 && chunks.back() == 0)
+            chunks.pop_back();
+#ifdef _WINDOWS
+        size_t j = sprintf_s(buf, lbuf, "%u", chunks.back());
+#else
+        size_t j = snprintf(buf, lbuf, "%u", chunks.back());
+#endif
+        for (size_t i = chunks.size() - 1; i-- > 0 && j + CHUNK_DIGITS < lbuf; ) {
+            mpn_digit c = chunks[i];
+            for (size_t l = CHUNK_DIGITS; l-- > 0; ) {
+                buf[j + l] = '0' + c % 10;
+                c /= 10;
+            }
+            j += CHUNK_DIGITS;
         }
         buf[j] = 0;
-
-        j--;
-        size_t mid = (j/2) + ((j % 2) ? 1 : 0);
-        for (size_t i = 0; i < mid; i++)
-            std::swap(buf[i], buf[j-i]);
     }
     return buf;
 }
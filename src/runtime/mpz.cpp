@@ -785,14 +785,19 @@ mpz mpz::emod(mpz const & n, mpz const & d) {
 }
 
 mpz mpz::pow(unsigned int p) const {
-    unsigned mask = 1;
-    mpz power(*this);
+    // left-to-right binary exponentiation: unlike the right-to-left variant, it never squares
+    // a value that is larger than the result
     mpz result(1);
-    while (mask <= p) {
+    if (p == 0)
+        return result;
+    unsigned mask = 1u << (sizeof(unsigned) * 8 - 1);
+    while ((mask & p) == 0)
+        mask >>= 1;
+    result = *this;
+    for (mask >>= 1; mask != 0; mask >>= 1) {
+        result *= result;
         if (mask & p)
-            result *= power;
-        power *= power;
-        mask = mask << 1;
+            result *= *this;
     }
     return result;
 }
@@ -965,8 +970,7 @@ uint64 mpz::mod64() const {
 }
 
 void power(mpz & a, mpz const & b, unsigned k) {
-    a = b;
-    a.pow(k);
+    a = b.pow(k);
 }
 
 void gcd(mpz & g, mpz const & a, mpz const & b) {
@@ -9,6 +9,7 @@ Author: Leonardo de Moura
 #include <vector>
 #include <deque>
 #include <cmath>
+#include <cstring>
 #include <lean/lean.h>
 #include "runtime/object.h"
 #include "runtime/thread.h"
@@ -44,6 +45,13 @@ Author: Leonardo de Moura
 // see `Task.Priority.max`
 #define LEAN_MAX_PRIO 8
 
+/* Node in the list of threads blocked on a task. `IO.waitAny` allocates one node per task,
+   all of them pointing to the same condition variable. */
+struct lean_task_waiter {
+    lean::condition_variable * m_cv;
+    lean_task_waiter *         m_next;
+};
+
 namespace lean {
 
 static void abort_on_panic() {
@@ -220,11 +228,35 @@ static inline void dec(lean_object * o, lean_object* & todo) {
     }
 }
 
+#if defined(LEAN_MULTI_THREAD) && !defined(LEAN_LAZY_RC)
+#define LEAN_BG_DEALLOC
+/* Worklists used when background deallocation is enabled. Single-threaded and multi-threaded objects are kept
+   apart since the RC field of an object on a worklist has been overwritten. */
+struct bg_todo {
+    lean_object * m_st{nullptr};
+    lean_object * m_mt{nullptr};
+};
+
+static inline void dec(lean_object * o, bg_todo & todo) {
+    if (lean_is_scalar(o))
+        return;
+    if (LEAN_LIKELY(o->m_rc > 1)) {
+        o->m_rc--;
+    } else if (o->m_rc == 1) {
+        push_back(todo.m_st, o);
+    } else if (o->m_rc == 0) {
+        return;
+    } else if (std::atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), 1, std::memory_order_acq_rel) == -1) {
+        push_back(todo.m_mt, o);
+    }
+}
+#endif
+
 #ifdef LEAN_LAZY_RC
 LEAN_THREAD_PTR(object, g_to_free);
 #endif
 
-static void lean_del_core(object * o, object * & todo);
+template<typename Todo> static void lean_del_core(object * o, Todo & todo);
 
 extern "C" LEAN_EXPORT lean_object * lean_alloc_object(size_t sz) {
 #ifdef LEAN_LAZY_RC
@@ -244,7 +276,7 @@ extern "C" LEAN_EXPORT lean_object * lean_alloc_object(size_t sz) {
 
 static void deactivate_task(lean_task_object * t);
 
-static void lean_del_core(object * o, object * & todo) {
+template<typename Todo> static void lean_del_core(object * o, Todo & todo) {
     uint8 tag = lean_ptr_tag(o);
     if (tag <= LeanMaxCtorTag) {
         object ** it  = lean_ctor_obj_cptr(o);
@@ -299,11 +331,154 @@ static void lean_del_core(object * o, object * & todo) {
     }
 }
 
+#ifdef LEAN_BG_DEALLOC
+/* Background deallocation: `lean_dec_ref_cold` frees at most `g_bg_dealloc_threshold` objects of a dead object graph
+   and hands the multi-threaded objects still on its worklist to a reclaimer thread. Their children are multi-threaded
+   or persistent as well, so the reclaimer does not race with the releasing thread. Single-threaded objects may share
+   children with live objects of the releasing thread and are always freed by it. If `g_bg_dealloc_max_queue`
+   worklists are already waiting, the releasing thread frees the rest itself. */
+static atomic<size_t>   g_bg_dealloc_threshold(0);
+static atomic<unsigned> g_bg_dealloc_max_queue(16);
+
+class reclaimer {
+    mutex                   m_mutex;
+    condition_variable      m_queue_cv;
+    std::vector<object *>   m_queue;
+    std::unique_ptr<lthread> m_thread;
+    bool                    m_shutting_down{false};
+    uint64_t                m_num_handoffs{0};
+    uint64_t                m_num_rejected{0};
+    uint64_t                m_max_queue_depth{0};
+    /* updated by the reclaimer thread without holding `m_mutex` */
+    atomic<uint64_t>        m_num_freed_objs{0};
+
+    void run() {
+        save_stack_info(false);
+        unique_lock<mutex> lock(m_mutex);
+        while (true) {
+            if (m_queue.empty()) {
+                if (m_shutting_down)
+                    break;
+                m_queue_cv.wait(lock);
+                continue;
+            }
+            object * todo = m_queue.back();
+            m_queue.pop_back();
+            lock.unlock();
+            uint64_t n = 0;
+            while (todo != nullptr) {
+                object * o = pop_back(todo);
+                lean_del_core(o, todo);
+                n++;
+            }
+            m_num_freed_objs += n;
+            /* objects of other heaps would otherwise wait for the next worklist before being returned */
+            export_freed_objs();
+            lock.lock();
+        }
+    }
+
+public:
+    /* Take ownership of the worklist `todo` unless the queue is full. */
+    bool push(object * todo) {
+        unique_lock<mutex> lock(m_mutex);
+        if (m_shutting_down || m_queue.size() >= g_bg_dealloc_max_queue) {
+            m_num_rejected++;
+            return false;
+        }
+        if (!m_thread)
+            m_thread.reset(new lthread([this]() { run(); }));
+        m_queue.push_back(todo);
+        m_max_queue_depth = std::max<uint64_t>(m_max_queue_depth, m_queue.size());
+        m_num_handoffs++;
+        m_queue_cv.notify_one();
+        return true;
+    }
+
+    void get_stats(lean_bg_dealloc_stats * r) {
+        unique_lock<mutex> lock(m_mutex);
+        r->m_num_handoffs    = m_num_handoffs;
+        r->m_num_rejected    = m_num_rejected;
+        r->m_num_freed_objs  = m_num_freed_objs;
+        r->m_queue_depth     = m_queue.size();
+        r->m_max_queue_depth = m_max_queue_depth;
+    }
+
+    /* Free the remaining worklists and stop the thread. Later worklists are freed by the releasing threads. */
+    void shutdown() {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_shutting_down = true;
+            m_queue_cv.notify_one();
+        }
+        if (m_thread) {
+            m_thread->join();
+            m_thread.reset();
+        }
+    }
+};
+
+static reclaimer * g_reclaimer = nullptr;
+
+/* Freeing a task deactivates it in the task manager, so the reclaimer must be done before the task manager is
+   deleted. */
+static void shutdown_reclaimer() {
+    g_bg_dealloc_threshold = 0;
+    g_reclaimer->shutdown();
+}
+
+static void lean_del_bg(object * o) {
+    bg_todo todo;
+    if (o->m_rc == 1)
+        push_back(todo.m_st, o);
+    else
+        push_back(todo.m_mt, o);
+    size_t threshold = g_bg_dealloc_threshold;
+    size_t n = 0;
+    while (true) {
+        if (todo.m_st != nullptr) {
+            o = pop_back(todo.m_st);
+        } else if (todo.m_mt != nullptr) {
+            if (n >= threshold) {
+                if (g_reclaimer->push(todo.m_mt))
+                    return;
+                threshold = SIZE_MAX;
+            }
+            o = pop_back(todo.m_mt);
+        } else {
+            return;
+        }
+        lean_del_core(o, todo);
+        n++;
+    }
+}
+#else
+static void shutdown_reclaimer() {}
+#endif
+
+extern "C" LEAN_EXPORT void lean_set_bg_dealloc(size_t threshold, unsigned max_queue) {
+#ifdef LEAN_BG_DEALLOC
+    g_bg_dealloc_max_queue = max_queue;
+    g_bg_dealloc_threshold = threshold;
+#endif
+}
+
+extern "C" LEAN_EXPORT void lean_get_bg_dealloc_stats(lean_bg_dealloc_stats * r) {
+    memset(r, 0, sizeof(lean_bg_dealloc_stats));
+#ifdef LEAN_BG_DEALLOC
+    g_reclaimer->get_stats(r);
+#endif
+}
+
 extern "C" LEAN_EXPORT void lean_dec_ref_cold(lean_object * o) {
     if (o->m_rc == 1 || std::atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), 1, std::memory_order_acq_rel) == -1) {
 #ifdef LEAN_LAZY_RC
         push_back(g_to_free, o);
 #else
+#ifdef LEAN_BG_DEALLOC
+        if (LEAN_UNLIKELY(g_bg_dealloc_threshold.load(std::memory_order_relaxed) > 0))
+            return lean_del_bg(o);
+#endif
         object * todo = nullptr;
         while (true) {
             lean_del_core(o, todo);
@@ -557,6 +732,7 @@ static lean_task_imp * alloc_task_imp(obj_arg c, unsigned prio, bool keep_alive)
     imp->m_closure     = c;
     imp->m_head_dep    = nullptr;
     imp->m_next_dep    = nullptr;
+    imp->m_waiters     = nullptr;
     imp->m_prio        = prio;
     imp->m_canceled    = false;
     imp->m_keep_alive  = keep_alive;
@@ -577,17 +753,121 @@ struct scoped_current_task_object : flet<lean_task_object *> {
     scoped_current_task_object(lean_task_object * t):flet(g_current_task_object, t) {}
 };
 
+/* Stored in `m_head_dep` once a task has finished or has been deactivated, no further
+   dependents can be added after that. */
+static lean_task_object * const g_closed_deps = reinterpret_cast<lean_task_object *>(static_cast<uintptr_t>(1));
+
+/* Chase-Lev work-stealing deque of tasks, see "Correct and Efficient Work-Stealing for
+   Weak Memory Models" by Le, Pop, Cohen and Zappa Nardelli.
+   Only the owner thread may invoke `push` and `pop`, any thread may invoke `steal`. */
+class task_deque {
+    struct buffer {
+        size_t                                         m_capacity;
+        std::unique_ptr<atomic<lean_task_object *>[]> m_data;
+        explicit buffer(size_t capacity):m_capacity(capacity), m_data(new atomic<lean_task_object *>[capacity]) {}
+        lean_task_object * get(int64 i) const { return m_data[i & (m_capacity - 1)].load(); }
+        void put(int64 i, lean_task_object * t) { m_data[i & (m_capacity - 1)].store(t); }
+    };
+    atomic<int64>                        m_top{0};
+    atomic<int64>                        m_bottom{0};
+    atomic<buffer *>                     m_buffer;
+    /* Thieves may still be reading from a buffer replaced by `grow`, so we only release
+       buffers when the deque itself is destroyed. */
+    std::vector<std::unique_ptr<buffer>> m_buffers;
+
+    buffer * grow(buffer * b, int64 top, int64 bottom) {
+        buffer * new_b = new buffer(2 * b->m_capacity);
+        for (int64 i = top; i < bottom; i++)
+            new_b->put(i, b->get(i));
+        m_buffers.emplace_back(new_b);
+        m_buffer.store(new_b);
+        return new_b;
+    }
+
+public:
+    task_deque() {
+        m_buffers.emplace_back(new buffer(64));
+        m_buffer.store(m_buffers.back().get());
+    }
+
+    /* Approximate, only reliable when invoked by the owner. */
+    bool empty() const { return m_bottom.load() <= m_top.load(); }
+
+    void push(lean_task_object * t) {
+        int64 bottom = m_bottom.load();
+        int64 top    = m_top.load();
+        buffer * b   = m_buffer.load();
+        if (bottom - top > static_cast<int64>(b->m_capacity) - 1)
+            b = grow(b, top, bottom);
+        b->put(bottom, t);
+        m_bottom.store(bottom + 1);
+    }
+
+    lean_task_object * pop() {
+        int64 bottom = m_bottom.load() - 1;
+        buffer * b   = m_buffer.load();
+        m_bottom.store(bottom);
+        int64 top    = m_top.load();
+        if (top > bottom) {
+            m_bottom.store(bottom + 1);
+            return nullptr;
+        }
+        lean_task_object * t = b->get(bottom);
+        if (top == bottom) {
+            /* last element, race against thieves */
+            if (!m_top.compare_exchange_strong(top, top + 1))
+                t = nullptr;
+            m_bottom.store(bottom + 1);
+        }
+        return t;
+    }
+
+    /* Return `nullptr` if the deque is empty or we lost a race against another thief or the owner. */
+    lean_task_object * steal() {
+        int64 top    = m_top.load();
+        int64 bottom = m_bottom.load();
+        if (top >= bottom)
+            return nullptr;
+        lean_task_object * t = m_buffer.load()->get(top);
+        if (!m_top.compare_exchange_strong(top, top + 1))
+            return nullptr;
+        return t;
+    }
+};
+
+class task_manager;
+
+/* Local task queues of a standard worker thread, one per priority. */
+struct task_worker {
+    task_manager * m_manager;
+    unsigned       m_idx;
+    task_deque     m_queues[LEAN_MAX_PRIO+1];
+    task_worker(task_manager * m, unsigned idx):m_manager(m), m_idx(idx) {}
+};
+
+LEAN_THREAD_PTR(task_worker, g_current_task_worker);
+
+/* Tasks spawned by standard worker threads are pushed into the worker's local deque
+   without taking `m_mutex`, idle workers steal from them. Tasks spawned by any other
+   thread and tasks of priority above `LEAN_MAX_PRIO` (dedicated workers) still go through
+   the global queues. Task state transitions (`run_task`, `resolve`, dependencies,
+   deactivation) are still protected by `m_mutex`. */
 class task_manager {
     mutex                                         m_mutex;
     std::vector<std::unique_ptr<lthread>>         m_std_workers;
-    unsigned                                      m_idle_std_workers{0};
+    /* Allocated upfront so that thieves can iterate over them without taking `m_mutex`. */
+    std::vector<std::unique_ptr<task_worker>>     m_workers;
+    atomic<unsigned>                              m_num_std_workers{0};
+    /* Number of standard workers blocked on (or about to block on) `m_queue_cv`. */
+    atomic<unsigned>                              m_sleeping_std_workers{0};
     unsigned                                      m_max_std_workers{0};
     unsigned                                      m_num_dedicated_workers{0};
     std::deque<lean_task_object *>                m_queues[LEAN_MAX_PRIO+1];
-    unsigned                                      m_queues_size{0};
-    unsigned                                      m_max_prio{0};
+    /* Modified only when holding `m_mutex`, but read without it by workers deciding whether
+       to look at the global queues. */
+    atomic<unsigned>                              m_queues_size{0};
+    atomic<unsigned>                              m_max_prio{0};
     condition_variable                            m_queue_cv;
-    condition_variable                            m_task_finished_cv;
     bool                                          m_shutting_down{false};
 
     lean_task_object * dequeue() {
@@ -598,15 +878,30 @@ class task_manager {
         q.pop_front();
         m_queues_size--;
         if (q.empty()) {
-            while (m_max_prio > 0) {
-                --m_max_prio;
-                if (!m_queues[m_max_prio].empty())
+            unsigned max_prio = m_max_prio;
+            while (max_prio > 0) {
+                --max_prio;
+                if (!m_queues[max_prio].empty())
                     break;
             }
+            m_max_prio = max_prio;
         }
         return result;
     }
 
+    task_worker * current_worker() const {
+        task_worker * w = g_current_task_worker;
+        return w && w->m_manager == this ? w : nullptr;
+    }
+
+    /* Make sure some worker will pick up a task that was pushed into a local deque. */
+    void notify_local_push_core() {
+        if (m_sleeping_std_workers > 0)
+            m_queue_cv.notify_one();
+        else if (m_num_std_workers < m_max_std_workers)
+            spawn_worker();
+    }
+
     void enqueue_core(lean_task_object * t) {
         lean_assert(t->m_imp);
         unsigned prio = t->m_imp->m_prio;
@@ -614,11 +909,16 @@ class task_manager {
             spawn_dedicated_worker(t);
             return;
         }
+        if (task_worker * w = current_worker()) {
+            w->m_queues[prio].push(t);
+            notify_local_push_core();
+            return;
+        }
         if (prio > m_max_prio)
             m_max_prio = prio;
         m_queues[prio].push_back(t);
         m_queues_size++;
-        if (!m_idle_std_workers && m_std_workers.size() < m_max_std_workers)
+        if (!m_sleeping_std_workers && m_num_std_workers < m_max_std_workers)
             spawn_worker();
         else
             m_queue_cv.notify_one();
@@ -626,12 +926,12 @@ class task_manager {
 
     void deactivate_task_core(unique_lock<mutex> & lock, lean_task_object * t) {
         object * c              = t->m_imp->m_closure;
-        lean_task_object * it   = t->m_imp->m_head_dep;
+        lean_task_object * it   = t->m_imp->m_head_dep.exchange(g_closed_deps);
         t->m_imp->m_closure     = nullptr;
-        t->m_imp->m_head_dep    = nullptr;
         t->m_imp->m_canceled    = true;
         t->m_imp->m_deleted     = true;
         lock.unlock();
+        lean_assert(it != g_closed_deps);
         while (it) {
             lean_assert(it->m_imp->m_deleted);
             lean_task_object * next_it = it->m_imp->m_next_dep;
@@ -642,30 +942,81 @@ class task_manager {
         lock.lock();
     }
 
+    /* Try to steal a task from the other workers, higher priorities first. */
+    lean_task_object * steal(task_worker & self) {
+        unsigned n = m_num_std_workers;
+        for (unsigned prio = LEAN_MAX_PRIO + 1; prio-- > 0;) {
+            for (unsigned i = 1; i < n; i++) {
+                task_worker & victim = *m_workers[(self.m_idx + i) % n];
+                if (lean_task_object * t = victim.m_queues[prio].steal())
+                    return t;
+            }
+        }
+        return nullptr;
+    }
+
+    /* Pop a task from the local deques or steal one, without looking at the global queues. */
+    lean_task_object * pop_local_or_steal(task_worker & self) {
+        for (unsigned prio = LEAN_MAX_PRIO + 1; prio-- > 0;) {
+            if (lean_task_object * t = self.m_queues[prio].pop())
+                return t;
+        }
+        return steal(self);
+    }
+
+    /* Fast path of a worker looking for its next task, `m_mutex` is only taken when the
+       global queues contain a task of higher priority than every local one. */
+    lean_task_object * next_task(task_worker & self) {
+        for (unsigned prio = LEAN_MAX_PRIO + 1; prio-- > 0;) {
+            if (self.m_queues[prio].empty())
+                continue;
+            if (m_queues_size > 0 && m_max_prio > prio)
+                break;
+            if (lean_task_object * t = self.m_queues[prio].pop())
+                return t;
+        }
+        if (m_queues_size > 0) {
+            unique_lock<mutex> lock(m_mutex);
+            if (m_queues_size > 0)
+                return dequeue();
+        }
+        return pop_local_or_steal(self);
+    }
+
     void spawn_worker() {
         if (m_shutting_down)
             return;
 
-        m_std_workers.emplace_back(new lthread([this]() {
+        task_worker * self = m_workers[m_num_std_workers].get();
+        m_num_std_workers++;
+        m_std_workers.emplace_back(new lthread([this, self]() {
             save_stack_info(false);
-            unique_lock<mutex> lock(m_mutex);
-            m_idle_std_workers++;
+            g_current_task_worker = self;
             while (true) {
-                if (m_queues_size == 0) {
-                    if (m_shutting_down) {
+                lean_task_object * t = next_task(*self);
+                unique_lock<mutex> lock(m_mutex);
+                while (!t) {
+                    if (m_queues_size > 0) {
+                        t = dequeue();
                         break;
                     }
-                    m_queue_cv.wait(lock);
-                    continue;
+                    if (m_shutting_down)
+                        break;
+                    /* Announce that we are going to sleep before checking the deques one
+                       last time, so that a concurrent `push` either is seen here or sees us. */
+                    m_sleeping_std_workers++;
+                    t = pop_local_or_steal(*self);
+                    if (!t)
+                        m_queue_cv.wait(lock);
+                    m_sleeping_std_workers--;
                 }
-
-                lean_task_object * t = dequeue();
-                m_idle_std_workers--;
+                if (!t)
+                    break;
                 run_task(lock, t);
-                m_idle_std_workers++;
+                lock.unlock();
                 reset_heartbeat();
             }
-            m_idle_std_workers--;
+            g_current_task_worker = nullptr;
         }));
     }
 
@@ -725,16 +1076,20 @@ class task_manager {
         handle_finished(t);
         mark_mt(v);
         t->m_value = v;
-        /* After the task has been finished and we propagated
-           dependencies, we can release `m_imp` and keep just the value */
-        free_task_imp(t->m_imp);
-        t->m_imp   = nullptr;
-        m_task_finished_cv.notify_all();
+        /* We cannot release `m_imp` here since a concurrent `add_dep` may have read it
+           before `m_value` was set, it is released together with the task object. */
+        lean_task_waiter * w = t->m_imp->m_waiters;
+        t->m_imp->m_waiters  = nullptr;
+        while (w) {
+            lean_task_waiter * next_w = w->m_next;
+            w->m_cv->notify_one();
+            w = next_w;
+        }
     }
 
     void handle_finished(lean_task_object * t) {
-        lean_task_object * it = t->m_imp->m_head_dep;
-        t->m_imp->m_head_dep = nullptr;
+        lean_task_object * it = t->m_imp->m_head_dep.exchange(g_closed_deps);
+        lean_assert(it != g_closed_deps);
         while (it) {
             if (t->m_imp->m_canceled)
                 it->m_imp->m_canceled = true;
@@ -763,6 +1118,8 @@ class task_manager {
 public:
     task_manager(unsigned max_std_workers):
         m_max_std_workers(max_std_workers) {
+        for (unsigned i = 0; i < max_std_workers; i++)
+            m_workers.emplace_back(new task_worker(this, i));
     }
 
     ~task_manager() {
@@ -781,6 +1138,20 @@ public:
     }
 
     void enqueue(lean_task_object * t) {
+        lean_assert(t->m_imp);
+        unsigned prio = t->m_imp->m_prio;
+        if (prio <= LEAN_MAX_PRIO) {
+            if (task_worker * w = current_worker()) {
+                w->m_queues[prio].push(t);
+                /* `push` and the load below are sequentially consistent, so a worker that
+                   is going to sleep either sees the new task or is seen here. */
+                if (m_sleeping_std_workers > 0 || m_num_std_workers < m_max_std_workers) {
+                    unique_lock<mutex> lock(m_mutex);
+                    notify_local_push_core();
+                }
+                return;
+            }
+        }
         unique_lock<mutex> lock(m_mutex);
         enqueue_core(t);
     }
@@ -795,20 +1166,24 @@ public:
         resolve_core(t, v);
     }
 
+    /* Make `t2` wait for `t1`. The caller must own a reference to `t1`, which keeps
+       `t1->m_imp` alive even if `t1` finishes concurrently. */
     void add_dep(lean_task_object * t1, lean_task_object * t2) {
         lean_assert(t2->m_value == nullptr);
         if (t1->m_value) {
             enqueue(t2);
             return;
         }
-        unique_lock<mutex> lock(m_mutex);
-        lean_assert(t2->m_value == nullptr);
-        if (t1->m_value) {
-            enqueue_core(t2);
-            return;
-        }
-        t2->m_imp->m_next_dep = t1->m_imp->m_head_dep;
-        t1->m_imp->m_head_dep = t2;
+        lean_task_imp * imp    = t1->m_imp;
+        lean_task_object * head = imp->m_head_dep;
+        do {
+            if (head == g_closed_deps) {
+                /* `t1` finished after we checked `m_value` */
+                enqueue(t2);
+                return;
+            }
+            t2->m_imp->m_next_dep = head;
+        } while (!imp->m_head_dep.compare_exchange_weak(head, t2));
     }
 
     void wait_for(lean_task_object * t) {
@@ -817,24 +1192,54 @@ public:
         unique_lock<mutex> lock(m_mutex);
         if (t->m_value)
             return;
-        m_task_finished_cv.wait(lock, [&]() { return t->m_value != nullptr; });
+        condition_variable cv;
+        lean_task_waiter w{&cv, t->m_imp->m_waiters};
+        t->m_imp->m_waiters = &w;
+        /* `resolve_core` removes `w` from the list before notifying us */
+        cv.wait(lock, [&]() { return t->m_value != nullptr; });
     }
 
     object * wait_any(object * task_list) {
         if (object * t = wait_any_check(task_list))
             return t;
         unique_lock<mutex> lock(m_mutex);
+        if (object * t = wait_any_check(task_list))
+            return t;
+        condition_variable cv;
+        std::vector<lean_task_waiter> ws;
+        for (object * it = task_list; !is_scalar(it); it = cnstr_get(it, 1))
+            ws.push_back(lean_task_waiter{&cv, nullptr});
+        unsigned i = 0;
+        for (object * it = task_list; !is_scalar(it); it = cnstr_get(it, 1), i++) {
+            lean_task_imp * imp = lean_to_task(lean_ctor_get(it, 0))->m_imp;
+            ws[i].m_next  = imp->m_waiters;
+            imp->m_waiters = &ws[i];
+        }
+        object * r;
         while (true) {
-            if (object * t = wait_any_check(task_list))
-                return t;
-            m_task_finished_cv.wait(lock);
+            if ((r = wait_any_check(task_list)))
+                break;
+            cv.wait(lock);
         }
+        /* Unregister from the tasks that are still running, finished tasks have already
+           dropped their waiter lists. */
+        i = 0;
+        for (object * it = task_list; !is_scalar(it); it = cnstr_get(it, 1), i++) {
+            lean_task_object * t = lean_to_task(lean_ctor_get(it, 0));
+            if (t->m_value)
+                continue;
+            lean_task_waiter ** curr = &t->m_imp->m_waiters;
+            while (*curr != &ws[i])
+                curr = &(*curr)->m_next;
+            *curr = ws[i].m_next;
+        }
+        return r;
     }
 
     void deactivate_task(lean_task_object * t) {
         unique_lock<mutex> lock(m_mutex);
         if (object * v = t->m_value) {
-            lean_assert(t->m_imp == nullptr);
+            lean_assert(t->m_imp == nullptr || t->m_imp->m_waiters == nullptr);
             lock.unlock();
             lean_dec(v);
             free_task(t);
@@ -881,6 +1286,7 @@ extern "C" LEAN_EXPORT void lean_init_task_manager() {
 }
 
 extern "C" LEAN_EXPORT void lean_finalize_task_manager() {
+    shutdown_reclaimer();
     if (g_task_manager) {
         delete g_task_manager;
         g_task_manager = nullptr;
@@ -897,6 +1303,7 @@ scoped_task_manager::scoped_task_manager(unsigned num_workers) {
 }
 
 scoped_task_manager::~scoped_task_manager() {
+    shutdown_reclaimer();
     if (g_task_manager) {
         delete g_task_manager;
         g_task_manager = nullptr;
@@ -1671,6 +2078,14 @@ extern "C" LEAN_EXPORT object * lean_string_append(object * s1, object * s2) {
     size_t len2     = lean_string_len(s2);
     size_t new_len  = len1 + len2;
     size_t new_sz   = sz1 + sz2 - 1;
+    /* Share the other operand instead of copying it when one of them is empty. */
+    if (sz2 == 1)
+        return s1;
+    if (sz1 == 1 && !lean_is_exclusive(s1)) {
+        lean_dec_ref(s1);
+        lean_inc_ref(s2);
+        return s2;
+    }
     object * r;
     if (!lean_is_exclusive(s1)) {
         r = lean_alloc_string(new_sz, mk_capacity(new_sz), new_len);
@@ -1949,6 +2364,16 @@ extern "C" LEAN_EXPORT obj_res lean_string_utf8_extract(b_obj_arg s, b_obj_arg b
     char const * str = lean_string_cstr(s);
     usize sz = lean_string_size(s) - 1;
     if (b >= e || b >= sz) return lean_mk_string("");
+    if (b == 0 && e >= sz) {
+        /* The whole string is extracted, share it. */
+        lean_inc_ref(s);
+        return s;
+    }
+    if (lean_string_is_ascii(s)) {
+        /* Every position is a character start position, and the result is pure ASCII as well. */
+        if (e > sz) e = sz;
+        return lean_mk_string_core(str + b, e - b, e - b);
+    }
     /* In the reference implementation if `b` is not pointing to a valid UTF8
        character start position, the result is the empty string. */
     if (!is_utf8_first_byte(str[b])) return lean_mk_string("");
@@ -1963,7 +2388,7 @@ extern "C" LEAN_EXPORT obj_res lean_string_utf8_extract(b_obj_arg s, b_obj_arg b
     return lean_mk_string_from_bytes(lean_string_cstr(s) + b, new_sz);
 }
 
-extern "C" LEAN_EXPORT obj_res lean_string_utf8_prev(b_obj_arg s, b_obj_arg i0) {
+extern "C" LEAN_EXPORT obj_res lean_string_utf8_prev_cold(b_obj_arg s, b_obj_arg i0) {
     if (!lean_is_scalar(i0)) {
         /* See comment at string_utf8_get */
         return lean_nat_sub(i0, lean_box(1));
@@ -1980,6 +2405,13 @@ extern "C" LEAN_EXPORT obj_res lean_string_utf8_prev(b_obj_arg s, b_obj_arg i0)
     return lean_box(i);
 }
 
+extern "C" LEAN_EXPORT obj_res lean_string_offset_of_pos_cold(b_obj_arg s, b_obj_arg pos0) {
+    usize sz = lean_string_size(s) - 1;
+    /* A position beyond the end of the string (in particular, a big one) counts all characters. */
+    usize pos = lean_is_scalar(pos0) && lean_unbox(pos0) < sz ? lean_unbox(pos0) : sz;
+    return lean_box(utf8_strlen(lean_string_cstr(s), pos));
+}
+
 static unsigned get_utf8_char_size_at(std::string const & s, usize i) {
     if (auto sz = get_utf8_first_byte_opt(s[i])) {
         return *sz;
@@ -1997,11 +2429,16 @@ extern "C" LEAN_EXPORT obj_res lean_string_utf8_set(obj_arg s, b_obj_arg i0, uin
     usize sz = lean_string_size(s) - 1;
     if (i >= sz) return s;
     char * str = w_string_cstr(s);
-    if (lean_is_exclusive(s)) {
-        if (static_cast<unsigned char>(str[i]) < 128 && c < 128) {
-            str[i] = c;
-            return s;
+    if (static_cast<unsigned char>(str[i]) < 128 && c < 128) {
+        if (!lean_is_exclusive(s)) {
+            /* The size and length of the string do not change, copy it directly. */
+            object * new_s = lean_mk_string_core(str, sz, lean_string_len(s));
+            dec_ref(s);
+            s   = new_s;
+            str = w_string_cstr(s);
         }
+        str[i] = c;
+        return s;
     }
     if (!is_utf8_first_byte(str[i])) return s;
     /* TODO(Leo): improve performance of other special cases.
@@ -2024,6 +2461,12 @@ extern "C" LEAN_EXPORT obj_res lean_string_of_usize(size_t n) {
     return mk_ascii_string(std::to_string(n));
 }
 
+extern "C" LEAN_EXPORT obj_res lean_string_of_nat(b_obj_arg n) {
+    if (lean_is_scalar(n))
+        return lean_string_of_usize(lean_unbox(n));
+    return mk_ascii_string(mpz_value(n).to_string());
+}
+
 // =======================================
 // ByteArray & FloatArray
 
@@ -2338,9 +2781,18 @@ void initialize_object() {
     g_ext_classes_mutex = new mutex();
     g_array_empty       = lean_alloc_array(0, 0);
     mark_persistent(g_array_empty);
+#ifdef LEAN_BG_DEALLOC
+    g_reclaimer         = new reclaimer();
+    if (char const * threshold = std::getenv("LEAN_BG_DEALLOC"))
+        g_bg_dealloc_threshold = std::strtoull(threshold, nullptr, 10);
+#endif
 }
 
 void finalize_object() {
+#ifdef LEAN_BG_DEALLOC
+    shutdown_reclaimer();
+    delete g_reclaimer;
+#endif
     for (external_object_class * cls : *g_ext_classes) delete cls;
     delete g_ext_classes;
     delete g_ext_classes_mutex;
@@ -8,6 +8,8 @@ Author: Leonardo de Moura
 #include <cstring>
 #include "runtime/object.h"
 #include "runtime/hash.h"
+#include "runtime/flat_hash_map.h"
+#include "runtime/sharecommon.h"
 
 namespace lean {
 
@@ -44,6 +46,23 @@ static obj_res mk_pair(obj_arg a, obj_arg b) {
     return r;
 }
 
+/*
+  `sharecommon_fn` is parametrized by the state it uses to store
+
+  - a map from objects to their maximally shared representations, and
+  - a set of maximally shared objects, where objects are compared using `lean_sharecommon_eq`.
+
+  It must provide
+
+  - `b_obj_res map_find(b_obj_arg k)`: the representation of `k`, or `nullptr`
+  - `void map_insert(obj_arg k, obj_arg v)`
+  - `b_obj_res set_find(b_obj_arg o)`: the object in the set equal to `o`, or `nullptr`
+  - `void set_insert(obj_arg o)`
+
+  The objects returned by `map_find` and `set_find` are kept alive by the state.
+*/
+
+/* State implemented in Lean, see `StateFactory.mk`. Every operation calls a Lean closure. */
 class sharecommon_state {
 protected:
     object * m_map_find;
@@ -76,9 +95,15 @@ public:
         return r;
     }
 
-    obj_res map_find(b_obj_arg k) {
+    b_obj_res map_find(b_obj_arg k) {
         lean_inc(m_map_find); lean_inc(m_map); lean_inc(k);
-        return lean_apply_2(m_map_find, m_map, k);
+        obj_res o = lean_apply_2(m_map_find, m_map, k);
+        if (o == lean_box(0))
+            return nullptr;
+        b_obj_res r = lean_ctor_get(o, 0);
+        // The map still has a reference to `r`
+        lean_dec(o);
+        return r;
     }
 
     void map_insert(obj_arg k, obj_arg v) {
@@ -86,9 +111,15 @@ public:
         m_map = lean_apply_3(m_map_insert, m_map, k, v);
     }
 
-    obj_res set_find(b_obj_arg o) {
+    b_obj_res set_find(b_obj_arg o) {
         lean_inc(m_set_find); lean_inc(m_set); lean_inc(o);
-        return lean_apply_2(m_set_find, m_set, o);
+        obj_res r = lean_apply_2(m_set_find, m_set, o);
+        if (r == lean_box(0))
+            return nullptr;
+        b_obj_res new_o = lean_ctor_get(r, 0);
+        // The set still has a reference to `new_o`
+        lean_dec(r);
+        return new_o;
     }
 
     void set_insert(obj_arg o) {
@@ -97,8 +128,76 @@ public:
     }
 };
 
+/* Native state, see `StateFactory.native` and `shareCommon'`. The tables own a reference to
+   all keys and values. */
+class sharecommon_tables {
+    struct object_hash {
+        uint64 operator()(b_obj_arg o) const { return lean_sharecommon_hash(o); }
+    };
+    struct object_eq {
+        bool operator()(b_obj_arg o1, b_obj_arg o2) const { return lean_sharecommon_eq(o1, o2); }
+    };
+    flat_hash_map<object *, object *>                m_map;
+    flat_hash_set<object *, object_hash, object_eq> m_set;
+public:
+    sharecommon_tables() {}
+
+    sharecommon_tables(sharecommon_tables const & other):m_map(other.m_map), m_set(other.m_set) {
+        for_each([](b_obj_arg o) { lean_inc(o); });
+    }
+
+    ~sharecommon_tables() {
+        for_each([](b_obj_arg o) { lean_dec(o); });
+    }
+
+    template<typename F> void for_each(F && f) const {
+        for (auto const & p : m_map) { f(p.first); f(p.second); }
+        for (object * o : m_set) f(o);
+    }
+
+    b_obj_res map_find(b_obj_arg k) {
+        auto p = m_map.find(k);
+        return p ? p->second : nullptr;
+    }
+
+    void map_insert(obj_arg k, obj_arg v) {
+        if (!m_map.insert(std::make_pair(k, v)).second) {
+            lean_dec(k);
+            lean_dec(v);
+        }
+    }
+
+    b_obj_res set_find(b_obj_arg o) {
+        auto p = m_set.find(o);
+        return p ? *p : nullptr;
+    }
+
+    void set_insert(obj_arg o) {
+        if (!m_set.insert(o).second)
+            lean_dec(o);
+    }
+};
+
+static lean_external_class * g_sharecommon_tables_class = nullptr;
+
+static void sharecommon_tables_finalize(void * t) {
+    delete static_cast<sharecommon_tables *>(t);
+}
+
+static void sharecommon_tables_foreach(void * t, b_obj_arg fn) {
+    static_cast<sharecommon_tables *>(t)->for_each([&](b_obj_arg o) {
+            lean_inc(fn); lean_inc(o);
+            lean_dec(lean_apply_1(fn, o));
+        });
+}
+
+static bool is_sharecommon_tables(b_obj_arg o) {
+    return !lean_is_scalar(o) && lean_is_external(o) && lean_get_external_class(o) == g_sharecommon_tables_class;
+}
+
+template<typename State>
 class sharecommon_fn {
-    sharecommon_state         m_state;
+    State &                   m_state;
     std::vector<lean_object*> m_children;
     std::vector<lean_object*> m_todo;
 
@@ -125,11 +224,7 @@ class sharecommon_fn {
         }
 
         // Check whether we have already maximized sharing for `a`
-        obj_res o = m_state.map_find(a);
-        if (o != lean_box(0)) {
-            obj_res r = lean_ctor_get(o, 0);
-            lean_dec(o);
-            // The map still has a reference to `r`
+        if (b_obj_res r = m_state.map_find(a)) {
             m_children.push_back(r);
             // std::cout << "cached maximized " << r << "\n";
             return true;
@@ -143,15 +238,12 @@ class sharecommon_fn {
         lean_assert(m_todo.size() > 0);
         lean_assert(m_todo.back() == a);
         m_todo.pop_back();
-        obj_res opt_new_r = m_state.set_find(new_a);
-        if (opt_new_r != lean_box(0)) {
+        if (b_obj_res new_r = m_state.set_find(new_a)) {
             lean_dec(new_a); // we already have a maximally shared term equivalent to `new_a`
-            new_a = lean_ctor_get(opt_new_r, 0);
-            lean_inc(new_a);
-            lean_dec(opt_new_r);
+            lean_inc(new_r);
             lean_inc(a);
-            m_state.map_insert(a, new_a);
-            // std::cout << "already maximized " << new_a << "\n";
+            m_state.map_insert(a, new_r);
+            // std::cout << "already maximized " << new_r << "\n";
         } else {
             lean_inc(a);
             lean_inc_n(new_a, 3);
@@ -230,11 +322,14 @@ class sharecommon_fn {
     }
 
 public:
-    sharecommon_fn(b_obj_arg tc, obj_arg s):m_state(tc, s) {}
+    sharecommon_fn(State & s):m_state(s) {}
 
     obj_res operator()(obj_arg a) {
         if (push_child(a)) {
-            return m_state.pack(a);
+            obj_res r = m_children.back();
+            lean_inc(r);
+            lean_dec(a);
+            return r;
         }
         while (!m_todo.empty()) {
             b_obj_arg curr = m_todo.back();
@@ -254,18 +349,52 @@ public:
             }
         }
 
-        obj_res o = m_state.map_find(a);
-        lean_assert(o != lean_box(0));
-        obj_res r = lean_ctor_get(o, 0);
+        obj_res r = m_state.map_find(a);
+        lean_assert(r != nullptr);
         lean_inc(r);
-        lean_dec(o);
         lean_dec(a);
-        return m_state.pack(r);
+        return r;
     }
 };
 
 // def State.shareCommon {α} {σ : @& StateFactory} (s : State σ) (a : α) : α × State σ
 extern "C" LEAN_EXPORT obj_res lean_state_sharecommon(b_obj_arg tc, obj_arg s, obj_arg a) {
-    return sharecommon_fn(tc, s)(a);
+    object * m = lean_ctor_get(s, 0);
+    if (is_sharecommon_tables(m)) {
+        // `StateFactory.native`: update the tables in place unless they are shared
+        lean_inc(m);
+        lean_dec(s);
+        if (!lean_is_exclusive(m)) {
+            object * new_m = lean_alloc_external(g_sharecommon_tables_class,
+                new sharecommon_tables(*static_cast<sharecommon_tables *>(lean_get_external_data(m))));
+            lean_dec(m);
+            m = new_m;
+        }
+        obj_res r = sharecommon_fn<sharecommon_tables>(*static_cast<sharecommon_tables *>(lean_get_external_data(m)))(a);
+        return mk_pair(r, mk_pair(m, lean_box(0)));
+    }
+    sharecommon_state state(tc, s);
+    obj_res r = sharecommon_fn<sharecommon_state>(state)(a);
+    return state.pack(r);
+}
+
+// def StateFactory.mkNativeTables : Unit → NonScalar
+extern "C" LEAN_EXPORT obj_res lean_sharecommon_mk_native_tables(obj_arg) {
+    return lean_alloc_external(g_sharecommon_tables_class, new sharecommon_tables());
+}
+
+// def shareCommon' (a : @& α) : α
+extern "C" LEAN_EXPORT obj_res lean_sharecommon_quick(b_obj_arg a) {
+    // The tables are local to this call, so it is safe to run it in parallel on different objects
+    sharecommon_tables tables;
+    lean_inc(a);
+    return sharecommon_fn<sharecommon_tables>(tables)(a);
+}
+
+void initialize_sharecommon() {
+    g_sharecommon_tables_class = lean_register_external_class(sharecommon_tables_finalize, sharecommon_tables_foreach);
+}
+
+void finalize_sharecommon() {
 }
 };
@@ -6,6 +6,9 @@ Author: Leonardo de Moura
 */
 #include <utility>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <exception>
 #include <iostream>
 #ifdef LEAN_WINDOWS
 #include <windows.h>
@@ -157,6 +160,49 @@ lthread::~lthread() {}
 void lthread::join() { m_imp->join(); }
 #endif
 
+void parallel_for(size_t n, std::function<void(size_t)> const & fn) {
+#if defined(LEAN_MULTI_THREAD)
+    if (n == 0)
+        return;
+    atomic<size_t> next(0);
+    mutex ex_mutex;
+    std::exception_ptr ex;
+    auto work = [&]() {
+        while (true) {
+            size_t i = next.fetch_add(1);
+            if (i >= n)
+                return;
+            try {
+                fn(i);
+            } catch (...) {
+                lock_guard<mutex> lock(ex_mutex);
+                if (!ex)
+                    ex = std::current_exception();
+                next = n;
+            }
+        }
+    };
+    size_t num_helpers = std::min<size_t>(n, std::max(hardware_concurrency(), 1u)) - 1;
+    std::vector<std::unique_ptr<lthread>> helpers;
+    for (size_t i = 0; i < num_helpers; i++) {
+        try {
+            helpers.emplace_back(new lthread(work));
+        } catch (exception &) {
+            // make do with the threads we already have
+            break;
+        }
+    }
+    work();
+    for (std::unique_ptr<lthread> & h : helpers)
+        h->join();
+    if (ex)
+        std::rethrow_exception(ex);
+#else
+    for (size_t i = 0; i < n; i++)
+        fn(i);
+#endif
+}
+
 LEAN_THREAD_VALUE(bool, g_finalizing, false);
 
 bool in_thread_finalization() {
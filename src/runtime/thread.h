@@ -252,4 +252,13 @@ LEAN_EXPORT void register_thread_local_reset_fn(std::function<void()> fn);
    We invoke this function before processing a command
    and before executing a task. */
 LEAN_EXPORT void reset_thread_local();
+
+/**
+   \brief Invoke \c fn(i) for every <tt>i < n</tt>, distributing the indices over the calling thread and up to
+   <tt>hardware_concurrency() - 1</tt> threads created for this call.
+
+   Unlike spawning tasks and waiting for them, this cannot deadlock when invoked from a task manager worker, as
+   the calling thread never waits for work that is still queued. The first exception thrown by \c fn is rethrown
+   after all threads have stopped; indices not started yet are skipped. */
+LEAN_EXPORT void parallel_for(size_t n, std::function<void(size_t)> const & fn);
 }
@@ -5,11 +5,17 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include "runtime/debug.h"
 #include "runtime/optional.h"
 #include "runtime/utf8.h"
 
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))
+#define LEAN_UTF8_SIMD
+#include <immintrin.h>
+#endif
+
 namespace lean {
 bool is_utf8_next(unsigned char c) { return (c & 0xC0) == 0x80; }
 
@@ -32,29 +38,339 @@ unsigned get_utf8_size(unsigned char c) {
         return 1; /* invalid */
 }
 
-extern "C" LEAN_EXPORT size_t lean_utf8_strlen(char const * str) {
+/*
+The kernels below are used for validation, length computation and ASCII detection.
+On x86-64, SSE2 is always available and the AVX2 kernels are selected at runtime;
+other platforms use the portable versions, which process 8 bytes at a time.
+Note that the length of a string is the number of bytes that are not continuation bytes (`10xxxxxx`),
+which is the number of unicode scalar values for valid UTF-8.
+*/
+
+#define ONES_64 0x0101010101010101ull
+#define HIGH_64 0x8080808080808080ull
+
+static inline uint64_t load_64(uint8_t const * str) {
+    uint64_t w;
+    memcpy(&w, str, sizeof(w));
+    return w;
+}
+
+static inline unsigned popcount_64(uint64_t w) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(w);
+#else
+    w = w - ((w >> 1) & 0x5555555555555555ull);
+    w = (w & 0x3333333333333333ull) + ((w >> 2) & 0x3333333333333333ull);
+    w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return static_cast<unsigned>((w * ONES_64) >> 56);
+#endif
+}
+
+static inline bool is_cont_byte(uint8_t c) { return (c & 0xC0) == 0x80; }
+
+static size_t ascii_prefix_portable(uint8_t const * str, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        if (load_64(str + i) & HIGH_64)
+            break;
+    }
+    while (i < size && str[i] < 0x80)
+        i++;
+    return i;
+}
+
+static size_t count_cont_portable(uint8_t const * str, size_t size) {
     size_t r = 0;
-    while (*str != 0) {
-        unsigned sz = get_utf8_size(*str);
-        r++;
-        str += sz;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w = load_64(str + i);
+        /* bit 7 set and bit 6 unset */
+        r += popcount_64((w >> 7) & ~(w >> 6) & ONES_64);
     }
+    for (; i < size; i++)
+        r += is_cont_byte(str[i]);
     return r;
 }
 
-size_t utf8_strlen(char const * str) {
-    return lean_utf8_strlen(str);
+/* Scalar validation, skipping runs of ASCII characters using `ascii_prefix`. */
+template<size_t (*ascii_prefix)(uint8_t const *, size_t)>
+static bool validate_utf8_core(uint8_t const * str, size_t size) {
+    size_t i = 0;
+    while (i < size) {
+        unsigned c = str[i];
+        if ((c & 0x80) == 0) {
+            /* zero continuation (0 to 0x7F) */
+            i++;
+            if (i < size && str[i] < 0x80)
+                i += ascii_prefix(str + i, size - i);
+        } else if ((c & 0xe0) == 0xc0) {
+            /* one continuation (0x80 to 0x7FF) */
+            if (i + 1 >= size) return false;
+
+            unsigned c1 = str[i+1];
+            if ((c1 & 0xc0) != 0x80) return false;
+
+            unsigned r = ((c & 0x1f) << 6) | (c1 & 0x3f);
+            if (r < 0x80) return false;
+
+            i += 2;
+        } else if ((c & 0xf0) == 0xe0) {
+            /* two continuations (0x800 to 0xD7FF and 0xE000 to 0xFFFF) */
+            if (i + 2 >= size) return false;
+
+            unsigned c1 = str[i+1];
+            unsigned c2 = str[i+2];
+            if ((c1 & 0xc0) != 0x80 || (c2 & 0xc0) != 0x80) return false;
+
+            unsigned r = ((c & 0x0f) << 12) | ((c1 & 0x3f) << 6) | (c2 & 0x3f);
+            if (r < 0x800 || (r >= 0xD800 && r <= 0xDFFF)) return false;
+
+            i += 3;
+        } else if ((c & 0xf8) == 0xf0) {
+            /* three continuations (0x10000 to 0x10FFFF) */
+            if (i + 3 >= size) return false;
+
+            unsigned c1 = str[i+1];
+            unsigned c2 = str[i+2];
+            unsigned c3 = str[i+3];
+            if ((c1 & 0xc0) != 0x80 || (c2 & 0xc0) != 0x80 || (c3 & 0xc0) != 0x80) return false;
+
+            unsigned r  = ((c & 0x07) << 18) | ((c1 & 0x3f) << 12) | ((c2 & 0x3f) << 6) | (c3 & 0x3f);
+            if (r < 0x10000 || r > 0x10FFFF) return false;
+
+            i += 4;
+        } else {
+            return false;
+        }
+    }
+    return true;
 }
 
-extern "C" LEAN_EXPORT size_t lean_utf8_n_strlen(char const * str, size_t sz) {
+#ifdef LEAN_UTF8_SIMD
+static size_t ascii_prefix_sse2(uint8_t const * str, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(str + i)));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return i + ascii_prefix_portable(str + i, size - i);
+}
+
+static size_t count_cont_sse2(uint8_t const * str, size_t size) {
+    __m128i const min_lead = _mm_set1_epi8(static_cast<char>(0xC0));
     size_t r = 0;
     size_t i = 0;
-    while (i < sz) {
-        unsigned d = get_utf8_size(str[i]);
-        r++;
-        i += d;
+    for (; i + 16 <= size; i += 16) {
+        /* as signed bytes, continuation bytes are exactly the ones smaller than `0xC0` */
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(str + i));
+        r += __builtin_popcount(_mm_movemask_epi8(_mm_cmplt_epi8(v, min_lead)));
     }
-    return r;
+    return r + count_cont_portable(str + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t ascii_prefix_avx2(uint8_t const * str, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        unsigned mask = _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(str + i)));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return i + ascii_prefix_sse2(str + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t count_cont_avx2(uint8_t const * str, size_t size) {
+    __m256i const min_lead = _mm256_set1_epi8(static_cast<char>(0xC0));
+    size_t r = 0;
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(str + i));
+        r += __builtin_popcount(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(min_lead, v))));
+    }
+    return r + count_cont_sse2(str + i, size - i);
+}
+
+/*
+AVX2 validation following Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte".
+Each byte is classified using three 16-entry tables indexed by the high and low nibble of the previous byte
+and the high nibble of the current one. The bitwise and of the three classifications is non-zero iff
+the two-byte sequence is invalid, with the exception of missing or superfluous third and fourth continuation
+bytes, which are checked separately using the bytes two and three positions back.
+*/
+#define UTF8_TOO_SHORT      (1 << 0)
+#define UTF8_TOO_LONG       (1 << 1)
+#define UTF8_OVERLONG_3     (1 << 2)
+#define UTF8_TOO_LARGE      (1 << 3)
+#define UTF8_SURROGATE      (1 << 4)
+#define UTF8_OVERLONG_2     (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4     (1 << 6)
+#define UTF8_TWO_CONTS      (1 << 7)
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+__attribute__((target("avx2")))
+static inline __m256i utf8_lookup(__m256i idx, char t0, char t1, char t2, char t3, char t4, char t5, char t6, char t7,
+                                  char t8, char t9, char t10, char t11, char t12, char t13, char t14, char t15) {
+    __m128i t = _mm_setr_epi8(t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15);
+    return _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(t), idx);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i utf8_high_nibbles(__m256i v) {
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+/* The bytes of `input` shifted by `N` positions, with the last bytes of `prev` shifted in. */
+template<int N>
+__attribute__((target("avx2")))
+static inline __m256i utf8_prev(__m256i input, __m256i prev) {
+    return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i utf8_check_block(__m256i input, __m256i prev_input) {
+    __m256i prev1 = utf8_prev<1>(input, prev_input);
+    __m256i byte_1_high = utf8_lookup(utf8_high_nibbles(prev1),
+        /* 0_______ ________ <ASCII in byte 1> */
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        /* 10______ ________ <continuation in byte 1> */
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        /* 1100____ ________ <two byte lead in byte 1> */
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        /* 1101____ ________ <two byte lead in byte 1> */
+        UTF8_TOO_SHORT,
+        /* 1110____ ________ <three byte lead in byte 1> */
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        /* 1111____ ________ <four+ byte lead in byte 1> */
+        static_cast<char>(UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4));
+    __m256i byte_1_low = utf8_lookup(_mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)),
+        /* ____0000 ________ */
+        static_cast<char>(UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4),
+        /* ____0001 ________ */
+        static_cast<char>(UTF8_CARRY | UTF8_OVERLONG_2),
+        /* ____001_ ________ */
+        static_cast<char>(UTF8_CARRY),
+        static_cast<char>(UTF8_CARRY),
+        /* ____0100 ________ */
+        static_cast<char>(UTF8_CARRY | UTF8_TOO_LARGE),
+        /* ____0101 ________ */
+        static_cast<char>(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        /* ____011_ ________ */
+        static_cast<char>(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        static_cast<char>(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        /* ____1___ ________ */
+        static_cast<char>(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        static_cast<char>(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        static_cast<char>(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        static_cast<char>(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        static_cast<char>(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        /* ____1101 ________ */
+        static_cast<char>(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE),
+        static_cast<char>(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+        static_cast<char>(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000));
+    __m256i byte_2_high = utf8_lookup(utf8_high_nibbles(input),
+        /* ________ 0_______ <ASCII in byte 2> */
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        /* ________ 1000____ */
+        static_cast<char>(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+        /* ________ 1001____ */
+        static_cast<char>(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE),
+        /* ________ 101_____ */
+        static_cast<char>(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        static_cast<char>(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+        /* ________ 11______ */
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+    __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+    /* a byte must be a third or fourth continuation byte iff the byte two positions back is `111_____`
+       or the one three positions back is `1111____`, which is exactly when `UTF8_TWO_CONTS` is expected */
+    __m256i prev2 = utf8_prev<2>(input, prev_input);
+    __m256i prev3 = utf8_prev<3>(input, prev_input);
+    __m256i is_third  = _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+    __m256i is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+    __m256i must_23 = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth), _mm256_set1_epi8(static_cast<char>(0x80)));
+    return _mm256_xor_si256(must_23, special);
+}
+
+/* Non-zero iff the block ends with an incomplete multi-byte sequence. */
+__attribute__((target("avx2")))
+static inline __m256i utf8_is_incomplete(__m256i input) {
+    __m256i const max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+    return _mm256_subs_epu8(input, max);
+}
+
+__attribute__((target("avx2")))
+static bool validate_utf8_avx2(uint8_t const * str, size_t size) {
+    __m256i error           = _mm256_setzero_si256();
+    __m256i prev_input      = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    size_t i = 0;
+    while (i < size) {
+        __m256i input;
+        if (i + 32 <= size) {
+            input = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(str + i));
+        } else {
+            /* pad the last block with zeros, which are valid ASCII characters */
+            alignas(32) uint8_t last[32] = {0};
+            memcpy(last, str + i, size - i);
+            input = _mm256_load_si256(reinterpret_cast<__m256i const *>(last));
+        }
+        if (_mm256_movemask_epi8(input) == 0) {
+            error = _mm256_or_si256(error, prev_incomplete);
+            prev_incomplete = _mm256_setzero_si256();
+        } else {
+            error = _mm256_or_si256(error, utf8_check_block(input, prev_input));
+            prev_incomplete = utf8_is_incomplete(input);
+        }
+        prev_input = input;
+        i += 32;
+    }
+    error = _mm256_or_si256(error, prev_incomplete);
+    return _mm256_testz_si256(error, error);
+}
+#endif
+
+struct utf8_kernels {
+    bool (*m_validate)(uint8_t const *, size_t);
+    size_t (*m_count_cont)(uint8_t const *, size_t);
+    size_t (*m_ascii_prefix)(uint8_t const *, size_t);
+};
+
+static utf8_kernels select_utf8_kernels() {
+#ifdef LEAN_UTF8_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        return { validate_utf8_avx2, count_cont_avx2, ascii_prefix_avx2 };
+    return { validate_utf8_core<ascii_prefix_sse2>, count_cont_sse2, ascii_prefix_sse2 };
+#else
+    return { validate_utf8_core<ascii_prefix_portable>, count_cont_portable, ascii_prefix_portable };
+#endif
+}
+
+static utf8_kernels const & get_utf8_kernels() {
+    static utf8_kernels kernels = select_utf8_kernels();
+    return kernels;
+}
+
+size_t utf8_ascii_prefix(uint8_t const * str, size_t size) {
+    return get_utf8_kernels().m_ascii_prefix(str, size);
+}
+
+extern "C" LEAN_EXPORT size_t lean_utf8_strlen(char const * str) {
+    return lean_utf8_n_strlen(str, strlen(str));
+}
+
+size_t utf8_strlen(char const * str) {
+    return lean_utf8_strlen(str);
+}
+
+extern "C" LEAN_EXPORT size_t lean_utf8_n_strlen(char const * str, size_t sz) {
+    return sz - get_utf8_kernels().m_count_cont(reinterpret_cast<uint8_t const *>(str), sz);
 }
 
 size_t utf8_strlen(char const * str, size_t sz) {
@@ -221,53 +537,7 @@ void utf8_decode(std::string const & str, std::vector<unsigned> & out) {
 }
 
 bool validate_utf8(uint8_t const * str, size_t size) {
-    size_t i = 0;
-    while (i < size) {
-        unsigned c = str[i];
-        if ((c & 0x80) == 0) {
-            /* zero continuation (0 to 0x7F) */
-            i++;
-        } else if ((c & 0xe0) == 0xc0) {
-            /* one continuation (0x80 to 0x7FF) */
-            if (i + 1 >= size) return false;
-
-            unsigned c1 = str[i+1];
-            if ((c1 & 0xc0) != 0x80) return false;
-
-            unsigned r = ((c & 0x1f) << 6) | (c1 & 0x3f);
-            if (r < 0x80) return false;
-
-            i += 2;
-        } else if ((c & 0xf0) == 0xe0) {
-            /* two continuations (0x800 to 0xD7FF and 0xE000 to 0xFFFF) */
-            if (i + 2 >= size) return false;
-
-            unsigned c1 = str[i+1];
-            unsigned c2 = str[i+2];
-            if ((c1 & 0xc0) != 0x80 || (c2 & 0xc0) != 0x80) return false;
-
-            unsigned r = ((c & 0x0f) << 12) | ((c1 & 0x3f) << 6) | (c2 & 0x3f);
-            if (r < 0x800 || (r >= 0xD800 && r <= 0xDFFF)) return false;
-
-            i += 3;
-        } else if ((c & 0xf8) == 0xf0) {
-            /* three continuations (0x10000 to 0x10FFFF) */
-            if (i + 3 >= size) return false;
-
-            unsigned c1 = str[i+1];
-            unsigned c2 = str[i+2];
-            unsigned c3 = str[i+3];
-            if ((c1 & 0xc0) != 0x80 || (c2 & 0xc0) != 0x80 || (c3 & 0xc0) != 0x80) return false;
-
-            unsigned r  = ((c & 0x07) << 18) | ((c1 & 0x3f) << 12) | ((c2 & 0x3f) << 6) | (c3 & 0x3f);
-            if (r < 0x10000 || r > 0x10FFFF) return false;
-
-            i += 4;
-        } else {
-            return false;
-        }
-    }
-    return true;
+    return get_utf8_kernels().m_validate(str, size);
 }
 
 #define TAG_CONT    static_cast<unsigned char>(0b10000000)
@@ -15,7 +15,8 @@ using uchar = unsigned char;
 
 LEAN_EXPORT bool is_utf8_next(unsigned char c);
 LEAN_EXPORT unsigned get_utf8_size(unsigned char c);
-/* Return the length of the null terminated string encoded using UTF8 */
+/* Return the length of the null terminated string encoded using UTF8.
+   The length is the number of bytes that are not continuation bytes. */
 LEAN_EXPORT size_t utf8_strlen(char const * str);
 /* Return the length of the string `str` encoded using UTF8.
    `str` may contain null characters. */
@@ -48,6 +49,9 @@ LEAN_EXPORT void utf8_decode(std::string const & str, std::vector<unsigned> & ou
 /* Returns true if the provided string is valid UTF-8 */
 LEAN_EXPORT bool validate_utf8(uint8_t const * str, size_t size);
 
+/* Return the length of the longest prefix of `str` consisting only of ASCII characters */
+LEAN_EXPORT size_t utf8_ascii_prefix(uint8_t const * str, size_t size);
+
 /* Push a unicode scalar value into a utf-8 encoded string */
 LEAN_EXPORT void push_unicode_scalar(std::string & s, unsigned code);
 
@@ -0,0 +1,12 @@
+-- Multiplication, division and decimal conversion of big natural numbers
+def main : List String → IO Unit
+| [n] => do
+  let n := n.toNat!
+  let a := 3 ^ n
+  let b := 7 ^ (n / 2) + 1
+  let c := a * b
+  unless c / b == a && c % b == 0 && (c + a - 1) / a == b do
+    throw <| IO.userError "unexpected quotient"
+  let s := toString (c + 1)
+  IO.println s!"{s.length} {s.take 10} {s.drop (s.length - 10)} {c % 1000000007}"
+| _ => throw <| IO.userError "give exponent"
@@ -0,0 +1,49 @@
+import Lean
+open Lean
+
+/-!
+  Per-node cost of `Expr.instantiate`, `Expr.instantiateRev`, `Expr.abstract` and
+  `Expr.liftLooseBVars`, which are implemented by the kernel's `replace_iter` traversal.
+  The inputs are a balanced term without sharing, a long application spine (too deep for a
+  traversal on the C stack), and a term with a lot of sharing. -/
+
+/-- A balanced term without sharing, and its number of nodes. -/
+def mkTree : Nat → Nat → Expr × Nat
+  | 0, k =>
+    if k % 3 == 0 then (.bvar (k % 4), 1) else (.app (.const `c []) (.lit (.natVal k)), 3)
+  | d+1, k =>
+    let (l, n₁) := mkTree d (2*k)
+    let (r, n₂) := mkTree d (2*k+1)
+    ((if d % 4 == 0 then .lam `x l r .default else .app l r), n₁ + n₂ + 1)
+
+/-- `g (#0 0) (#1 1) ... (#3 (n-1))`, and its number of nodes. -/
+def mkSpine (n : Nat) : Expr × Nat := Id.run do
+  let mut e : Expr := .const `g []
+  for i in [:n] do
+    e := .app e (.app (.bvar (i % 4)) (.lit (.natVal i)))
+  return (e, 4*n + 1)
+
+/-- `t_{i+1} = f t_i t_i`, whose size without sharing is exponential in `depth`. -/
+def mkShared (depth : Nat) : Expr × Nat := Id.run do
+  let mut e : Expr := .bvar 0
+  for _ in [:depth] do
+    e := mkApp2 (.const `f []) e e
+  return (e, 3*depth + 1)
+
+def bench (name : String) (e : Expr) (nodes reps : Nat) (f : Expr → Array Expr → Expr) : IO Unit := do
+  let start ← IO.monoNanosNow
+  let mut h : UInt64 := 0
+  for i in [:reps] do
+    -- a different substitution in each iteration, so the call cannot be shared between them
+    let subst := #[.fvar ⟨.num `a i⟩, .fvar ⟨.num `b i⟩, .fvar ⟨.num `c i⟩, .fvar ⟨.num `d i⟩]
+    h := mixHash h (f e subst).hash
+  let stop ← IO.monoNanosNow
+  IO.println s!"{name}: {(stop - start) / (reps * nodes)} ns/node ({h != 0})"
+
+def main : IO Unit := do
+  for (input, (e, nodes), reps) in [("tree", mkTree 16 1, 20), ("spine", mkSpine 1000000, 5), ("shared", mkShared 10000, 200)] do
+    bench s!"instantiate {input}" e nodes reps (·.instantiate ·)
+    bench s!"instantiateRev {input}" e nodes reps (·.instantiateRev ·)
+    let a := e.instantiateRev #[.fvar ⟨`a⟩, .fvar ⟨`b⟩, .fvar ⟨`c⟩, .fvar ⟨`d⟩]
+    bench s!"abstract {input}" a nodes reps fun e _ => e.abstract #[.fvar ⟨`a⟩, .fvar ⟨`b⟩, .fvar ⟨`c⟩, .fvar ⟨`d⟩]
+    bench s!"liftLooseBVars {input}" e nodes reps fun e subst => e.liftLooseBVars 0 subst.size
@@ -0,0 +1,20 @@
+import Lean.Data.Json
+open Lean
+
+-- Serialization of a large JSON message, similar to an LSP response with many diagnostics
+def diagnostic (i : Nat) : Json :=
+  Json.mkObj [
+    ("range", Json.mkObj [("start", Json.mkObj [("line", i), ("character", 4)]),
+                          ("end", Json.mkObj [("line", i), ("character", 20)])]),
+    ("severity", 1),
+    ("message", s!"type mismatch\n  h {i}\nhas type\n  α → β : Type\nbut is expected to have type \"γ\"")
+  ]
+
+def main : List String → IO Unit
+| [n] => do
+  let msg := Json.mkObj [("uri", "file:///foo.lean"), ("diagnostics", Json.arr ((Array.range 2000).map diagnostic))]
+  let mut total := 0
+  for _ in [0:n.toNat!] do
+    total := total + msg.compress.utf8ByteSize
+  IO.println total
+| _ => throw <| IO.userError "give number of iterations"
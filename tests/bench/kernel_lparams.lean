@@ -0,0 +1,27 @@
+import Lean
+open Lean
+
+/-!
+  Checks many small theorems about universe polymorphic list functions. Every check instantiates the level
+  parameters of `List.map`, `List.length`, `List.rec`, `Eq`, ... at the same levels, so the kernel time is
+  dominated by `instantiate_type_lparams`/`instantiate_value_lparams` and their cache. -/
+
+def natListLit (xs : List Nat) : Expr :=
+  xs.foldr (fun x l => mkApp3 (mkConst ``List.cons [levelZero]) (mkConst ``Nat) (mkRawNatLit x) l)
+    (mkApp (mkConst ``List.nil [levelZero]) (mkConst ``Nat))
+
+def main (args : List String) : IO Unit := do
+  let n := args.head!.toNat!
+  initSearchPath (← findSysroot)
+  let mut env ← importModules #[{ module := `Init }] {}
+  for i in [0:n] do
+    let xs := List.range (i % 20)
+    -- `(xs.map Nat.succ).length = xs.length`
+    let lhs := mkApp2 (mkConst ``List.length [levelZero]) (mkConst ``Nat)
+      (mkApp4 (mkConst ``List.map [levelZero, levelZero]) (mkConst ``Nat) (mkConst ``Nat) (mkConst ``Nat.succ) (natListLit xs))
+    let type := mkApp3 (mkConst ``Eq [levelOne]) (mkConst ``Nat) lhs (mkRawNatLit xs.length)
+    let value := mkApp2 (mkConst ``Eq.refl [levelOne]) (mkConst ``Nat) (mkRawNatLit xs.length)
+    match env.addDecl (.thmDecl { name := .mkSimple s!"lengthMap{i}", levelParams := [], type, value }) with
+    | .ok env' => env := env'
+    | .error _ => throw <| IO.userError s!"kernel rejected lengthMap{i}"
+  IO.println s!"{n} theorems checked"
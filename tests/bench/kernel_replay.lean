@@ -0,0 +1,16 @@
+import Lean
+import Lean.Replay
+open Lean
+
+/-!
+  Replays the kernel checks of all declarations in `Init` into an empty environment.
+  Dominated by the kernel type checker and its `whnf`/`infer_type`/definitional equality caches. -/
+
+def main : IO Unit := do
+  initSearchPath (← findSysroot)
+  let env ← importModules #[{ module := `Init }] {}
+  let mut constants : HashMap Name ConstantInfo := {}
+  for (n, c) in env.constants.map₁.toList do
+    constants := constants.insert n c
+  let env' ← (← mkEmptyEnvironment).replay constants
+  IO.println s!"{env'.constants.size} declarations replayed"
@@ -0,0 +1,13 @@
+-- Throughput of UTF-8 validation, length computation and position conversion on a large mixed string
+def main : List String → IO Unit
+| [n] => do
+  let n := n.toNat!
+  let line := "def foo (x : Nat) : Nat := x + 1 -- ∀ α β, α → β ≠ 𝔸\n"
+  let s := String.join (List.replicate 100000 line)
+  let bytes := s.toUTF8
+  let mut total := 0
+  for i in [0:n] do
+    let t := String.fromUTF8! bytes
+    total := total + t.length + t.offsetOfPos ⟨t.utf8ByteSize / 2 + i⟩
+  IO.println total
+| _ => throw <| IO.userError "give number of iterations"
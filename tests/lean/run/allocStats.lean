@@ -0,0 +1,18 @@
+#eval id (α := IO _) do
+  let s ← IO.getAllocStats
+  unless s.numHeaps > 0 && s.numSegments > 0 && s.numPages > 0 do
+    throw <| IO.userError s!"unexpected allocator statistics {repr s}"
+  let pages := s.slots.foldl (fun n slot => n + slot.numPages) 0
+  unless pages == s.numPages do
+    throw <| IO.userError s!"per-slot pages {pages} do not add up to {s.numPages}"
+  unless s.slots.all (fun slot => slot.objSize % 8 == 0) do
+    throw <| IO.userError "unexpected slot size"
+
+#eval id (α := IO _) do
+  let before ← IO.getAllocStats
+  let released ← IO.releaseFreeMemory
+  let after ← IO.getAllocStats
+  unless after.numReleasedSegments ≥ before.numReleasedSegments do
+    throw <| IO.userError "released segment counter decreased"
+  unless released % (8 * 1024 * 1024) == 0 do
+    throw <| IO.userError s!"unexpected number of released bytes {released}"
@@ -0,0 +1,15 @@
+-- dropping a large object graph shared with a task hands most of it to the reclaimer thread
+#eval id (α := IO _) do
+  IO.setBackgroundDealloc 1000
+  let before ← IO.getBgDeallocStats
+  for i in [0:10] do
+    let t := Task.spawn fun _ => (List.range (100000 + i)).map (· + i)
+    unless t.get.length == 100000 + i do
+      throw <| IO.userError "unexpected result"
+  IO.setBackgroundDealloc 0
+  let after ← IO.getBgDeallocStats
+  unless after.numHandoffs + after.numRejected > before.numHandoffs + before.numRejected do
+    throw <| IO.userError s!"no object graph was handed to the reclaimer thread {repr after}"
+  unless after.maxQueueDepth ≤ 16 do
+    throw <| IO.userError s!"queue depth exceeded {repr after}"
+
@@ -0,0 +1,19 @@
+/-! Arithmetic on natural numbers that are large enough to use the subquadratic algorithms of the runtime. -/
+
+def a : Nat := 3 ^ 20000 + 12345
+def b : Nat := 7 ^ 9000 + 1
+def c : Nat := 2 ^ 40000 - 1
+
+#guard (a * b) / b == a
+#guard (a * b) % b == 0
+#guard (a * b + b - 1) / b == a
+#guard (a * b + b - 1) % b == b - 1
+#guard a / b * b + a % b == a
+#guard c % (2 ^ 20000 + 1) == 0
+#guard (a + b) ^ 2 == a ^ 2 + 2 * a * b + b ^ 2
+#guard (a * c) * b == a * (c * b)
+#guard c * c == 2 ^ 80000 - 2 ^ 40001 + 1
+#guard (toString a).toNat! == a
+#guard (toString (10 ^ 5000)).length == 5001
+#guard toString (10 ^ 3000 * 7 + 5) == "7" ++ String.mk (List.replicate 2999 '0') ++ "5"
+#guard toString (b * 12345) == (Nat.toDigits 10 (b * 12345)).asString
@@ -0,0 +1,66 @@
+/-! Exercises the lowering of IR code in the interpreter: jump tables with default alternatives,
+join points, self tail calls, unboxed fields and literals, constants, and partial applications. -/
+
+inductive Op where
+  | add | sub | mul | neg | dup | swap | drop | nop
+
+structure S where
+  x : Float
+  n : UInt32
+  b : Bool
+  u : USize
+
+def Op.arity : Op → Nat
+  | .neg | .dup | .drop => 1
+  | .add | .sub | .mul | .swap => 2
+  | _ => 0
+
+def step : List Int → Op → List Int
+  | a :: b :: s, .add => (b + a) :: s
+  | a :: b :: s, .sub => (b - a) :: s
+  | a :: b :: s, .mul => (b * a) :: s
+  | a :: s, .neg => (-a) :: s
+  | a :: s, .dup => a :: a :: s
+  | a :: b :: s, .swap => b :: a :: s
+  | _ :: s, .drop => s
+  | s, _ => s
+
+def run (ops : List Op) : List Int :=
+  ops.foldl step [1, 2, 3]
+
+-- a self tail call that would overflow the stack if it was not turned into a jump
+def countDown : Nat → Nat → Nat
+  | 0, acc => acc
+  | n+1, acc => countDown n (acc + (n + 1) % 7)
+
+-- join points with parameters
+@[noinline] def classify (n : Nat) : String := Id.run do
+  let mut s := if n % 2 == 0 then "even" else "odd"
+  if n % 3 == 0 then
+    s := s ++ "/three"
+  else if n % 5 == 0 then
+    s := s ++ "/five"
+  return s ++ "!"
+
+def bigTable : Array Nat := (List.range 100).toArray.map (· * 3)
+
+def addThree (a b c : Nat) : Nat := a + b + c
+
+def mkS (i : Nat) : S := { x := i.toFloat / 2, n := i.toUInt32 * 7, b := i % 2 == 0, u := i.toUSize + 1 }
+
+def sumS (ss : Array S) : Float × UInt32 × Nat × USize :=
+  ss.foldl (init := (0, 0, 0, 0)) fun (x, n, b, u) s => (x + s.x, n + s.n, b + if s.b then 1 else 0, u + s.u)
+
+#guard run [.add, .dup, .mul, .nop, .neg, .swap, .drop, .sub] == [-9]
+#guard [Op.add, .nop, .dup, .drop].map Op.arity == [2, 0, 1, 1]
+#guard countDown 1000000 0 == 2999998
+#guard (List.range 6).map classify == ["even/three!", "odd!", "even!", "odd/three!", "even!", "odd/five!"]
+#guard classify 10 == "even/five!"
+#guard bigTable[42]! + bigTable.size == 226
+#guard (List.range 5).map (addThree 1 2) == [3, 4, 5, 6, 7]
+#guard sumS ((List.range 10).toArray.map mkS) == (22.5, 315, 5, 55)
+#guard (mkS 3).x + 0.25 == 1.75
+
+-- the same functions are interpreted again from later commands
+#guard countDown 100 0 == 297
+#guard (List.range 4).map classify == ["even/three!", "odd!", "even!", "odd/three!"]
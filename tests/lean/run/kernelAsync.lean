@@ -0,0 +1,25 @@
+import Lean
+
+open Lean
+
+def t1 : Nat := 2 + 3
+
+def eqNat (a b : Expr) : Expr := mkApp3 (mkConst ``Eq [levelOne]) (mkConst ``Nat) a b
+def reflNat (a : Expr) : Expr := mkApp2 (mkConst ``Eq.refl [levelOne]) (mkConst ``Nat) a
+
+def thm (n : Name) (type value : Expr) : Declaration :=
+  .thmDecl { name := n, levelParams := [], type, value }
+
+#eval show CoreM Unit from do
+  let .ok (env, t) := (← getEnv).addDeclAsync (thm `ok (eqNat (mkConst ``t1) (mkNatLit 5)) (reflNat (mkNatLit 5)))
+    | throwError "header rejected"
+  unless env.contains `ok do
+    throwError "missing declaration"
+  let .ok () := t.get | throwError "value rejected"
+  -- the header is fine, so the error is only reported by the task
+  let .ok (_, t) := env.addDeclAsync (thm `bad (eqNat (mkConst ``t1) (mkNatLit 6)) (reflNat (mkNatLit 5)))
+    | throwError "header rejected"
+  let .error _ := t.get | throwError "kernel accepted wrong theorem"
+  -- ill-typed headers are still rejected synchronously
+  let .error _ := env.addDeclAsync (thm `bad2 (mkNatLit 5) (reflNat (mkNatLit 5)))
+    | throwError "kernel accepted theorem whose type is not a proposition"
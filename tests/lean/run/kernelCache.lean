@@ -0,0 +1,48 @@
+import Lean
+
+open Lean
+
+def t1 : Nat := 2 + 3
+
+def eqNat (a b : Expr) : Expr := mkApp3 (mkConst ``Eq [levelOne]) (mkConst ``Nat) a b
+def reflNat (a : Expr) : Expr := mkApp2 (mkConst ``Eq.refl [levelOne]) (mkConst ``Nat) a
+
+def thm (n : Name) (type value : Expr) : Declaration :=
+  .thmDecl { name := n, levelParams := [], type, value }
+
+#eval show CoreM Unit from do
+  let cache ← Kernel.Cache.new
+  let mut env ← getEnv
+  for i in [0:3] do
+    match env.addDeclWithCache (thm (.mkSimple s!"ok{i}") (eqNat (mkConst ``t1) (mkNatLit 5)) (reflNat (mkNatLit 5))) cache with
+    | .ok env' => env := env'
+    | .error _ => throwError "unexpected kernel error"
+  -- shared results must not make the kernel accept a wrong proof
+  match env.addDeclWithCache (thm `bad (eqNat (mkConst ``t1) (mkNatLit 6)) (reflNat (mkNatLit 5))) cache with
+  | .ok _    => throwError "kernel accepted wrong theorem"
+  | .error _ => pure ()
+  unless env.contains `ok2 do
+    throwError "missing declaration"
+
+def natDefn (n : Name) (value : Expr) (safety := DefinitionSafety.safe) : DefinitionVal :=
+  { name := n, levelParams := [], type := mkConst ``Nat, value, hints := .abbrev, safety }
+
+-- results computed while checking a rejected declaration must not be reused later
+#eval show CoreM Unit from do
+  let cache ← Kernel.Cache.new
+  let env ← getEnv
+  let f := mkConst `cachedF
+  -- `cachedF` is unfolded to `1` before `cachedG` is rejected because of its type
+  let g := mkApp2 (mkConst ``id [levelZero]) (eqNat f (mkNatLit 1)) (reflNat (mkNatLit 1))
+  match env.addDeclWithCache (.mutualDefnDecl [natDefn `cachedF (mkNatLit 1) .unsafe, natDefn `cachedG g .unsafe]) cache with
+  | .ok _    => throwError "kernel accepted ill-typed definition"
+  | .error _ => pure ()
+  let env ← match env.addDeclWithCache (.defnDecl (natDefn `cachedF (mkNatLit 2))) cache with
+    | .ok env  => pure env
+    | .error _ => throwError "unexpected kernel error"
+  match env.addDeclWithCache (thm `cachedBad (eqNat f (mkNatLit 1)) (reflNat (mkNatLit 1))) cache with
+  | .ok _    => throwError "kernel used a result of a rejected declaration"
+  | .error _ => pure ()
+  match env.addDeclWithCache (thm `cachedOk (eqNat f (mkNatLit 2)) (reflNat (mkNatLit 2))) cache with
+  | .ok _    => pure ()
+  | .error _ => throwError "unexpected kernel error"
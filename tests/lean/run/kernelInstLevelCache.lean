@@ -0,0 +1,10 @@
+universe u v
+
+def idU {α : Sort u} (a : α) : α := a
+def constU {α : Sort u} {β : Sort v} (a : α) (_ : β) : α := a
+
+-- the same constants at the same levels over and over, and at different levels
+theorem t1 : idU.{1} (constU.{1, 1} 2 3) = 2 := rfl
+theorem t2 : idU.{1} (constU.{1, 1} 2 3) = idU.{1} 2 := rfl
+theorem t3 : idU.{2} (constU.{2, 1} Nat 3) = Nat := rfl
+theorem t4 : idU.{1} (constU.{1, 2} 2 Nat) = constU.{1, 1} 2 3 := rfl
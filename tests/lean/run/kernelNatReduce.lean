@@ -0,0 +1,18 @@
+import Lean
+
+open Lean
+
+def kernelWhnf (e : Expr) : CoreM Expr := do
+  ofExceptKernelException (Kernel.whnf (← getEnv) {} e)
+
+def check (e : Expr) (expected : Nat) : CoreM Unit := do
+  let r ← kernelWhnf e
+  unless r == mkRawNatLit expected do
+    throwError "unexpected result {r} for {e}, expected {expected}"
+
+#eval check (mkApp (mkConst ``Nat.log2) (mkRawNatLit 0)) 0
+#eval check (mkApp (mkConst ``Nat.log2) (mkRawNatLit 1000000)) 19
+#eval check (mkApp (mkConst ``Nat.log2) (mkRawNatLit (2^200 + 1))) 200
+#eval check (mkApp (mkConst ``Nat.pred) (mkRawNatLit 0)) 0
+#eval check (mkApp (mkConst ``Nat.pred) (mkRawNatLit (2^100))) (2^100 - 1)
+#eval check (mkApp2 (mkConst ``Nat.add) (mkRawNatLit 2) (mkApp (mkConst ``Nat.succ) (mkRawNatLit 3))) 6
@@ -0,0 +1,38 @@
+import Lean
+
+open Lean
+
+def t1 : Nat := 2 + 3
+def t2 : Nat := t1 + t1
+
+def eqNat (a b : Expr) : Expr := mkApp3 (mkConst ``Eq [levelOne]) (mkConst ``Nat) a b
+def reflNat (a : Expr) : Expr := mkApp2 (mkConst ``Eq.refl [levelOne]) (mkConst ``Nat) a
+
+def thm (n : Name) (type value : Expr) : Declaration :=
+  .thmDecl { name := n, levelParams := [], type, value }
+
+def getNat (j : Json) (path : List String) : CoreM Nat := do
+  let some j := path.foldlM (fun j k => (j.getObjVal? k).toOption) j | throwError "missing {path}"
+  let .ok n := j.getNat? | throwError "not a number: {path}"
+  return n
+
+#eval show CoreM Unit from do
+  let (res, stats) := (← getEnv).addDeclWithStats (thm `ok (eqNat (mkConst ``t2) (mkNatLit 10)) (reflNat (mkNatLit 10))) 1
+  let .ok _ := res | throwError "unexpected kernel error"
+  let .ok j := Json.parse stats | throwError "invalid JSON: {stats}"
+  unless (← getNat j ["unfold_definition"]) ≥ 2 do
+    throwError "expected t1 and t2 to be unfolded: {stats}"
+  discard <| getNat j ["cache", "whnf", "hits"]
+  discard <| getNat j ["cache", "failure", "hits"]
+  discard <| getNat j ["cache", "instantiate_lparams", "hits"]
+  let .ok unfolded := j.getObjValAs? (Array Json) "unfolded" | throwError "missing unfolded: {stats}"
+  unless unfolded.size == 1 do
+    throwError "expected a single unfolded constant: {stats}"
+
+-- statistics are reported even if checking fails
+#eval show CoreM Unit from do
+  let (res, stats) := (← getEnv).addDeclWithStats (thm `bad (eqNat (mkConst ``t2) (mkNatLit 11)) (reflNat (mkNatLit 10))) 10
+  let .error _ := res | throwError "kernel accepted wrong theorem"
+  let .ok j := Json.parse stats | throwError "invalid JSON: {stats}"
+  unless (← getNat j ["is_def_eq_core"]) > 0 do
+    throwError "expected definitional equality checks: {stats}"
@@ -0,0 +1,74 @@
+import Lean.Replay
+
+open Lean
+
+namespace ReplayTest
+
+inductive Tree where
+  | leaf
+  | node (l r : Tree)
+
+def Tree.size : Tree → Nat
+  | .leaf => 1
+  | .node l r => l.size + r.size + 1
+
+mutual
+inductive Even : Nat → Prop
+  | zero : Even 0
+  | succ : Odd n → Even (n + 1)
+inductive Odd : Nat → Prop
+  | succ : Even n → Odd (n + 1)
+end
+
+structure Point where
+  x : Nat
+  y : Nat
+
+def Point.add (p q : Point) : Point := ⟨p.x + q.x, p.y + q.y⟩
+
+theorem Point.add_x (p q : Point) : (p.add q).x = p.x + q.x := rfl
+theorem Tree.size_node (l r : Tree) : (Tree.node l r).size = l.size + r.size + 1 := rfl
+theorem even_two : Even 2 := .succ (.succ .zero)
+
+end ReplayTest
+
+/-- The declarations of this file that are checked below, i.e. not the test code itself. -/
+def localConstants : CoreM (HashMap Name ConstantInfo) := do
+  let mut cs := {}
+  for (n, ci) in (← getEnv).constants.map₂.toList do
+    if (`ReplayTest).isPrefixOf n then
+      cs := cs.insert n ci
+  return cs
+
+def replayOnInit (cs : HashMap Name ConstantInfo) : CoreM (Option Environment) := do
+  let base ← importModules #[{ module := `Init }] {}
+  try
+    return some (← base.replayParallel cs)
+  catch _ =>
+    return none
+
+#eval show CoreM Unit from do
+  let cs ← localConstants
+  let some env ← replayOnInit cs | throwError "kernel rejected declarations"
+  for (n, ci) in cs.toList do
+    -- unsafe and partial constants, such as the compiler's auxiliary definitions, are skipped
+    unless ci.isUnsafe || ci.isPartial || env.contains n do
+      throwError "missing {n}"
+
+-- the same declarations, except for a wrong proof, are rejected
+#eval show CoreM Unit from do
+  let cs ← localConstants
+  let some (.thmInfo val) := cs.find? ``ReplayTest.Point.add_x | throwError "unexpected"
+  let cs := cs.insert ``ReplayTest.Point.add_x (.thmInfo { val with value := mkConst ``ReplayTest.even_two })
+  if (← replayOnInit cs).isSome then
+    throwError "kernel accepted wrong theorem"
+
+-- generated declarations must agree in all fields, not just their types
+#eval show CoreM Unit from do
+  let cs ← localConstants
+  let some (.ctorInfo val) := cs.find? ``ReplayTest.Tree.node | throwError "unexpected"
+  let some (.recInfo rval) := cs.find? ``ReplayTest.Tree.rec | throwError "unexpected"
+  for cs in [cs.insert ``ReplayTest.Tree.node (.ctorInfo { val with cidx := 0 }),
+             cs.insert ``ReplayTest.Tree.rec (.recInfo { rval with k := !rval.k })] do
+    if (← replayOnInit cs).isSome then
+      throwError "kernel accepted forged generated declaration"
@@ -145,3 +145,37 @@ check $ ptrAddrUnsafe a != ptrAddrUnsafe c
 pure ()
 
 #eval (tst6 2).run
+
+unsafe def tst7 : IO Unit := do
+  let a := mkArray1 3
+  let b := mkArray2 3
+  let a := _root_.ShareCommon.shareCommon' a
+  unless ptrAddrUnsafe a[0]! == ptrAddrUnsafe a[1]! && ptrAddrUnsafe a[0]! != ptrAddrUnsafe a[2]! do
+    throw $ IO.userError "check failed"
+  -- `shareCommon'` does not keep any state between calls
+  let b := _root_.ShareCommon.shareCommon' b
+  unless ptrAddrUnsafe a != ptrAddrUnsafe b && ptrAddrUnsafe b[0]! == ptrAddrUnsafe b[1]! do
+    throw $ IO.userError "check failed"
+  -- it can be used on different objects in parallel
+  let ts ← (List.range 8).mapM fun i => IO.asTask (pure (_root_.ShareCommon.shareCommon' (mkArray1 i)))
+  for t in ts do
+    let a ← IO.ofExcept t.get
+    unless ptrAddrUnsafe a[0]! == ptrAddrUnsafe a[1]! do
+      throw $ IO.userError "check failed"
+  IO.println a
+
+#eval tst7
+
+unsafe def tst8 : IO Unit := do
+  let s := _root_.ShareCommon.State.mk.{0} nativeObjectFactory
+  let (x, s₁) := s.shareCommon [1]
+  -- `s` is still used below, so `s₁` must be a copy of it
+  let (y, s₂) := s.shareCommon ([0].map (· + 1))
+  let (z, _) := s₁.shareCommon ([0].map (· + 1))
+  unless ptrAddrUnsafe x != ptrAddrUnsafe y && ptrAddrUnsafe x == ptrAddrUnsafe z do
+    throw $ IO.userError "check failed"
+  let (w, _) := s₂.shareCommon [1]
+  unless ptrAddrUnsafe y == ptrAddrUnsafe w do
+    throw $ IO.userError "check failed"
+
+#eval tst8
@@ -0,0 +1,16 @@
+import Lean.Data.Json
+open Lean
+
+/-! Appending to and extracting from strings that are shared instead of copied. -/
+
+def s : String := "hello"
+
+#guard "" ++ s == "hello"
+#guard s ++ "" == "hello"
+#guard ("" ++ s) ++ " world" == "hello world" && s == "hello"
+#guard s.extract 0 s.endPos == s
+#guard (s.extract 0 ⟨100⟩ ++ "!") == "hello!" && s == "hello"
+
+#guard (Json.mkObj [("a\"b", "c\\d\n"), ("e", Json.arr #[1, "f\u0001"])]).compress ==
+  "{\"e\":[1,\"f\\u0001\"],\"a\\\"b\":\"c\\\\d\\n\"}"
+#guard Json.renderString "x\"y" == "\"x\\\"y\""
@@ -0,0 +1,27 @@
+/-! String operations on pure ASCII strings, which use byte positions as character indices. -/
+
+def s : String := "hello world"
+def u : String := "héllo wörld"
+
+#guard s.prev ⟨0⟩ == ⟨0⟩
+#guard s.prev ⟨5⟩ == ⟨4⟩
+#guard s.prev s.endPos == ⟨10⟩
+#guard s.prev ⟨100⟩ == ⟨0⟩
+#guard u.prev ⟨3⟩ == ⟨1⟩
+#guard s.back == 'd'
+#guard u.back == 'd'
+
+#guard s.offsetOfPos ⟨3⟩ == 3
+#guard s.offsetOfPos ⟨100⟩ == 11
+#guard u.offsetOfPos ⟨3⟩ == 2
+
+#guard s.extract ⟨6⟩ ⟨100⟩ == "world"
+#guard (s.extract ⟨6⟩ ⟨100⟩).length == 5
+#guard s.extract ⟨3⟩ ⟨3⟩ == ""
+#guard (u.extract ⟨0⟩ ⟨6⟩).length == 5
+
+-- `set` on a shared string must not modify the original one
+def t : String := s.set ⟨0⟩ 'j'
+#guard t == "jello world" && s == "hello world"
+#guard (s.set ⟨0⟩ 'é') == "éello world"
+#guard (s.set ⟨0⟩ 'é').length == 11
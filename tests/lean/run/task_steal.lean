@@ -0,0 +1,38 @@
+/-!
+Tasks spawned from within worker threads go to the worker's local deque and
+are stolen by idle workers. Make sure nested spawns, `map` chains and the
+priority classes all still produce the right results.
+-/
+
+def leaf (i : Nat) : Nat := i + 1
+
+def fanout (n : Nat) (prio : Task.Priority) : Array (Task Nat) := Id.run do
+  let mut ts := #[]
+  for i in [0:n] do
+    let t := Task.spawn (prio := prio) fun _ => leaf i
+    ts := ts.push (t.map (· + 1))
+  return ts
+
+def sumTasks (ts : Array (Task Nat)) : Nat :=
+  ts.foldl (fun s t => s + t.get) 0
+
+def nested (k n : Nat) : IO Unit := do
+  let outer := (List.range k).map fun j =>
+    Task.spawn (prio := if j % 2 == 0 then .default else .max) fun _ => fanout n .default
+  let mut total := 0
+  for t in outer do
+    total := total + sumTasks t.get
+  let expected := k * (n * (n + 1) / 2 + n)
+  unless total == expected do
+    throw <| IO.userError s!"unexpected result {total}, expected {expected}"
+
+#eval nested 32 64
+
+#eval id (α := IO _) do
+  let ts ← (List.range 100).mapM fun i =>
+    IO.asTask (prio := if i % 10 == 0 then .dedicated else .default) (pure i)
+  let mut total := 0
+  for t in ts do
+    total := total + (← IO.ofExcept t.get)
+  unless total == 4950 do
+    throw <| IO.userError s!"unexpected result {total}"
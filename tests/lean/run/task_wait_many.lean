@@ -0,0 +1,21 @@
+/-!
+Several threads blocked on the same task, and `IO.waitAny` over tasks that are
+also being waited on individually, must all be woken up when their task finishes.
+-/
+
+def slow (i : Nat) : Task Nat :=
+  Task.spawn fun _ => dbgSleep (i.toUInt32 * 5) fun _ => i
+
+#eval id (α := IO _) do
+  let base := (List.range 8).map slow
+  let single ← base.mapM fun t => IO.asTask (prio := .dedicated) (pure (t.get * 2))
+  let any ← (List.range 8).mapM fun _ => IO.asTask (prio := .dedicated) (IO.waitAny base)
+  let mut total := 0
+  for t in single do
+    total := total + (← IO.ofExcept t.get)
+  unless total == 56 do
+    throw <| IO.userError s!"unexpected result {total}"
+  for t in any do
+    let v ← IO.ofExcept t.get
+    unless v < 8 do
+      throw <| IO.userError s!"unexpected result {v}"
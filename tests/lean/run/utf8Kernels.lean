@@ -0,0 +1,30 @@
+/-! UTF-8 validation, length computation and position conversion on strings that span several SIMD blocks. -/
+
+def mixed : String := String.join (List.replicate 50 "abc∀x𝔸ü0123456789αβγ")
+def ascii : String := String.mk (List.replicate 1000 'a')
+
+#guard mixed.length == 50 * 20
+#guard (String.fromUTF8! mixed.toUTF8).length == mixed.length
+#guard (String.fromUTF8! (ascii ++ mixed).toUTF8).length == 1000 + mixed.length
+#guard String.validateUTF8 (ascii ++ mixed ++ ascii).toUTF8
+#guard mixed.extract ⟨29⟩ ⟨58⟩ == "abc∀x𝔸ü0123456789αβγ"
+#guard (mixed.extract ⟨29⟩ ⟨58⟩).length == 20
+
+-- invalid sequences at different offsets
+def invalid (pre : String) (bytes : List UInt8) : Bool :=
+  !String.validateUTF8 (pre.toUTF8 ++ ⟨bytes.toArray⟩ ++ ascii.toUTF8)
+
+#guard (List.range 70).all fun n => invalid (String.mk (List.replicate n 'a')) [0x80]
+#guard (List.range 70).all fun n => invalid (String.mk (List.replicate n 'a')) [0xE2, 0x82]
+#guard (List.range 70).all fun n => invalid (String.mk (List.replicate n 'a')) [0xED, 0xA0, 0x80]
+#guard (List.range 70).all fun n => invalid (String.mk (List.replicate n 'a')) [0xC0, 0xAF]
+#guard (List.range 70).all fun n => invalid (String.mk (List.replicate n 'a')) [0xF4, 0x90, 0x80, 0x80]
+#guard !String.validateUTF8 (ascii.toUTF8.push 0xF0)
+
+-- `offsetOfPos` counts the characters starting before the given position
+#guard mixed.offsetOfPos ⟨0⟩ == 0
+#guard mixed.offsetOfPos mixed.endPos == mixed.length
+#guard mixed.offsetOfPos ⟨mixed.utf8ByteSize + 10⟩ == mixed.length
+#guard mixed.offsetOfPos ⟨4⟩ == 4
+#guard mixed.offsetOfPos ⟨5⟩ == 4
+#guard mixed.offsetOfPos (mixed.next (mixed.next ⟨3⟩)) == 5